@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+"""Stub feed for trying out background mode without Classroom.
+
+GET /feed answers with the canned responses in bench/feeds/ in name order,
+one step further on every request and then staying on the last one, so a
+poller sees a baseline, then one new post, then two more. Each response has
+an ETag, and a matching If-None-Match gets 304. The names of the cookies
+sent with each request are logged, to check that the session is reused.
+
+Point the app at it with
+
+  [Background]
+  Enabled=true
+  FeedURL=http://127.0.0.1:8001/feed
+  PollSeconds=30
+
+and serve bench/pages with server.py on port 8000 for the links.
+"""
+
+import argparse
+import hashlib
+import http.server
+import os
+import sys
+import threading
+
+FEEDS_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "feeds")
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    canned = []
+    served = 0
+    lock = threading.Lock()
+
+    def do_GET(self):
+        if self.path.split("?")[0] != "/feed":
+            self.send_error(404)
+            return
+
+        with self.lock:
+            body = self.canned[min(Handler.served, len(self.canned) - 1)]
+            Handler.served += 1
+
+        cookies = [c.split("=", 1)[0].strip() for c in self.headers.get("Cookie", "").split(";") if "=" in c]
+        etag = '"%s"' % hashlib.sha1(body).hexdigest()[:16]
+        print("request %d, cookies: %s" % (Handler.served, ", ".join(cookies) or "none"), file=sys.stderr)
+
+        if self.headers.get("If-None-Match") == etag:
+            self.send_response(304)
+            self.send_header("ETag", etag)
+            self.end_headers()
+            return
+
+        content_type = "application/rss+xml" if b"<rss" in body else "application/atom+xml"
+        self.send_response(200)
+        self.send_header("Content-Type", content_type + "; charset=utf-8")
+        self.send_header("Content-Length", str(len(body)))
+        self.send_header("ETag", etag)
+        self.end_headers()
+        self.wfile.write(body)
+
+    def log_message(self, format, *args):
+        pass
+
+
+def start(port=0, directory=FEEDS_DIR):
+    """Starts the server on a background thread and returns it."""
+    Handler.canned = []
+    for name in sorted(os.listdir(directory)):
+        with open(os.path.join(directory, name), "rb") as f:
+            Handler.canned.append(f.read())
+    Handler.served = 0
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", port), Handler)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    return server
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=8001)
+    args = parser.parse_args()
+
+    server = start(args.port)
+    print("Feed at http://127.0.0.1:%d/feed (%d canned responses)" % (server.server_address[1], len(Handler.canned)),
+          file=sys.stderr)
+    try:
+        threading.Event().wait()
+    except KeyboardInterrupt:
+        server.shutdown()
+
+
+if __name__ == "__main__":
+    main()
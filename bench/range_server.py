@@ -0,0 +1,170 @@
+#!/usr/bin/env python3
+"""Large-file server for trying out segmented, resumable downloads.
+
+GET /file.bin answers with --size-mb of generated bytes as an attachment,
+with Accept-Ranges, an ETag and Last-Modified. A single "Range: bytes=a-b"
+gets 206 with Content-Range, an unsatisfiable one 416, and If-Range with a
+stale validator gets the whole file again. --rate-kbps slows each response
+down so a transfer can be watched or interrupted.
+
+With --drops N, the first N responses are cut off after --drop-after-kb
+each: the connection is closed mid-body, like a flaky link. The engine
+retries a failed segment a few times, so a small N is absorbed without the
+user noticing, and a larger one makes the download fail so that Retry can
+be checked to resume from the journal. Requests are logged to stderr with
+their ranges, and the SHA-256 of the file is printed at startup to compare
+with the downloaded copy.
+
+Point the app at it with
+
+  [Downloads]
+  SegmentThresholdMB=8
+
+and open http://127.0.0.1:8002/file.bin in a tab.
+"""
+
+import argparse
+import email.utils
+import hashlib
+import http.server
+import re
+import sys
+import threading
+import time
+
+CHUNK = 64 * 1024
+RANGE = re.compile(r"^bytes=(\d*)-(\d*)$")
+
+
+def generate(size):
+    """Deterministic, incompressible-looking content."""
+    block = b"".join(hashlib.sha256(b"leaf-class %d" % i).digest() for i in range(CHUNK // 32))
+    return (block * (size // len(block) + 1))[:size]
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    body = b""
+    etag = ""
+    last_modified = ""
+    rate = 0  # bytes per second, 0 for unlimited
+    drops = 0
+    drop_after = 0
+    lock = threading.Lock()
+
+    def parse_range(self):
+        """Returns (start, end) inclusive, None for the whole file, or False if unsatisfiable."""
+        header = self.headers.get("Range")
+        if not header:
+            return None
+        if_range = self.headers.get("If-Range")
+        if if_range and if_range not in (self.etag, self.last_modified):
+            return None
+
+        match = RANGE.match(header.strip())
+        if not match or match.group(1) == match.group(2) == "":
+            return None
+        size = len(self.body)
+        if match.group(1) == "":
+            length = int(match.group(2))
+            start, end = max(size - length, 0), size - 1
+        else:
+            start = int(match.group(1))
+            end = min(int(match.group(2)), size - 1) if match.group(2) else size - 1
+        if start >= size or start > end:
+            return False
+        return start, end
+
+    def respond(self, send_body):
+        if self.path.split("?")[0] != "/file.bin":
+            self.send_error(404)
+            return
+
+        byte_range = self.parse_range()
+        if byte_range is False:
+            self.send_response(416)
+            self.send_header("Content-Range", "bytes */%d" % len(self.body))
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+            return
+
+        start, end = byte_range or (0, len(self.body) - 1)
+        self.send_response(206 if byte_range else 200)
+        self.send_header("Content-Type", "application/octet-stream")
+        self.send_header("Content-Disposition", 'attachment; filename="file.bin"')
+        self.send_header("Accept-Ranges", "bytes")
+        self.send_header("ETag", self.etag)
+        self.send_header("Last-Modified", self.last_modified)
+        self.send_header("Content-Length", str(end - start + 1))
+        if byte_range:
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (start, end, len(self.body)))
+        self.end_headers()
+        if not send_body:
+            return
+
+        with self.lock:
+            drop = Handler.drops > 0
+            if drop:
+                Handler.drops -= 1
+        print("%s bytes %d-%d%s" % (self.command, start, end, ", dropping" if drop else ""), file=sys.stderr)
+
+        limit = end + 1 if not drop else min(end + 1, start + self.drop_after)
+        offset = start
+        while offset < limit:
+            chunk = self.body[offset:min(offset + CHUNK, limit)]
+            try:
+                self.wfile.write(chunk)
+            except (BrokenPipeError, ConnectionResetError):
+                return
+            offset += len(chunk)
+            if self.rate:
+                time.sleep(len(chunk) / self.rate)
+
+        if drop:
+            self.close_connection = True
+            self.wfile.flush()
+            self.connection.shutdown(2)
+
+    def do_GET(self):
+        self.respond(True)
+
+    def do_HEAD(self):
+        self.respond(False)
+
+    def log_message(self, format, *args):
+        pass
+
+
+def start(port=0, size_mb=64, rate_kbps=0, drops=0, drop_after_kb=1024):
+    """Starts the server on a background thread and returns it."""
+    Handler.body = generate(size_mb * 1024 * 1024)
+    Handler.etag = '"%s"' % hashlib.sha1(Handler.body[:CHUNK]).hexdigest()[:16]
+    Handler.last_modified = email.utils.formatdate(usegmt=True)
+    Handler.rate = rate_kbps * 1024
+    Handler.drops = drops
+    Handler.drop_after = drop_after_kb * 1024
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", port), Handler)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    return server
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=8002)
+    parser.add_argument("--size-mb", type=int, default=64)
+    parser.add_argument("--rate-kbps", type=int, default=0, help="per-response bandwidth limit, 0 for none")
+    parser.add_argument("--drops", type=int, default=0, help="cut off this many responses")
+    parser.add_argument("--drop-after-kb", type=int, default=1024, help="where a dropped response is cut off")
+    args = parser.parse_args()
+
+    server = start(args.port, args.size_mb, args.rate_kbps, args.drops, args.drop_after_kb)
+    print("File at http://127.0.0.1:%d/file.bin (%d MB, sha256 %s)"
+          % (server.server_address[1], args.size_mb, hashlib.sha256(Handler.body).hexdigest()), file=sys.stderr)
+    try:
+        threading.Event().wait()
+    except KeyboardInterrupt:
+        server.shutdown()
+
+
+if __name__ == "__main__":
+    main()
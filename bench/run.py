@@ -0,0 +1,305 @@
+#!/usr/bin/env python3
+"""Startup and navigation benchmark for Leaf Class.
+
+Starts the app N times per theme under its own Xvfb display and session bus,
+pointed at the local stand-in server (server.py). Each run uses a fresh
+config, data and cache directory. Metrics come from the app's --trace
+output and from sampling /proc:
+
+  first_commit_ms, first_paint_ms   since process start
+  load_ms                           navigation start to load finished
+  darkreader_enable_ms              DarkReader.enable() inside the page
+  theme_toggle_ms                   action activated to the next window paint
+  peak_rss_mb                       app plus all WebKit processes together
+
+Medians, minima and the raw samples are written as JSON. Run with
+"cmake --build build --target bench", or directly:
+
+  bench/run.py --app build/LeafClass --runs 5 --output bench.json
+"""
+
+import argparse
+import json
+import os
+import shutil
+import signal
+import statistics
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+import server
+
+APP_ID = "com.example.LeafClass"
+APP_PATH = "/com/example/LeafClass"
+
+
+def read_trace(path):
+    """Parses a trace that may still be open (no closing bracket yet)."""
+    try:
+        with open(path) as f:
+            text = f.read().strip()
+    except FileNotFoundError:
+        return []
+    if not text:
+        return []
+    if not text.endswith("]"):
+        text = text.rstrip(",") + "]"
+    try:
+        return json.loads(text)
+    except ValueError:
+        # Caught mid-write; drop the partial last event
+        text = text[: text.rstrip("]").rfind("\n")].rstrip(",") + "]"
+        try:
+            return json.loads(text)
+        except ValueError:
+            return []
+
+
+def find_event(events, name, category=None, phase=None):
+    for event in events:
+        if event.get("name") == name and (category is None or event.get("cat") == category) \
+                and (phase is None or event.get("ph") == phase):
+            return event
+    return None
+
+
+def process_tree_rss(root):
+    """RSS in bytes of root and all of its descendants."""
+    parents = {}
+    rss = {}
+    page = os.sysconf("SC_PAGE_SIZE")
+    for name in os.listdir("/proc"):
+        if not name.isdigit():
+            continue
+        try:
+            with open("/proc/%s/stat" % name) as f:
+                fields = f.read().rsplit(")", 1)[1].split()
+        except (OSError, IndexError):
+            continue
+        parents[int(name)] = int(fields[1])
+        rss[int(name)] = int(fields[21]) * page
+    total = 0
+    for pid in rss:
+        p = pid
+        while p > 1:
+            if p == root:
+                total += rss[pid]
+                break
+            p = parents.get(p, 0)
+    return total
+
+
+class RssSampler(threading.Thread):
+    def __init__(self, pid, interval=0.1):
+        super().__init__(daemon=True)
+        self.pid = pid
+        self.interval = interval
+        self.peak = 0
+        self.stopped = threading.Event()
+
+    def run(self):
+        while not self.stopped.is_set():
+            self.peak = max(self.peak, process_tree_rss(self.pid))
+            self.stopped.wait(self.interval)
+
+
+def wait_for(predicate, timeout, interval=0.05):
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        result = predicate()
+        if result:
+            return result
+        time.sleep(interval)
+    return None
+
+
+def start_xvfb():
+    read_fd, write_fd = os.pipe()
+    xvfb = subprocess.Popen(["Xvfb", "-displayfd", str(write_fd), "-screen", "0", "1280x800x24", "-nolisten", "tcp"],
+                            pass_fds=(write_fd,), stderr=subprocess.DEVNULL)
+    os.close(write_fd)
+    with os.fdopen(read_fd) as f:
+        display = f.readline().strip()
+    return xvfb, ":" + display
+
+
+def start_session_bus():
+    output = subprocess.check_output(["dbus-daemon", "--session", "--fork", "--print-address=1", "--print-pid=1"], text=True)
+    address, pid = output.split()[:2]
+    return address, int(pid)
+
+
+def write_config(root, theme, width, height):
+    config_dir = os.path.join(root, "config", "leaf-class")
+    os.makedirs(config_dir)
+    with open(os.path.join(config_dir, "config.ini"), "w") as f:
+        f.write("[General]\nTheme=%s\nWidth=%d\nHeight=%d\n\n[Tabs]\nHibernateMinutes=0\n\n[Offline]\nMaxMB=0\n"
+                % (theme, width, height))
+
+
+def activate_theme(env, theme):
+    subprocess.run(["gdbus", "call", "--session", "--dest", APP_ID, "--object-path", APP_PATH,
+                    "--method", "org.freedesktop.Application.ActivateAction",
+                    "theme", "[<'%s'>]" % theme, "{}"],
+                   env=env, check=False, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+
+def run_once(args, env, url, theme):
+    root = tempfile.mkdtemp(prefix="leaf-class-bench-")
+    trace_path = os.path.join(root, "trace.json")
+    write_config(root, theme, 1280, 800)
+
+    run_env = dict(env)
+    run_env.update({
+        "XDG_CONFIG_HOME": os.path.join(root, "config"),
+        "XDG_DATA_HOME": os.path.join(root, "data"),
+        "XDG_CACHE_HOME": os.path.join(root, "cache"),
+    })
+
+    app = subprocess.Popen([args.app, "--url", url, "--trace", trace_path], env=run_env,
+                           stdout=subprocess.DEVNULL, stderr=None if args.verbose else subprocess.DEVNULL)
+    sampler = RssSampler(app.pid)
+    sampler.start()
+
+    result = {}
+    try:
+        def loaded():
+            events = read_trace(trace_path)
+            done = find_event(events, "load", "navigation", "E") and find_event(events, "first paint", "startup")
+            return events if done else None
+
+        events = wait_for(loaded, args.timeout)
+        if not events:
+            raise RuntimeError("page did not finish loading within %ds" % args.timeout)
+
+        # Give Navigation Timing and DarkReader a moment to report
+        time.sleep(args.settle)
+
+        other = "light" if theme == "dark" else "dark"
+        toggle_start = time.monotonic()
+        activate_theme(run_env, other)
+        painted = wait_for(lambda: find_event(read_trace(trace_path), "theme painted", "ui"), args.timeout)
+        time.sleep(args.settle)
+
+        events = read_trace(trace_path)
+        origin = find_event(events, "command line", "startup")["ts"]
+        start = find_event(events, "load", "navigation", "B")
+        finish = find_event(events, "load", "navigation", "E")
+        result["first_commit_ms"] = (find_event(events, "first commit", "startup")["ts"] - origin) / 1000.0
+        result["first_paint_ms"] = (find_event(events, "first paint", "startup")["ts"] - origin) / 1000.0
+        result["load_ms"] = (finish["ts"] - start["ts"]) / 1000.0
+
+        enable = find_event(events, "DarkReader.enable", "page", "X")
+        if enable:
+            result["darkreader_enable_ms"] = enable["dur"] / 1000.0
+
+        toggle = find_event(events, "theme toggle", "ui", "X")
+        if toggle and painted:
+            result["theme_toggle_ms"] = (painted["ts"] - toggle["ts"]) / 1000.0
+        elif painted is None:
+            result["theme_toggle_ms"] = None
+            print("warning: theme toggle was not observed (%.1fs)" % (time.monotonic() - toggle_start), file=sys.stderr)
+    finally:
+        sampler.stopped.set()
+        sampler.join()
+        app.send_signal(signal.SIGTERM)
+        try:
+            app.wait(10)
+        except subprocess.TimeoutExpired:
+            app.kill()
+            app.wait()
+        if args.keep_traces:
+            shutil.copy(trace_path, os.path.join(args.keep_traces, "%s-%d.json" % (theme, len(os.listdir(args.keep_traces)))))
+        shutil.rmtree(root, ignore_errors=True)
+
+    result["peak_rss_mb"] = sampler.peak / (1024.0 * 1024.0)
+    return result
+
+
+def summarize(samples):
+    summary = {}
+    for key in sorted({k for sample in samples for k in sample}):
+        values = [sample[key] for sample in samples if sample.get(key) is not None]
+        if values:
+            summary[key] = {"median": statistics.median(values), "min": min(values), "max": max(values), "samples": values}
+    return summary
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--app", required=True, help="path to the LeafClass binary")
+    parser.add_argument("--runs", type=int, default=5)
+    parser.add_argument("--page", default="stream.html", help="page under bench/pages to load")
+    parser.add_argument("--delay-ms", type=int, default=0, help="latency the server adds to every response")
+    parser.add_argument("--timeout", type=int, default=60)
+    parser.add_argument("--settle", type=float, default=1.0, help="seconds to wait after load and toggle")
+    parser.add_argument("--output", help="JSON file to write (default: stdout)")
+    parser.add_argument("--keep-traces", help="directory to keep every run's trace in")
+    parser.add_argument("--no-xvfb", action="store_true", help="use the current $DISPLAY")
+    parser.add_argument("--verbose", action="store_true")
+    args = parser.parse_args()
+
+    args.app = os.path.abspath(args.app)
+    if args.keep_traces:
+        os.makedirs(args.keep_traces, exist_ok=True)
+
+    http = server.start(delay_ms=args.delay_ms)
+    url = "http://127.0.0.1:%d/%s" % (http.server_address[1], args.page)
+
+    env = dict(os.environ)
+    env["GDK_BACKEND"] = "x11"
+    env.pop("WAYLAND_DISPLAY", None)
+
+    xvfb = None
+    bus_pid = None
+    try:
+        if not args.no_xvfb:
+            xvfb, env["DISPLAY"] = start_xvfb()
+        env["DBUS_SESSION_BUS_ADDRESS"], bus_pid = start_session_bus()
+
+        results = {}
+        for theme in ("light", "dark"):
+            samples = []
+            for i in range(args.runs):
+                sample = run_once(args, env, url, theme)
+                print("%s run %d/%d: %s" % (theme, i + 1, args.runs, json.dumps(sample)), file=sys.stderr)
+                samples.append(sample)
+            results[theme] = summarize(samples)
+    finally:
+        if bus_pid:
+            os.kill(bus_pid, signal.SIGTERM)
+        if xvfb:
+            xvfb.terminate()
+            xvfb.wait()
+        http.shutdown()
+
+    def median(theme, key):
+        return results[theme].get(key, {}).get("median")
+
+    report = {
+        "app": args.app,
+        "url": url,
+        "runs": args.runs,
+        "delay_ms": args.delay_ms,
+        "results": results,
+        # What dark mode costs on top of the light theme
+        "darkreader_overhead_ms": {
+            key: median("dark", key) - median("light", key)
+            for key in ("first_paint_ms", "load_ms")
+            if median("dark", key) is not None and median("light", key) is not None
+        },
+    }
+
+    text = json.dumps(report, indent=2)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text + "\n")
+    else:
+        print(text)
+
+
+if __name__ == "__main__":
+    main()
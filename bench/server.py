@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+"""Serves bench/pages on 127.0.0.1 as a stand-in for Classroom.
+
+Every response can be delayed to imitate a slow link, and nothing is cached
+by the client, so each run downloads the same bytes.
+"""
+
+import argparse
+import functools
+import http.server
+import os
+import sys
+import threading
+import time
+
+
+class Handler(http.server.SimpleHTTPRequestHandler):
+    delay = 0.0
+
+    def end_headers(self):
+        self.send_header("Cache-Control", "no-store")
+        super().end_headers()
+
+    def do_GET(self):
+        if self.delay:
+            time.sleep(self.delay)
+        super().do_GET()
+
+    def log_message(self, format, *args):
+        pass
+
+
+def start(port=0, delay_ms=0, directory=None):
+    """Starts the server on a background thread and returns it."""
+    directory = directory or os.path.join(os.path.dirname(os.path.abspath(__file__)), "pages")
+    handler = functools.partial(Handler, directory=directory)
+    Handler.delay = delay_ms / 1000.0
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", port), handler)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    return server
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--port", type=int, default=8000)
+    parser.add_argument("--delay-ms", type=int, default=0, help="latency added to every response")
+    args = parser.parse_args()
+
+    server = start(args.port, args.delay_ms)
+    print("Serving on http://127.0.0.1:%d/" % server.server_address[1], file=sys.stderr)
+    try:
+        threading.Event().wait()
+    except KeyboardInterrupt:
+        server.shutdown()
+
+
+if __name__ == "__main__":
+    main()
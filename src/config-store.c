@@ -0,0 +1,134 @@
+#include "config-store.h"
+
+#include <gio/gio.h>
+
+struct _ConfigStore {
+    char *path;
+    guint delay_ms;
+    ConfigStoreSerialize serialize;
+    ConfigStoreFill fill;
+    gpointer user_data;
+    guint flush_id;
+    guint64 generation;  // bumped for every snapshot handed to a writer
+
+    // Writers run one at a time and never replace a newer snapshot
+    GMutex write_lock;
+    guint64 written_generation;
+};
+
+typedef struct {
+    ConfigStore *store;
+    char *data;
+    gsize length;
+    guint64 generation;
+} ConfigWrite;
+
+// Every store, so shutdown can flush them all
+static GSList *stores = NULL;
+
+static void config_write_free(ConfigWrite *write) {
+    g_free(write->data);
+    g_free(write);
+}
+
+// Called with write_lock held
+static void write_locked(ConfigWrite *write) {
+    ConfigStore *store = write->store;
+    GError *error = NULL;
+
+    if (write->generation > store->written_generation) {
+        char *dir = g_path_get_dirname(store->path);
+        g_mkdir_with_parents(dir, 0700);
+        g_free(dir);
+
+        if (g_file_set_contents(store->path, write->data, write->length, &error)) {
+            store->written_generation = write->generation;
+        } else {
+            g_warning("Could not save settings: %s", error->message);
+            g_error_free(error);
+        }
+    }
+}
+
+static void write_snapshot(ConfigWrite *write) {
+    g_mutex_lock(&write->store->write_lock);
+    write_locked(write);
+    g_mutex_unlock(&write->store->write_lock);
+}
+
+static void write_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+    write_snapshot(task_data);
+    g_task_return_boolean(task, TRUE);
+}
+
+static ConfigWrite *take_snapshot(ConfigStore *store) {
+    ConfigWrite *write = g_new0(ConfigWrite, 1);
+    write->store = store;
+    if (store->fill) {
+        GKeyFile *key_file = g_key_file_new();
+        store->fill(key_file, store->user_data);
+        write->data = g_key_file_to_data(key_file, &write->length, NULL);
+        g_key_file_free(key_file);
+    } else {
+        write->data = store->serialize(&write->length, store->user_data);
+    }
+    write->generation = ++store->generation;
+    return write;
+}
+
+static gboolean on_flush_timeout(gpointer user_data) {
+    ConfigStore *store = user_data;
+    store->flush_id = 0;
+
+    GTask *task = g_task_new(NULL, NULL, NULL, NULL);
+    g_task_set_task_data(task, take_snapshot(store), (GDestroyNotify)config_write_free);
+    g_task_run_in_thread(task, write_thread);
+    g_object_unref(task);
+    return G_SOURCE_REMOVE;
+}
+
+ConfigStore *config_store_new(const char *path, guint delay_ms, ConfigStoreSerialize serialize, gpointer user_data) {
+    ConfigStore *store = g_new0(ConfigStore, 1);
+    store->path = g_strdup(path);
+    store->delay_ms = delay_ms;
+    store->serialize = serialize;
+    store->user_data = user_data;
+    g_mutex_init(&store->write_lock);
+    stores = g_slist_prepend(stores, store);
+    return store;
+}
+
+ConfigStore *config_store_new_key_file(const char *path, guint delay_ms, ConfigStoreFill fill, gpointer user_data) {
+    ConfigStore *store = config_store_new(path, delay_ms, NULL, user_data);
+    store->fill = fill;
+    return store;
+}
+
+void config_store_mark_dirty(ConfigStore *store) {
+    // Restart the quiet period so a burst of changes is one write
+    if (store->flush_id) g_source_remove(store->flush_id);
+    store->flush_id = g_timeout_add(store->delay_ms, on_flush_timeout, store);
+}
+
+void config_store_flush_sync(ConfigStore *store) {
+    gboolean pending = store->flush_id != 0;
+    if (pending) {
+        g_source_remove(store->flush_id);
+        store->flush_id = 0;
+    }
+
+    // Waits for a write still running on the worker. A snapshot handed to
+    // a worker that hasn't landed yet (queued, or failed) is written again
+    // here from the current state, since the process is about to exit.
+    g_mutex_lock(&store->write_lock);
+    if (pending || store->generation > store->written_generation) {
+        ConfigWrite *write = take_snapshot(store);
+        write_locked(write);
+        config_write_free(write);
+    }
+    g_mutex_unlock(&store->write_lock);
+}
+
+void config_store_flush_all(void) {
+    for (GSList *l = stores; l; l = l->next) config_store_flush_sync(l->data);
+}
@@ -0,0 +1,26 @@
+#ifndef LEAF_CLASS_CONFIG_STORE_H
+#define LEAF_CLASS_CONFIG_STORE_H
+
+#include <glib.h>
+
+// Debounced writer for the settings file and the side-file indexes. Callers keep their state in
+// memory and mark it dirty; after delay_ms of quiet the state is serialized
+// on the main thread and written (with fsync and rename) on a worker thread,
+// so a burst of changes costs one write off the UI thread.
+typedef struct _ConfigStore ConfigStore;
+
+// Returns the whole file; called on the main thread
+typedef char *(*ConfigStoreSerialize)(gsize *length, gpointer user_data);
+
+// Fills a fresh key file with the current state; called on the main thread
+typedef void (*ConfigStoreFill)(GKeyFile *key_file, gpointer user_data);
+
+ConfigStore *config_store_new(const char *path, guint delay_ms, ConfigStoreSerialize serialize, gpointer user_data);
+ConfigStore *config_store_new_key_file(const char *path, guint delay_ms, ConfigStoreFill fill, gpointer user_data);
+void config_store_mark_dirty(ConfigStore *store);
+// Writes pending changes before returning; for shutdown
+void config_store_flush_sync(ConfigStore *store);
+// Flushes every store ever created; for shutdown
+void config_store_flush_all(void);
+
+#endif
@@ -0,0 +1,366 @@
+#include "dark-mode.h"
+
+#include <glib/gstdio.h>
+#include <string.h>
+
+// Hosts whose subframes (Docs previews, Drive pickers) get themed as well
+static const char *const subframe_hosts[] = {
+    "https://*.google.com/*",
+    "https://*.googleusercontent.com/*",
+    NULL
+};
+
+// Hosts that get a cached static sheet in static mode
+static const char *const static_hosts[] = {
+    "classroom.google.com",
+    "docs.google.com",
+    "drive.google.com",
+    NULL
+};
+
+// Bump when the export format or DarkReader options change
+#define DARK_MODE_STATIC_VERSION 1
+#define DARK_MODE_STATIC_MAX_AGE (3 * G_TIME_SPAN_DAY)
+// Give the dynamic engine time to process late stylesheets before exporting
+#define DARK_MODE_EXPORT_DELAY_MS 3000
+
+#define DARK_MODE_OPTIONS "{brightness: 100, contrast: 100, sepia: 0}"
+
+// Turns DarkReader off in a frame and asks its child frames to do the same
+#define DARK_MODE_DISABLE_FRAME \
+    "if (window.DarkReader) DarkReader.disable();" \
+    "window.__leafDarkReader = false;" \
+    "for (let i = 0; i < window.frames.length; i++) window.frames[i].postMessage({leafDarkReader: 'disable'}, '*');"
+
+// Cross-origin resources go through the native fetch cache (leaf://fetch),
+// falling back to the page's own fetch if the bridge is unavailable. The
+// synchronous cost of enable() is left on the page for --trace to collect.
+//
+// Scripts run from C only reach the main frame, so every frame also listens
+// for a disable message from its parent and passes it on to its own frames.
+#define DARK_MODE_ENABLE_SCRIPT \
+    "if (!window.__leafDarkReaderListener) {" \
+    "  window.__leafDarkReaderListener = true;" \
+    "  window.addEventListener('message', (event) => {" \
+    "    if (event.source !== window.parent || !event.data || event.data.leafDarkReader !== 'disable') return;" \
+    DARK_MODE_DISABLE_FRAME \
+    "  });" \
+    "}" \
+    "if (window.DarkReader && !window.__leafDarkReader) {" \
+    "  window.__leafDarkReader = true;" \
+    "  DarkReader.setFetchMethod((url) =>" \
+    "    fetch('leaf://fetch?url=' + encodeURIComponent(url))" \
+    "      .then((r) => r.ok ? r : Promise.reject(r))" \
+    "      .catch(() => fetch(url)));" \
+    "  const start = performance.now();" \
+    "  DarkReader.enable(" DARK_MODE_OPTIONS ");" \
+    "  window.__leafDarkReaderTiming = {start, duration: performance.now() - start};" \
+    "}"
+
+#define DARK_MODE_DISABLE_SCRIPT "{" DARK_MODE_DISABLE_FRAME "}"
+
+#define DARK_MODE_EXPORT_SCRIPT \
+    "return window.DarkReader && window.__leafDarkReader ? await DarkReader.exportGeneratedCSS() : null;"
+
+struct _DarkMode {
+    WebKitUserContentManager *content_manager;
+    GBytes *bundle;
+    WebKitUserScript *top_frame_script;
+    WebKitUserScript *subframe_script;
+    WebKitUserScript *enable_script;
+    gboolean enabled;
+
+    char *static_dir;
+    char *static_header;
+    gboolean use_static;
+    GHashTable *static_sheets;  // host -> WebKitUserStyleSheet
+    GHashTable *exporting;      // hosts with an export in flight
+};
+
+typedef struct {
+    DarkMode *dark_mode;
+    WebKitWebView *webview;
+    char *host;
+    char *css;
+} DarkModeExport;
+
+static gboolean is_static_host(const char *host) {
+    return host && g_strv_contains(static_hosts, host);
+}
+
+static char *static_sheet_path(DarkMode *dark_mode, const char *host) {
+    char *filename = g_strconcat(host, ".css", NULL);
+    char *path = g_build_filename(dark_mode->static_dir, filename, NULL);
+    g_free(filename);
+    return path;
+}
+
+// First line of every cached sheet; a mismatch means the sheet was produced
+// by another DarkReader build or option set and must be regenerated
+static const char *static_header(DarkMode *dark_mode) {
+    if (!dark_mode->static_header) {
+        char *checksum = g_compute_checksum_for_bytes(G_CHECKSUM_SHA1, dark_mode->bundle);
+        dark_mode->static_header = g_strdup_printf("/* leaf-class-static v%d %.12s */\n",
+                                                   DARK_MODE_STATIC_VERSION, checksum);
+        g_free(checksum);
+    }
+    return dark_mode->static_header;
+}
+
+static WebKitUserStyleSheet *static_sheet_new(const char *host, const char *css) {
+    char *pattern = g_strdup_printf("https://%s/*", host);
+    const char *allow_list[] = {pattern, NULL};
+    WebKitUserStyleSheet *sheet = webkit_user_style_sheet_new(
+        css,
+        WEBKIT_USER_CONTENT_INJECT_ALL_FRAMES,
+        WEBKIT_USER_STYLE_LEVEL_AUTHOR,
+        allow_list, NULL);
+    g_free(pattern);
+    return sheet;
+}
+
+static void load_static_sheets(DarkMode *dark_mode) {
+    const char *header = static_header(dark_mode);
+    gint64 now = g_get_real_time();
+
+    for (int i = 0; static_hosts[i] != NULL; i++) {
+        char *path = static_sheet_path(dark_mode, static_hosts[i]);
+        GStatBuf st;
+        char *css = NULL;
+
+        if (g_stat(path, &st) == 0 &&
+            now - (gint64)st.st_mtime * G_USEC_PER_SEC < DARK_MODE_STATIC_MAX_AGE &&
+            g_file_get_contents(path, &css, NULL, NULL) &&
+            g_str_has_prefix(css, header)) {
+            g_hash_table_replace(dark_mode->static_sheets, g_strdup(static_hosts[i]),
+                                 static_sheet_new(static_hosts[i], css));
+        }
+
+        g_free(css);
+        g_free(path);
+    }
+}
+
+static void uninstall(DarkMode *dark_mode) {
+    GHashTableIter iter;
+    gpointer sheet;
+
+    if (dark_mode->top_frame_script) {
+        webkit_user_content_manager_remove_script(dark_mode->content_manager, dark_mode->top_frame_script);
+        webkit_user_content_manager_remove_script(dark_mode->content_manager, dark_mode->subframe_script);
+        webkit_user_content_manager_remove_script(dark_mode->content_manager, dark_mode->enable_script);
+    }
+
+    g_hash_table_iter_init(&iter, dark_mode->static_sheets);
+    while (g_hash_table_iter_next(&iter, NULL, &sheet)) {
+        webkit_user_content_manager_remove_style_sheet(dark_mode->content_manager, sheet);
+    }
+
+    g_clear_pointer(&dark_mode->top_frame_script, webkit_user_script_unref);
+    g_clear_pointer(&dark_mode->subframe_script, webkit_user_script_unref);
+    g_clear_pointer(&dark_mode->enable_script, webkit_user_script_unref);
+}
+
+static void install(DarkMode *dark_mode) {
+    GPtrArray *static_block_list = g_ptr_array_new_with_free_func(g_free);
+    GHashTableIter iter;
+    gpointer host, sheet;
+
+    g_hash_table_iter_init(&iter, dark_mode->static_sheets);
+    while (g_hash_table_iter_next(&iter, &host, &sheet)) {
+        webkit_user_content_manager_add_style_sheet(dark_mode->content_manager, sheet);
+        g_ptr_array_add(static_block_list, g_strdup_printf("https://%s/*", (char *)host));
+    }
+    g_ptr_array_add(static_block_list, NULL);
+
+    // The bundle is NUL-terminated resource data. Top-level documents on
+    // Google hosts are covered by the subframe script, so they are excluded
+    // here to avoid evaluating the bundle twice. Hosts with a fresh static
+    // sheet skip the dynamic engine entirely.
+    const char *bundle_source = g_bytes_get_data(dark_mode->bundle, NULL);
+    dark_mode->top_frame_script = webkit_user_script_new(
+        bundle_source,
+        WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
+        WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START,
+        NULL, subframe_hosts);
+    dark_mode->subframe_script = webkit_user_script_new(
+        bundle_source,
+        WEBKIT_USER_CONTENT_INJECT_ALL_FRAMES,
+        WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START,
+        subframe_hosts, (const char *const *)static_block_list->pdata);
+    dark_mode->enable_script = webkit_user_script_new(
+        DARK_MODE_ENABLE_SCRIPT,
+        WEBKIT_USER_CONTENT_INJECT_ALL_FRAMES,
+        WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_START,
+        NULL, NULL);
+
+    webkit_user_content_manager_add_script(dark_mode->content_manager, dark_mode->top_frame_script);
+    webkit_user_content_manager_add_script(dark_mode->content_manager, dark_mode->subframe_script);
+    webkit_user_content_manager_add_script(dark_mode->content_manager, dark_mode->enable_script);
+
+    g_ptr_array_free(static_block_list, TRUE);
+}
+
+DarkMode *dark_mode_new(WebKitUserContentManager *content_manager, GBytes *bundle, const char *cache_dir) {
+    DarkMode *dark_mode = g_new0(DarkMode, 1);
+    dark_mode->content_manager = g_object_ref(content_manager);
+    dark_mode->bundle = g_bytes_ref(bundle);
+    dark_mode->static_dir = g_build_filename(cache_dir, "dark-static", NULL);
+    dark_mode->static_sheets = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                                     (GDestroyNotify)webkit_user_style_sheet_unref);
+    dark_mode->exporting = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    return dark_mode;
+}
+
+void dark_mode_set_enabled(DarkMode *dark_mode, gboolean enabled) {
+    if (dark_mode->enabled == enabled) return;
+    dark_mode->enabled = enabled;
+
+    if (enabled) {
+        install(dark_mode);
+    } else {
+        uninstall(dark_mode);
+    }
+}
+
+void dark_mode_set_static(DarkMode *dark_mode, gboolean use_static) {
+    if (dark_mode->use_static == use_static) return;
+
+    if (dark_mode->enabled) uninstall(dark_mode);
+
+    dark_mode->use_static = use_static;
+    g_hash_table_remove_all(dark_mode->static_sheets);
+    if (use_static) load_static_sheets(dark_mode);
+
+    if (dark_mode->enabled) install(dark_mode);
+}
+
+static void on_bundle_probe_finished(GObject *object, GAsyncResult *result, gpointer user_data) {
+    WebKitWebView *webview = WEBKIT_WEB_VIEW(object);
+    DarkMode *dark_mode = user_data;
+    JSCValue *value = webkit_web_view_evaluate_javascript_finish(webview, result, NULL);
+
+    // The page was loaded while the theme was light, so the bundle has to be
+    // evaluated once before it can be enabled
+    if (value && !jsc_value_to_boolean(value) && dark_mode->enabled) {
+        gsize length;
+        const char *bundle_source = g_bytes_get_data(dark_mode->bundle, &length);
+        webkit_web_view_evaluate_javascript(webview, bundle_source, length, NULL, NULL, NULL, NULL, NULL);
+    }
+    if (dark_mode->enabled) {
+        webkit_web_view_evaluate_javascript(webview, DARK_MODE_ENABLE_SCRIPT, -1, NULL, NULL, NULL, NULL, NULL);
+    }
+
+    if (value) g_object_unref(value);
+}
+
+void dark_mode_apply(DarkMode *dark_mode, WebKitWebView *webview) {
+    if (dark_mode->enabled) {
+        webkit_web_view_evaluate_javascript(webview, "!!window.DarkReader", -1, NULL, NULL, NULL,
+                                            on_bundle_probe_finished, dark_mode);
+    } else {
+        webkit_web_view_evaluate_javascript(webview, DARK_MODE_DISABLE_SCRIPT, -1, NULL, NULL, NULL, NULL, NULL);
+    }
+}
+
+static void dark_mode_export_free(DarkModeExport *export) {
+    g_hash_table_remove(export->dark_mode->exporting, export->host);
+    g_object_unref(export->webview);
+    g_free(export->host);
+    g_free(export->css);
+    g_free(export);
+}
+
+static void on_static_sheet_written(GObject *object, GAsyncResult *result, gpointer user_data) {
+    DarkModeExport *export = user_data;
+    DarkMode *dark_mode = export->dark_mode;
+    GError *error = NULL;
+
+    if (!g_file_replace_contents_finish(G_FILE(object), result, NULL, &error)) {
+        g_warning("Could not cache dark stylesheet for %s: %s", export->host, error->message);
+        g_error_free(error);
+    } else if (dark_mode->use_static) {
+        // Later loads of this host use the sheet instead of the dynamic engine
+        if (dark_mode->enabled) uninstall(dark_mode);
+        g_hash_table_replace(dark_mode->static_sheets, g_strdup(export->host),
+                             static_sheet_new(export->host, export->css));
+        if (dark_mode->enabled) install(dark_mode);
+    }
+
+    dark_mode_export_free(export);
+}
+
+static void on_generated_css_exported(GObject *object, GAsyncResult *result, gpointer user_data) {
+    DarkModeExport *export = user_data;
+    DarkMode *dark_mode = export->dark_mode;
+    JSCValue *value = webkit_web_view_call_async_javascript_function_finish(WEBKIT_WEB_VIEW(object), result, NULL);
+
+    if (!value || !jsc_value_is_string(value) || !dark_mode->use_static) {
+        if (value) g_object_unref(value);
+        dark_mode_export_free(export);
+        return;
+    }
+
+    char *css = jsc_value_to_string(value);
+    export->css = g_strconcat(static_header(dark_mode), css, NULL);
+    g_free(css);
+    g_object_unref(value);
+
+    g_mkdir_with_parents(dark_mode->static_dir, 0700);
+    char *path = static_sheet_path(dark_mode, export->host);
+    GFile *file = g_file_new_for_path(path);
+    g_file_replace_contents_async(file, export->css, strlen(export->css), NULL, FALSE,
+                                  G_FILE_CREATE_PRIVATE, NULL, on_static_sheet_written, export);
+    g_object_unref(file);
+    g_free(path);
+}
+
+static char *uri_get_host(const char *uri) {
+    GUri *parsed = uri ? g_uri_parse(uri, G_URI_FLAGS_NONE, NULL) : NULL;
+    char *host = NULL;
+
+    if (parsed) {
+        if (g_strcmp0(g_uri_get_scheme(parsed), "https") == 0) {
+            host = g_strdup(g_uri_get_host(parsed));
+        }
+        g_uri_unref(parsed);
+    }
+    return host;
+}
+
+static gboolean on_export_timeout(gpointer user_data) {
+    DarkModeExport *export = user_data;
+    char *host = uri_get_host(webkit_web_view_get_uri(export->webview));
+
+    // Only export if the view is still showing the same host in dynamic mode
+    if (g_strcmp0(host, export->host) == 0 && export->dark_mode->enabled && export->dark_mode->use_static) {
+        webkit_web_view_call_async_javascript_function(export->webview, DARK_MODE_EXPORT_SCRIPT, -1,
+                                                       NULL, NULL, NULL, NULL,
+                                                       on_generated_css_exported, export);
+    } else {
+        dark_mode_export_free(export);
+    }
+
+    g_free(host);
+    return G_SOURCE_REMOVE;
+}
+
+void dark_mode_page_loaded(DarkMode *dark_mode, WebKitWebView *webview) {
+    if (!dark_mode->enabled || !dark_mode->use_static) return;
+
+    char *host = uri_get_host(webkit_web_view_get_uri(webview));
+    if (!is_static_host(host) ||
+        g_hash_table_contains(dark_mode->static_sheets, host) ||
+        g_hash_table_contains(dark_mode->exporting, host)) {
+        g_free(host);
+        return;
+    }
+
+    DarkModeExport *export = g_new0(DarkModeExport, 1);
+    export->dark_mode = dark_mode;
+    export->webview = g_object_ref(webview);
+    export->host = host;
+    g_hash_table_add(dark_mode->exporting, g_strdup(host));
+
+    g_timeout_add(DARK_MODE_EXPORT_DELAY_MS, on_export_timeout, export);
+}
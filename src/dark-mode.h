@@ -0,0 +1,30 @@
+#ifndef LEAF_CLASS_DARK_MODE_H
+#define LEAF_CLASS_DARK_MODE_H
+
+#include <webkit2/webkit2.h>
+
+// Owns the DarkReader user scripts in a WebKitUserContentManager (one per
+// profile). While the dark theme is active the bundle is injected at
+// document start (top frame everywhere, subframes on Google hosts) so pages
+// never flash white and SPA navigations keep their theme without further
+// enable() calls.
+//
+// In static mode the CSS DarkReader generates for the main Google hosts is
+// exported once, cached under cache_dir and injected as a user style sheet
+// on later loads instead of running the dynamic engine. The dynamic engine
+// only runs again to regenerate a missing or stale sheet.
+typedef struct _DarkMode DarkMode;
+
+DarkMode *dark_mode_new(WebKitUserContentManager *content_manager, GBytes *bundle, const char *cache_dir);
+
+void dark_mode_set_enabled(DarkMode *dark_mode, gboolean enabled);
+void dark_mode_set_static(DarkMode *dark_mode, gboolean use_static);
+
+// Brings an already loaded page in line with the current state
+void dark_mode_apply(DarkMode *dark_mode, WebKitWebView *webview);
+
+// Called on WEBKIT_LOAD_FINISHED; refreshes the static sheet for the page's
+// host if static mode needs one
+void dark_mode_page_loaded(DarkMode *dark_mode, WebKitWebView *webview);
+
+#endif
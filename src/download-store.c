@@ -0,0 +1,460 @@
+#include "download-store.h"
+
+#include "config-store.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#define STORE_SAVE_DELAY_MS 5000
+#define STORE_READ_CHUNK (64 * 1024)
+
+typedef struct {
+    char *uri;
+    char *validator;
+    char *blob;  // SHA-256 of the content, also the blob's file name
+    guint64 size;
+    gint64 used;
+} StoreEntry;
+
+struct _DownloadStore {
+    char *directory;
+    char *blob_dir;
+    char *index_path;
+    guint64 max_bytes;
+    GHashTable *entries;  // key -> StoreEntry
+    ConfigStore *index_store;
+};
+
+// Inputs and results of a worker thread job
+typedef struct {
+    DownloadStore *store;
+    char *key;
+    char *uri;
+    char *validator;
+    char *path;       // the download
+    char *blob_path;  // known up front when linking out, found by hashing when adding
+    char *blob;
+    guint64 size;
+    DownloadStoreMethod method;
+    gboolean damaged;
+    DownloadStoreDone done;
+    gpointer user_data;
+} StoreJob;
+
+static void store_entry_free(StoreEntry *entry) {
+    g_free(entry->uri);
+    g_free(entry->validator);
+    g_free(entry->blob);
+    g_free(entry);
+}
+
+static void store_job_free(StoreJob *job) {
+    g_free(job->key);
+    g_free(job->uri);
+    g_free(job->validator);
+    g_free(job->path);
+    g_free(job->blob_path);
+    g_free(job->blob);
+    g_free(job);
+}
+
+static gint64 now_seconds(void) {
+    return g_get_real_time() / G_USEC_PER_SEC;
+}
+
+// Doubles as the entry's group name in the index
+static char *entry_key(const char *uri, const char *validator) {
+    char *joined = g_strconcat(uri, "\n", validator, NULL);
+    char *key = g_compute_checksum_for_string(G_CHECKSUM_SHA256, joined, -1);
+    g_free(joined);
+    return key;
+}
+
+// --- Index ---
+
+static void fill_index(GKeyFile *key_file, gpointer user_data) {
+    DownloadStore *store = user_data;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, store->entries);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        StoreEntry *entry = value;
+        g_key_file_set_string(key_file, key, "URL", entry->uri);
+        g_key_file_set_string(key_file, key, "Validator", entry->validator);
+        g_key_file_set_string(key_file, key, "Blob", entry->blob);
+        g_key_file_set_uint64(key_file, key, "Size", entry->size);
+        g_key_file_set_int64(key_file, key, "Used", entry->used);
+    }
+}
+
+static void schedule_save(DownloadStore *store) {
+    config_store_mark_dirty(store->index_store);
+}
+
+static gboolean is_blob_name(const char *name) {
+    if (!name || strlen(name) != 64) return FALSE;
+    for (const char *c = name; *c; c++) {
+        if (!g_ascii_isxdigit(*c)) return FALSE;
+    }
+    return TRUE;
+}
+
+static void load_index(DownloadStore *store) {
+    GKeyFile *key_file = g_key_file_new();
+    if (!g_key_file_load_from_file(key_file, store->index_path, G_KEY_FILE_NONE, NULL)) {
+        g_key_file_free(key_file);
+        return;
+    }
+
+    gchar **groups = g_key_file_get_groups(key_file, NULL);
+    for (int i = 0; groups[i] != NULL; i++) {
+        StoreEntry *entry = g_new0(StoreEntry, 1);
+        entry->uri = g_key_file_get_string(key_file, groups[i], "URL", NULL);
+        entry->validator = g_key_file_get_string(key_file, groups[i], "Validator", NULL);
+        entry->blob = g_key_file_get_string(key_file, groups[i], "Blob", NULL);
+        entry->size = g_key_file_get_uint64(key_file, groups[i], "Size", NULL);
+        entry->used = g_key_file_get_int64(key_file, groups[i], "Used", NULL);
+
+        if (entry->uri && entry->validator && is_blob_name(entry->blob)) {
+            g_hash_table_replace(store->entries, g_strdup(groups[i]), entry);
+        } else {
+            store_entry_free(entry);
+        }
+    }
+
+    g_strfreev(groups);
+    g_key_file_free(key_file);
+}
+
+// Blobs added just before a quit that never reached the index, and
+// temporaries left by a crash, would otherwise slip past max_bytes. Entries
+// whose blob is gone are dropped too.
+static void remove_orphans(DownloadStore *store) {
+    GHashTable *referenced = g_hash_table_new(g_str_hash, g_str_equal);
+    GHashTable *present = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, store->entries);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) g_hash_table_add(referenced, ((StoreEntry *)value)->blob);
+
+    GDir *dir = g_dir_open(store->blob_dir, 0, NULL);
+    const char *name;
+    while (dir && (name = g_dir_read_name(dir)) != NULL) {
+        if (g_hash_table_contains(referenced, name)) {
+            g_hash_table_add(present, g_strdup(name));
+            continue;
+        }
+        char *path = g_build_filename(store->blob_dir, name, NULL);
+        g_unlink(path);
+        g_free(path);
+    }
+    if (dir) g_dir_close(dir);
+    g_hash_table_destroy(referenced);
+
+    gboolean changed = FALSE;
+    g_hash_table_iter_init(&iter, store->entries);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        if (g_hash_table_contains(present, ((StoreEntry *)value)->blob)) continue;
+        g_hash_table_iter_remove(&iter);
+        changed = TRUE;
+    }
+    g_hash_table_destroy(present);
+
+    if (changed) schedule_save(store);
+}
+
+static char *blob_path(DownloadStore *store, const char *blob) {
+    return g_build_filename(store->blob_dir, blob, NULL);
+}
+
+static gboolean is_blob_shared(DownloadStore *store, const char *blob) {
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, store->entries);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        if (g_str_equal(((StoreEntry *)value)->blob, blob)) return TRUE;
+    }
+    return FALSE;
+}
+
+// Removes the entry and, once nothing points at it, its blob. With a
+// hardlinked blob this only drops the store's name for the file.
+static void drop_entry(DownloadStore *store, const char *key) {
+    StoreEntry *entry = g_hash_table_lookup(store->entries, key);
+    if (!entry) return;
+
+    char *blob = g_strdup(entry->blob);
+    g_hash_table_remove(store->entries, key);
+    if (!is_blob_shared(store, blob)) {
+        char *path = blob_path(store, blob);
+        g_unlink(path);
+        g_free(path);
+    }
+
+    g_free(blob);
+    schedule_save(store);
+}
+
+typedef struct {
+    char *key;
+    StoreEntry *entry;
+} StoreRef;
+
+static gint compare_refs(gconstpointer a, gconstpointer b) {
+    const StoreRef *x = a;
+    const StoreRef *y = b;
+    return (x->entry->used > y->entry->used) - (x->entry->used < y->entry->used);
+}
+
+// Drops least recently used entries until the distinct blobs fit
+static void enforce_max_bytes(DownloadStore *store) {
+    GHashTable *blobs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);  // blob -> references
+    GArray *refs = g_array_new(FALSE, FALSE, sizeof(StoreRef));
+    guint64 total = 0;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, store->entries);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        StoreEntry *entry = value;
+        guint references = GPOINTER_TO_UINT(g_hash_table_lookup(blobs, entry->blob));
+        if (references == 0) total += entry->size;
+        g_hash_table_insert(blobs, g_strdup(entry->blob), GUINT_TO_POINTER(references + 1));
+
+        StoreRef ref = {g_strdup(key), entry};
+        g_array_append_val(refs, ref);
+    }
+    g_array_sort(refs, compare_refs);
+
+    for (guint i = 0; i < refs->len && total > store->max_bytes; i++) {
+        StoreRef *ref = &g_array_index(refs, StoreRef, i);
+        guint references = GPOINTER_TO_UINT(g_hash_table_lookup(blobs, ref->entry->blob));
+        if (references == 1) total -= ref->entry->size;
+        g_hash_table_insert(blobs, g_strdup(ref->entry->blob), GUINT_TO_POINTER(references - 1));
+
+        g_debug("download store: evicting %s", ref->entry->uri);
+        drop_entry(store, ref->key);
+    }
+
+    for (guint i = 0; i < refs->len; i++) g_free(g_array_index(refs, StoreRef, i).key);
+    g_array_free(refs, TRUE);
+    g_hash_table_destroy(blobs);
+}
+
+// --- Worker threads ---
+
+static char *hash_file(const char *path, guint64 *size) {
+    int fd = g_open(path, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) return NULL;
+
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA256);
+    guchar *buffer = g_malloc(STORE_READ_CHUNK);
+    gboolean ok = TRUE;
+    *size = 0;
+
+    for (;;) {
+        ssize_t n = read(fd, buffer, STORE_READ_CHUNK);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) ok = FALSE;
+        if (n <= 0) break;
+        g_checksum_update(checksum, buffer, n);
+        *size += n;
+    }
+
+    char *digest = ok ? g_strdup(g_checksum_get_string(checksum)) : NULL;
+    g_free(buffer);
+    g_checksum_free(checksum);
+    close(fd);
+    return digest;
+}
+
+// Makes dest (which must not exist) a copy of source, sharing its blocks
+// where the filesystem allows. A hardlink shares the file itself, so it is
+// only used between a download and its blob: two user copies sharing an
+// inode would see each other's edits.
+static DownloadStoreMethod clone_file(const char *source, const char *dest, gboolean hardlink) {
+#ifdef FICLONE
+    int in = g_open(source, O_RDONLY | O_CLOEXEC, 0);
+    if (in >= 0) {
+        int out = g_open(dest, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        gboolean cloned = out >= 0 && ioctl(out, FICLONE, in) == 0;
+        if (out >= 0) close(out);
+        close(in);
+        if (cloned) return DOWNLOAD_STORE_REFLINKED;
+        g_unlink(dest);
+    }
+#endif
+
+    if (hardlink && link(source, dest) == 0) return DOWNLOAD_STORE_HARDLINKED;
+
+    GFile *from = g_file_new_for_path(source);
+    GFile *to = g_file_new_for_path(dest);
+    gboolean copied = g_file_copy(from, to, G_FILE_COPY_NONE, NULL, NULL, NULL, NULL);
+    g_object_unref(from);
+    g_object_unref(to);
+    return copied ? DOWNLOAD_STORE_COPIED : DOWNLOAD_STORE_FAILED;
+}
+
+// Clones source to target through a temporary name in target's directory,
+// so target is replaced in one step
+static DownloadStoreMethod clone_into_place(const char *source, const char *target, gboolean hardlink) {
+    char *temporary = g_strdup_printf("%s.%08x.tmp", target, g_random_int());
+    DownloadStoreMethod method = clone_file(source, temporary, hardlink);
+
+    if (method != DOWNLOAD_STORE_FAILED && g_rename(temporary, target) != 0) {
+        g_warning("Could not move %s into place: %s", target, g_strerror(errno));
+        g_unlink(temporary);
+        method = DOWNLOAD_STORE_FAILED;
+    }
+
+    g_free(temporary);
+    return method;
+}
+
+static void add_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+    StoreJob *job = task_data;
+
+    job->blob = hash_file(job->path, &job->size);
+    if (!job->blob) return;
+
+    // An identical blob may already be there; replacing it is cheap unless
+    // it has to be copied, and repairs one edited through a hardlink
+    job->blob_path = g_build_filename(job->store->blob_dir, job->blob, NULL);
+    job->method = clone_into_place(job->path, job->blob_path, TRUE);
+}
+
+// A hardlinked blob is also the user's first download, and size and mtime
+// miss an edit within the same second, so the content is hashed again and
+// must still match the blob's name before it is handed out
+static void link_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+    StoreJob *job = task_data;
+    guint64 size;
+
+    char *digest = hash_file(job->blob_path, &size);
+    job->damaged = !digest || size != job->size || g_strcmp0(digest, job->blob) != 0;
+    g_free(digest);
+    if (job->damaged) return;
+
+    job->method = clone_into_place(job->blob_path, job->path, FALSE);
+}
+
+static const char *const method_names[] = {"failed", "reflink", "hardlink", "copy"};
+
+static void on_added(GObject *source, GAsyncResult *result, gpointer user_data) {
+    StoreJob *job = user_data;
+    DownloadStore *store = job->store;
+
+    if (job->method == DOWNLOAD_STORE_FAILED) {
+        g_debug("download store: could not add %s", job->path);
+        store_job_free(job);
+        return;
+    }
+
+    StoreEntry *entry = g_new0(StoreEntry, 1);
+    entry->uri = g_strdup(job->uri);
+    entry->validator = g_strdup(job->validator);
+    entry->blob = g_strdup(job->blob);
+    entry->size = job->size;
+    entry->used = now_seconds();
+    g_hash_table_replace(store->entries, g_strdup(job->key), entry);
+
+    g_debug("download store: added %s (%" G_GUINT64_FORMAT " bytes, %s)", job->uri, job->size,
+            method_names[job->method]);
+    enforce_max_bytes(store);
+    schedule_save(store);
+    store_job_free(job);
+}
+
+static void on_linked(GObject *source, GAsyncResult *result, gpointer user_data) {
+    StoreJob *job = user_data;
+    DownloadStore *store = job->store;
+
+    if (job->damaged) {
+        g_debug("download store: %s changed on disk, dropping it", job->blob_path);
+        drop_entry(store, job->key);
+    } else if (job->method != DOWNLOAD_STORE_FAILED) {
+        StoreEntry *entry = g_hash_table_lookup(store->entries, job->key);
+        if (entry) entry->used = now_seconds();
+        schedule_save(store);
+    }
+
+    job->done(job->method, job->user_data);
+    store_job_free(job);
+}
+
+static void run_job(StoreJob *job, GTaskThreadFunc thread, GAsyncReadyCallback callback) {
+    GTask *task = g_task_new(NULL, NULL, callback, job);
+    g_task_set_task_data(task, job, NULL);
+    g_task_run_in_thread(task, thread);
+    g_object_unref(task);
+}
+
+// --- Public API ---
+
+DownloadStore *download_store_new(const char *directory, guint64 max_bytes) {
+    DownloadStore *store = g_new0(DownloadStore, 1);
+    store->directory = g_strdup(directory);
+    store->blob_dir = g_build_filename(directory, "blobs", NULL);
+    store->index_path = g_build_filename(directory, "index.ini", NULL);
+    store->max_bytes = max_bytes;
+    store->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)store_entry_free);
+    store->index_store = config_store_new_key_file(store->index_path, STORE_SAVE_DELAY_MS, fill_index, store);
+
+    g_mkdir_with_parents(store->blob_dir, 0700);
+    load_index(store);
+    remove_orphans(store);
+    enforce_max_bytes(store);
+    return store;
+}
+
+gboolean download_store_contains(DownloadStore *store, const char *uri, const char *validator, guint64 *size) {
+    if (!uri || !validator) return FALSE;
+
+    char *key = entry_key(uri, validator);
+    StoreEntry *entry = g_hash_table_lookup(store->entries, key);
+    if (entry && size) *size = entry->size;
+    g_free(key);
+    return entry != NULL;
+}
+
+void download_store_link(DownloadStore *store, const char *uri, const char *validator, const char *path,
+                         DownloadStoreDone done, gpointer user_data) {
+    StoreJob *job = g_new0(StoreJob, 1);
+    job->store = store;
+    job->key = entry_key(uri, validator);
+    job->path = g_strdup(path);
+    job->done = done;
+    job->user_data = user_data;
+
+    StoreEntry *entry = g_hash_table_lookup(store->entries, job->key);
+    if (!entry) {
+        done(DOWNLOAD_STORE_FAILED, user_data);
+        store_job_free(job);
+        return;
+    }
+    job->blob_path = blob_path(store, entry->blob);
+    job->blob = g_strdup(entry->blob);
+    job->size = entry->size;
+    run_job(job, link_thread, on_linked);
+}
+
+void download_store_add(DownloadStore *store, const char *uri, const char *validator, const char *path) {
+    if (!uri || !validator || !path || store->max_bytes == 0) return;
+
+    StoreJob *job = g_new0(StoreJob, 1);
+    job->store = store;
+    job->key = entry_key(uri, validator);
+    job->uri = g_strdup(uri);
+    job->validator = g_strdup(validator);
+    job->path = g_strdup(path);
+    run_job(job, add_thread, on_added);
+}
@@ -0,0 +1,43 @@
+#ifndef LEAF_CLASS_DOWNLOAD_STORE_H
+#define LEAF_CLASS_DOWNLOAD_STORE_H
+
+#include <gio/gio.h>
+
+// Content-addressed store of finished downloads, so an attachment that is
+// downloaded again unchanged is linked into place instead of transferred.
+// Entries are keyed by the request URI plus the response's ETag or
+// Last-Modified and point at a blob named by the SHA-256 of its content,
+// so identical files share one blob. Files are hashed and linked on worker
+// threads: reflinked where the filesystem supports it, else copied. Only a
+// blob may be a hardlink of the download it came from, never the copies
+// handed out later. Least recently used entries are dropped to stay under
+// max_bytes. The index is <directory>/index.ini; blobs it doesn't list are
+// deleted when the store is opened.
+typedef struct _DownloadStore DownloadStore;
+
+typedef enum {
+    DOWNLOAD_STORE_FAILED,
+    DOWNLOAD_STORE_REFLINKED,
+    DOWNLOAD_STORE_HARDLINKED,
+    DOWNLOAD_STORE_COPIED
+} DownloadStoreMethod;
+
+typedef void (*DownloadStoreDone)(DownloadStoreMethod method, gpointer user_data);
+
+DownloadStore *download_store_new(const char *directory, guint64 max_bytes);
+
+// Whether content for uri at this validator is in the index; size is set
+// to its length. Touches no files, so it is cheap enough for the main
+// thread; download_store_link checks the content.
+gboolean download_store_contains(DownloadStore *store, const char *uri, const char *validator, guint64 *size);
+
+// Puts the stored content at path, replacing any file there; done runs on
+// the main thread. A blob whose content no longer matches its hash is
+// dropped and reported as FAILED.
+void download_store_link(DownloadStore *store, const char *uri, const char *validator, const char *path,
+                         DownloadStoreDone done, gpointer user_data);
+
+// Hashes the finished download at path and adds it, in the background
+void download_store_add(DownloadStore *store, const char *uri, const char *validator, const char *path);
+
+#endif
@@ -0,0 +1,1020 @@
+#include "downloads.h"
+#include "download-store.h"
+#include "segmented-download.h"
+#include "trace.h"
+
+#include <string.h>
+
+typedef enum {
+    DOWNLOAD_QUEUED,
+    DOWNLOAD_ACTIVE,
+    DOWNLOAD_FINISHED,
+    DOWNLOAD_FAILED,
+    DOWNLOAD_CANCELLED
+} DownloadState;
+
+typedef struct {
+    Downloads *downloads;
+    WebKitWebContext *context;  // where it started; retries are requested again through it
+    char *cookie_file;          // of that context, for the segmented engine
+    DownloadStore *store;       // of that context's profile, NULL when disabled
+    WebKitDownload *download;
+    DownloadState state;
+    char *uri;
+    char *filename;
+    char *destination;  // file URI, kept so retries skip the dialog
+    GtkFileChooserNative *chooser;  // open while the user picks a destination
+    SegmentedDownload *engine;  // set when the transfer was taken over from WebKit
+    char *validator;  // ETag or Last-Modified of the response, the store key with uri
+    gboolean from_store;  // being linked from the download store instead of transferred
+    gboolean deferred;  // queued with its response in, waiting for a slot to pick a destination
+
+    // Sampled cheaply on every notify, rendered at most once per frame
+    guint64 received;
+    guint64 total;
+    double progress;
+    gboolean dirty;
+
+    gint64 start_time;
+    gint64 rate_sample_time;
+    guint64 rate_sample_bytes;
+    double rate;  // EWMA-smoothed bytes per second
+
+    // Preallocated label text, only pushed to GTK when it changes
+    char progress_text[8];
+    char speed_text[24];
+    char time_text[32];
+
+    GtkWidget *row;
+    GtkWidget *filename_label;
+    GtkWidget *status_label;
+    GtkWidget *progress_bar;
+    GtkWidget *speed_label;
+    GtkWidget *time_label;
+    GtkWidget *cancel_button;
+    GtkWidget *retry_button;
+    GtkWidget *remove_button;
+} DownloadItem;
+
+typedef struct {
+    char *match;
+    char *directory;
+} DownloadRule;
+
+typedef struct {
+    Downloads *downloads;
+    WebKitWebContext *context;
+    char *cookie_file;
+    DownloadStore *store;
+} DownloadSource;
+
+struct _Downloads {
+    GPtrArray *sources;  // DownloadSource, one per watched context
+    guint max_active;
+    GList *items;  // DownloadItem, in start order
+    DownloadItem *adopting;  // item being retried through webkit_web_context_download_uri()
+
+    char *directory;
+    gboolean ask;
+    GPtrArray *rules;  // DownloadRule, in config order
+
+    guint64 segment_threshold;
+
+    GtkWidget *card;
+    GtkWidget *list;
+    GtkWidget *ticker;
+    GtkWidget *ticker_button;
+    GtkWidget *overlay;  // drives the repaint tick, mapped even when the card is hidden
+    guint tick_id;
+    guint stall_id;
+    char ticker_text[64];
+};
+
+static void downloads_pump(Downloads *downloads);
+static void item_attach(DownloadItem *item, WebKitDownload *download);
+static gboolean is_requeueable(const char *uri);
+
+// Progress sampling and rendering are decoupled: notify::estimated-progress
+// can fire thousands of times per second, so it only records byte counts
+// and marks the item dirty. A frame-clock tick callback repaints dirty items
+// at most once per frame, and throughput is smoothed with an EWMA sampled
+// every RATE_SAMPLE_INTERVAL.
+#define RATE_SAMPLE_INTERVAL (G_USEC_PER_SEC / 2)
+#define RATE_SMOOTHING 0.3
+
+// ... helpers ...
+static void format_size(char *buffer, gsize size, guint64 bytes) {
+    const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+    int i = 0;
+    double value = bytes;
+    while (value >= 1024 && i < 4) {
+        value /= 1024;
+        i++;
+    }
+    g_snprintf(buffer, size, "%.1f %s", value, units[i]);
+}
+
+static void format_time(char *buffer, gsize size, guint64 seconds) {
+    if (seconds < 60) g_snprintf(buffer, size, "%" G_GUINT64_FORMAT "s", seconds);
+    else if (seconds < 3600) g_snprintf(buffer, size, "%" G_GUINT64_FORMAT "m %" G_GUINT64_FORMAT "s", seconds / 60, seconds % 60);
+    else g_snprintf(buffer, size, "%" G_GUINT64_FORMAT "h %" G_GUINT64_FORMAT "m", seconds / 3600, (seconds % 3600) / 60);
+}
+
+// Copies text into the label's cached buffer and updates the label only on change
+static void set_label_cached(GtkWidget *label, char *cache, gsize size, const char *text) {
+    if (strncmp(cache, text, size) == 0) return;
+    g_strlcpy(cache, text, size);
+    gtk_label_set_text(GTK_LABEL(label), cache);
+}
+
+static guint count_in_state(Downloads *downloads, DownloadState state) {
+    guint count = 0;
+    for (GList *l = downloads->items; l != NULL; l = l->next) {
+        DownloadItem *item = l->data;
+        if (item->state == state) count++;
+    }
+    return count;
+}
+
+static DownloadItem *find_item(Downloads *downloads, WebKitDownload *download) {
+    for (GList *l = downloads->items; l != NULL; l = l->next) {
+        DownloadItem *item = l->data;
+        if (item->download == download) return item;
+    }
+    return NULL;
+}
+
+static void update_ticker(Downloads *downloads) {
+    guint active = 0;
+    guint queued = 0;
+    double progress = 0;
+    char text[sizeof(downloads->ticker_text)];
+
+    for (GList *l = downloads->items; l != NULL; l = l->next) {
+        DownloadItem *item = l->data;
+        if (item->state == DOWNLOAD_ACTIVE) {
+            active++;
+            progress += item->progress;
+        } else if (item->state == DOWNLOAD_QUEUED) {
+            queued++;
+        }
+    }
+
+    if (active > 0 && queued > 0) {
+        g_snprintf(text, sizeof(text), "Downloading %u (%u queued)... %.0f%%", active, queued, progress / active * 100);
+    } else if (active > 0) {
+        g_snprintf(text, sizeof(text), "Downloading %u... %.0f%%", active, progress / active * 100);
+    } else {
+        g_strlcpy(text, "Downloads Manager", sizeof(text));
+    }
+
+    if (strcmp(text, downloads->ticker_text) != 0) {
+        g_strlcpy(downloads->ticker_text, text, sizeof(downloads->ticker_text));
+        gtk_button_set_label(GTK_BUTTON(downloads->ticker_button), downloads->ticker_text);
+    }
+}
+
+static void show_card(Downloads *downloads) {
+    gtk_widget_hide(downloads->ticker);
+    gtk_widget_show(downloads->card);
+}
+
+static const char *const state_names[] = {"queued", "active", "finished", "failed", "cancelled"};
+
+static void item_set_state(DownloadItem *item, DownloadState state, const char *status) {
+    DownloadState previous = item->state;
+    item->state = state;
+
+    // One slice per transfer on the download's own row of the trace
+    if (state == DOWNLOAD_ACTIVE && previous != DOWNLOAD_ACTIVE) {
+        trace_begin(item, "download", "download", "url", item->uri, NULL);
+    } else if (previous == DOWNLOAD_ACTIVE && state != DOWNLOAD_ACTIVE) {
+        char *bytes = g_strdup_printf("%" G_GUINT64_FORMAT, item->received);
+        trace_end(item, "download", "download", "state", state_names[state], "bytes", bytes, NULL);
+        g_free(bytes);
+    } else {
+        trace_instant(item, "download", state_names[state], "url", item->uri, NULL);
+    }
+
+    gtk_label_set_text(GTK_LABEL(item->status_label), status);
+
+    gtk_widget_set_visible(item->cancel_button, state == DOWNLOAD_ACTIVE || state == DOWNLOAD_QUEUED);
+    gtk_widget_set_visible(item->retry_button, state == DOWNLOAD_FAILED || state == DOWNLOAD_CANCELLED);
+    gtk_widget_set_visible(item->remove_button, state != DOWNLOAD_ACTIVE && state != DOWNLOAD_QUEUED);
+    gtk_widget_set_visible(item->progress_bar, state != DOWNLOAD_QUEUED);
+
+    update_ticker(item->downloads);
+}
+
+static void item_detach(DownloadItem *item) {
+    if (!item->download) return;
+    g_signal_handlers_disconnect_by_data(item->download, item);
+    g_clear_object(&item->download);
+}
+
+static void item_close_chooser(DownloadItem *item) {
+    if (!item->chooser) return;
+    g_signal_handlers_disconnect_by_data(item->chooser, item);
+    gtk_native_dialog_destroy(GTK_NATIVE_DIALOG(item->chooser));
+    g_clear_object(&item->chooser);
+}
+
+static void item_free(DownloadItem *item) {
+    if (item->engine) {
+        segmented_download_cancel(item->engine, FALSE);
+        g_clear_pointer(&item->engine, segmented_download_unref);
+    }
+    item_close_chooser(item);
+    item_detach(item);
+    g_object_unref(item->context);
+    g_free(item->cookie_file);
+    g_free(item->uri);
+    g_free(item->filename);
+    g_free(item->destination);
+    g_free(item->validator);
+    g_free(item);
+}
+
+static void item_remove(DownloadItem *item) {
+    Downloads *downloads = item->downloads;
+
+    downloads->items = g_list_remove(downloads->items, item);
+    gtk_widget_destroy(gtk_widget_get_parent(item->row));  // GtkListBoxRow
+    item_free(item);
+
+    if (!downloads->items) {
+        gtk_widget_hide(downloads->card);
+        gtk_widget_hide(downloads->ticker);
+    }
+    update_ticker(downloads);
+}
+
+static void on_item_cancel(GtkButton *button, DownloadItem *item) {
+    if (item->state == DOWNLOAD_ACTIVE && item->engine) {
+        segmented_download_cancel(item->engine, TRUE);
+        g_clear_pointer(&item->engine, segmented_download_unref);
+        item_set_state(item, DOWNLOAD_CANCELLED, "Cancelled");
+        downloads_pump(item->downloads);
+    } else if ((item->state == DOWNLOAD_ACTIVE || item->state == DOWNLOAD_QUEUED) && item->download) {
+        // Reported back through the "failed" signal
+        webkit_download_cancel(item->download);
+    } else if (item->state == DOWNLOAD_QUEUED) {
+        item_set_state(item, DOWNLOAD_CANCELLED, "Cancelled");
+    }
+}
+
+static void on_item_retry(GtkButton *button, DownloadItem *item) {
+    item->progress = 0;
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(item->progress_bar), 0);
+    g_strlcpy(item->progress_text, "0%", sizeof(item->progress_text));
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(item->progress_bar), item->progress_text);
+    item_set_state(item, DOWNLOAD_QUEUED, "Queued");
+    downloads_pump(item->downloads);
+}
+
+static void on_item_remove(GtkButton *button, DownloadItem *item) {
+    item_remove(item);
+}
+
+static GtkWidget *icon_button(const char *icon_name, const char *tooltip, GCallback callback, DownloadItem *item) {
+    GtkWidget *button = gtk_button_new_from_icon_name(icon_name, GTK_ICON_SIZE_BUTTON);
+    gtk_button_set_relief(GTK_BUTTON(button), GTK_RELIEF_NONE);
+    gtk_widget_set_tooltip_text(button, tooltip);
+    g_signal_connect(button, "clicked", callback, item);
+    return button;
+}
+
+static DownloadItem *item_new(DownloadSource *source, const char *uri) {
+    Downloads *downloads = source->downloads;
+    DownloadItem *item = g_new0(DownloadItem, 1);
+    item->downloads = downloads;
+    item->context = g_object_ref(source->context);
+    item->cookie_file = g_strdup(source->cookie_file);
+    item->store = source->store;
+    item->uri = g_strdup(uri);
+    item->filename = g_strdup("download");
+
+    GtkWidget *row = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
+    g_object_set(row, "margin", 5, NULL);
+    item->row = row;
+
+    // Row Header (Filename + Actions)
+    GtkWidget *row_header = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    item->filename_label = gtk_label_new(item->filename);
+    gtk_label_set_ellipsize(GTK_LABEL(item->filename_label), PANGO_ELLIPSIZE_MIDDLE);
+    gtk_widget_set_halign(item->filename_label, GTK_ALIGN_START);
+    gtk_box_pack_start(GTK_BOX(row_header), item->filename_label, TRUE, TRUE, 0);
+
+    item->remove_button = icon_button("window-close-symbolic", "Remove from List", G_CALLBACK(on_item_remove), item);
+    gtk_box_pack_end(GTK_BOX(row_header), item->remove_button, FALSE, FALSE, 0);
+    item->retry_button = icon_button("view-refresh-symbolic", "Retry", G_CALLBACK(on_item_retry), item);
+    gtk_box_pack_end(GTK_BOX(row_header), item->retry_button, FALSE, FALSE, 0);
+    item->cancel_button = icon_button("process-stop-symbolic", "Cancel", G_CALLBACK(on_item_cancel), item);
+    gtk_box_pack_end(GTK_BOX(row_header), item->cancel_button, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(row), row_header, FALSE, FALSE, 0);
+
+    // Status & Progress
+    item->status_label = gtk_label_new("Queued");
+    gtk_widget_set_halign(item->status_label, GTK_ALIGN_START);
+    gtk_box_pack_start(GTK_BOX(row), item->status_label, FALSE, FALSE, 0);
+
+    item->progress_bar = gtk_progress_bar_new();
+    gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(item->progress_bar), TRUE);
+    gtk_box_pack_start(GTK_BOX(row), item->progress_bar, FALSE, FALSE, 0);
+
+    // Info (Speed, Time)
+    GtkWidget *info_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 10);
+    item->speed_label = gtk_label_new("-");
+    gtk_box_pack_start(GTK_BOX(info_box), item->speed_label, TRUE, TRUE, 0);
+    item->time_label = gtk_label_new("-");
+    gtk_box_pack_start(GTK_BOX(info_box), item->time_label, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(row), info_box, FALSE, FALSE, 0);
+
+    gtk_widget_show_all(row);
+    gtk_list_box_insert(GTK_LIST_BOX(downloads->list), row, -1);
+
+    downloads->items = g_list_append(downloads->items, item);
+    item_set_state(item, DOWNLOAD_QUEUED, "Queued");
+    return item;
+}
+
+static void on_download_failed(WebKitDownload *download, GError *error, DownloadItem *item) {
+    item_close_chooser(item);
+    item_detach(item);
+    set_label_cached(item->speed_label, item->speed_text, sizeof(item->speed_text), "-");
+    set_label_cached(item->time_label, item->time_text, sizeof(item->time_text), "-");
+
+    if (g_error_matches(error, WEBKIT_DOWNLOAD_ERROR, WEBKIT_DOWNLOAD_ERROR_CANCELLED_BY_USER)) {
+        item_set_state(item, DOWNLOAD_CANCELLED, "Cancelled");
+    } else {
+        item_set_state(item, DOWNLOAD_FAILED, "Failed");
+        show_card(item->downloads);
+    }
+    downloads_pump(item->downloads);
+}
+
+// Offers a finished download to the store, which hashes it in the background
+static void item_store(DownloadItem *item) {
+    if (!item->store || !item->validator || !item->destination) return;
+
+    char *path = g_filename_from_uri(item->destination, NULL, NULL);
+    download_store_add(item->store, item->uri, item->validator, path);
+    g_free(path);
+}
+
+static void on_download_finished(WebKitDownload *download, DownloadItem *item) {
+    // "finished" is also emitted after "failed"
+    if (item->state != DOWNLOAD_ACTIVE) return;
+
+    item_detach(item);
+    item->progress = 1.0;
+    item->dirty = FALSE;
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(item->progress_bar), 1.0);
+    g_strlcpy(item->progress_text, "100%", sizeof(item->progress_text));
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(item->progress_bar), item->progress_text);
+    set_label_cached(item->time_label, item->time_text, sizeof(item->time_text), "-");
+    item_set_state(item, DOWNLOAD_FINISHED, "Finished");
+    item_store(item);
+    show_card(item->downloads);
+    downloads_pump(item->downloads);
+}
+
+static void item_render(DownloadItem *item, gint64 now) {
+    char text[32];
+    item->dirty = FALSE;
+
+    if (ABS(gtk_progress_bar_get_fraction(GTK_PROGRESS_BAR(item->progress_bar)) - item->progress) >= 0.001) {
+        gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(item->progress_bar), item->progress);
+    }
+    g_snprintf(text, sizeof(text), "%.0f%%", item->progress * 100);
+    if (strcmp(text, item->progress_text) != 0) {
+        g_strlcpy(item->progress_text, text, sizeof(item->progress_text));
+        gtk_progress_bar_set_text(GTK_PROGRESS_BAR(item->progress_bar), item->progress_text);
+    }
+
+    if (now - item->rate_sample_time < RATE_SAMPLE_INTERVAL) return;
+
+    double instant = (double)(item->received - item->rate_sample_bytes) * G_USEC_PER_SEC / (now - item->rate_sample_time);
+    item->rate = item->rate > 0 ? RATE_SMOOTHING * instant + (1 - RATE_SMOOTHING) * item->rate : instant;
+    item->rate_sample_time = now;
+    item->rate_sample_bytes = item->received;
+
+    format_size(text, sizeof(text) - 2, (guint64)item->rate);
+    g_strlcat(text, "/s", sizeof(text));
+    set_label_cached(item->speed_label, item->speed_text, sizeof(item->speed_text), text);
+
+    // Without a Content-Length, extrapolate the total from WebKit's progress
+    // estimate; failing that, show the elapsed time instead of no ETA at all
+    guint64 total = item->total;
+    if (total == 0 && item->progress > 0.01) total = (guint64)(item->received / item->progress);
+
+    if (item->rate > 0 && total > item->received) {
+        format_time(text, sizeof(text), (guint64)((total - item->received) / item->rate));
+    } else {
+        char elapsed[16];
+        format_time(elapsed, sizeof(elapsed), (now - item->start_time) / G_USEC_PER_SEC);
+        g_snprintf(text, sizeof(text), "%s elapsed", elapsed);
+    }
+    set_label_cached(item->time_label, item->time_text, sizeof(item->time_text), text);
+}
+
+static gboolean on_progress_tick(GtkWidget *widget, GdkFrameClock *clock, gpointer user_data) {
+    Downloads *downloads = user_data;
+    gint64 now = gdk_frame_clock_get_frame_time(clock);
+
+    for (GList *l = downloads->items; l != NULL; l = l->next) {
+        DownloadItem *item = l->data;
+        if (item->dirty) item_render(item, now);
+    }
+    update_ticker(downloads);
+
+    downloads->tick_id = 0;
+    return G_SOURCE_REMOVE;
+}
+
+static void schedule_repaint(Downloads *downloads) {
+    if (downloads->tick_id || !downloads->overlay) return;
+    downloads->tick_id = gtk_widget_add_tick_callback(downloads->overlay, on_progress_tick, downloads, NULL);
+}
+
+// Keeps the rate and ETA honest while a transfer stalls and stops notifying
+static gboolean on_stall_check(gpointer user_data) {
+    Downloads *downloads = user_data;
+    gboolean active = FALSE;
+
+    for (GList *l = downloads->items; l != NULL; l = l->next) {
+        DownloadItem *item = l->data;
+        if (item->state == DOWNLOAD_ACTIVE) {
+            item->dirty = TRUE;
+            active = TRUE;
+        }
+    }
+
+    if (!active) {
+        downloads->stall_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+    schedule_repaint(downloads);
+    return G_SOURCE_CONTINUE;
+}
+
+static void on_download_progress(WebKitDownload *download, GParamSpec *pspec, DownloadItem *item) {
+    if (item->state != DOWNLOAD_ACTIVE) return;
+
+    item->progress = webkit_download_get_estimated_progress(download);
+    item->received = webkit_download_get_received_data_length(download);
+    if (!item->total) {
+        WebKitURIResponse *response = webkit_download_get_response(download);
+        if (response) item->total = webkit_uri_response_get_content_length(response);
+    }
+
+    item->dirty = TRUE;
+    schedule_repaint(item->downloads);
+}
+
+static char *expand_home(const char *path) {
+    if (g_str_has_prefix(path, "~/")) return g_build_filename(g_get_home_dir(), path + 2, NULL);
+    return g_strdup(path);
+}
+
+// Extracts <id> from classroom.google.com/[u/N/]c/<id>/... page URIs
+static char *course_id_for(WebKitDownload *download) {
+    WebKitWebView *webview = webkit_download_get_web_view(download);
+    const char *page_uri = webview ? webkit_web_view_get_uri(webview) : NULL;
+    char *course_id = NULL;
+
+    if (!page_uri || !g_str_has_prefix(page_uri, "https://classroom.google.com/")) return NULL;
+
+    gchar **segments = g_strsplit(page_uri + strlen("https://classroom.google.com/"), "/", -1);
+    for (int i = 0; segments[i] != NULL && segments[i + 1] != NULL; i++) {
+        if (g_str_equal(segments[i], "c") && *segments[i + 1]) {
+            course_id = g_strndup(segments[i + 1], strcspn(segments[i + 1], "?#"));
+            break;
+        }
+    }
+    g_strfreev(segments);
+    return course_id;
+}
+
+static const char *rule_directory(Downloads *downloads, WebKitDownload *download) {
+    WebKitURIResponse *response = webkit_download_get_response(download);
+    const char *mime_type = response ? webkit_uri_response_get_mime_type(response) : NULL;
+    char *course_id = course_id_for(download);
+    const char *course_match = NULL;
+    const char *type_match = NULL;
+
+    for (guint i = 0; i < downloads->rules->len; i++) {
+        DownloadRule *rule = g_ptr_array_index(downloads->rules, i);
+
+        if (g_str_has_prefix(rule->match, "course:")) {
+            if (!course_match && g_strcmp0(rule->match + strlen("course:"), course_id) == 0) {
+                course_match = rule->directory;
+            }
+        } else if (g_str_has_prefix(rule->match, "type:") && mime_type && !type_match) {
+            const char *pattern = rule->match + strlen("type:");
+            if (g_str_has_suffix(pattern, "/*")
+                    ? strncmp(pattern, mime_type, strlen(pattern) - 1) == 0
+                    : g_ascii_strcasecmp(pattern, mime_type) == 0) {
+                type_match = rule->directory;
+            }
+        }
+    }
+
+    g_free(course_id);
+    return course_match ? course_match : type_match;
+}
+
+static char *destination_directory(Downloads *downloads, WebKitDownload *download) {
+    const char *directory = rule_directory(downloads, download);
+    if (!directory) directory = downloads->directory;
+    if (!directory) directory = g_get_user_special_dir(G_USER_DIRECTORY_DOWNLOAD);
+    if (!directory) directory = g_get_home_dir();
+    return expand_home(directory);
+}
+
+static gboolean is_destination_taken(Downloads *downloads, const char *path) {
+    if (g_file_test(path, G_FILE_TEST_EXISTS)) return TRUE;
+
+    // Another download may be about to create the same file
+    char *uri = g_filename_to_uri(path, NULL, NULL);
+    gboolean taken = FALSE;
+    for (GList *l = downloads->items; l != NULL && !taken; l = l->next) {
+        DownloadItem *item = l->data;
+        taken = g_strcmp0(item->destination, uri) == 0;
+    }
+    g_free(uri);
+    return taken;
+}
+
+// "report.pdf" -> "report (1).pdf", "report (2).pdf", ...
+static char *unique_destination(Downloads *downloads, const char *directory, const char *filename) {
+    char *path = g_build_filename(directory, filename, NULL);
+    const char *dot = strrchr(filename, '.');
+    gsize stem_length = dot && dot != filename ? (gsize)(dot - filename) : strlen(filename);
+    const char *extension = dot && dot != filename ? dot : "";
+
+    for (int n = 1; is_destination_taken(downloads, path); n++) {
+        g_free(path);
+        char *candidate = g_strdup_printf("%.*s (%d)%s", (int)stem_length, filename, n, extension);
+        path = g_build_filename(directory, candidate, NULL);
+        g_free(candidate);
+    }
+    return path;
+}
+
+static void on_engine_progress(SegmentedDownload *engine, guint64 received, guint64 total, gpointer user_data) {
+    DownloadItem *item = user_data;
+    item->received = received;
+    item->total = total;
+    item->progress = total ? (double)received / total : 0;
+
+    item->dirty = TRUE;
+    schedule_repaint(item->downloads);
+}
+
+static void on_engine_done(SegmentedDownload *engine, const GError *error, gpointer user_data) {
+    DownloadItem *item = user_data;
+    g_clear_pointer(&item->engine, segmented_download_unref);
+    set_label_cached(item->speed_label, item->speed_text, sizeof(item->speed_text), "-");
+    set_label_cached(item->time_label, item->time_text, sizeof(item->time_text), "-");
+
+    if (error) {
+        g_warning("Download of %s failed: %s", item->uri, error->message);
+        // The journal is kept, so Retry picks up where this stopped
+        item_set_state(item, DOWNLOAD_FAILED, "Failed - retry to resume");
+    } else {
+        item->progress = 1.0;
+        item->dirty = FALSE;
+        gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(item->progress_bar), 1.0);
+        g_strlcpy(item->progress_text, "100%", sizeof(item->progress_text));
+        gtk_progress_bar_set_text(GTK_PROGRESS_BAR(item->progress_bar), item->progress_text);
+        item_set_state(item, DOWNLOAD_FINISHED, "Finished");
+        item_store(item);
+    }
+    show_card(item->downloads);
+    downloads_pump(item->downloads);
+}
+
+static const char *response_validator(WebKitURIResponse *response) {
+    SoupMessageHeaders *headers = response ? webkit_uri_response_get_http_headers(response) : NULL;
+    if (!headers) return NULL;
+
+    const char *validator = soup_message_headers_get_one(headers, "ETag");
+    return validator ? validator : soup_message_headers_get_one(headers, "Last-Modified");
+}
+
+// Large files on range-capable servers go to the segmented engine
+static gboolean item_hand_off(DownloadItem *item, const char *path) {
+    Downloads *downloads = item->downloads;
+    WebKitURIResponse *response = webkit_download_get_response(item->download);
+    if (!downloads->segment_threshold || !response) return FALSE;
+
+    // The final URI after redirects, e.g. a signed googleusercontent link;
+    // a retry gets a fresh one, so the engine keys its journal by item->uri
+    const char *uri = webkit_uri_response_get_uri(response);
+    guint64 total = webkit_uri_response_get_content_length(response);
+    SoupMessageHeaders *headers = webkit_uri_response_get_http_headers(response);
+    const char *accept_ranges = headers ? soup_message_headers_get_one(headers, "Accept-Ranges") : NULL;
+
+    if (total < downloads->segment_threshold || !accept_ranges || !strstr(accept_ranges, "bytes") ||
+        !uri || !(g_str_has_prefix(uri, "https://") || g_str_has_prefix(uri, "http://"))) {
+        return FALSE;
+    }
+
+    const char *validator = response_validator(response);
+
+    WebKitWebView *webview = webkit_download_get_web_view(item->download);
+    const char *user_agent = webview ? webkit_settings_get_user_agent(webkit_web_view_get_settings(webview)) : NULL;
+    SoupSession *session = segmented_download_session_new(item->cookie_file, user_agent);
+    item->engine = segmented_download_new(session, item->uri, uri, path, total, validator);
+    g_object_unref(session);
+
+    // Detach first so the cancellation is not reported as a user cancel
+    WebKitDownload *download = g_object_ref(item->download);
+    item_detach(item);
+    webkit_download_cancel(download);
+    g_object_unref(download);
+
+    gtk_label_set_text(GTK_LABEL(item->status_label), "Downloading (segmented)...");
+    segmented_download_start(item->engine, on_engine_progress, on_engine_done, item);
+    return TRUE;
+}
+
+static void on_linked_from_store(DownloadStoreMethod method, gpointer user_data) {
+    DownloadItem *item = user_data;
+    item->from_store = FALSE;
+
+    if (method == DOWNLOAD_STORE_FAILED) {
+        // Fetch it after all; the retry reuses the destination and skips the store
+        on_item_retry(NULL, item);
+        return;
+    }
+
+    item->progress = 1.0;
+    item->received = item->total;
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(item->progress_bar), 1.0);
+    g_strlcpy(item->progress_text, "100%", sizeof(item->progress_text));
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(item->progress_bar), item->progress_text);
+    set_label_cached(item->speed_label, item->speed_text, sizeof(item->speed_text), "Not downloaded");
+    set_label_cached(item->time_label, item->time_text, sizeof(item->time_text), "-");
+    gtk_widget_set_tooltip_text(item->status_label, method == DOWNLOAD_STORE_COPIED
+                                ? "Copied from an earlier download of the same file"
+                                : "Linked to an earlier download of the same file; no extra disk space is used");
+    item_set_state(item, DOWNLOAD_FINISHED, "Finished (served locally)");
+    show_card(item->downloads);
+    downloads_pump(item->downloads);
+}
+
+// An unchanged file that was downloaded before is linked from the store;
+// WebKit has only fetched the headers at this point
+static gboolean item_serve_locally(DownloadItem *item, const char *path) {
+    if (!item->store || !item->validator || !is_requeueable(item->uri) ||
+        !download_store_contains(item->store, item->uri, item->validator, &item->total)) {
+        return FALSE;
+    }
+
+    WebKitDownload *download = g_object_ref(item->download);
+    item_detach(item);
+    webkit_download_cancel(download);
+    g_object_unref(download);
+
+    item->from_store = TRUE;
+    gtk_label_set_text(GTK_LABEL(item->status_label), "Found an earlier download...");
+    trace_instant(item, "download", "served-locally", "url", item->uri, NULL);
+    download_store_link(item->store, item->uri, item->validator, path, on_linked_from_store, item);
+    return TRUE;
+}
+
+static void item_set_destination(DownloadItem *item, const char *path) {
+    g_free(item->destination);
+    item->destination = g_filename_to_uri(path, NULL, NULL);
+
+    char *basename = g_path_get_basename(path);
+    g_free(item->filename);
+    item->filename = basename;
+    gtk_label_set_text(GTK_LABEL(item->filename_label), item->filename);
+
+    if (item_serve_locally(item, path)) return;
+    if (item_hand_off(item, path)) return;
+
+    webkit_download_set_destination(item->download, item->destination);
+    gtk_label_set_text(GTK_LABEL(item->status_label), "Downloading...");
+}
+
+static void on_destination_chosen(GtkNativeDialog *native, gint response, DownloadItem *item) {
+    char *filename = NULL;
+    if (response == GTK_RESPONSE_ACCEPT) {
+        filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(native));
+    }
+    item_close_chooser(item);
+
+    if (!item->download) {
+        g_free(filename);
+        return;
+    }
+
+    if (filename) {
+        // The user confirmed any overwrite in the dialog
+        webkit_download_set_allow_overwrite(item->download, TRUE);
+        item_set_destination(item, filename);
+        g_free(filename);
+    } else {
+        webkit_download_cancel(item->download);
+    }
+}
+
+static void ask_destination(DownloadItem *item, const char *directory) {
+    item->chooser = gtk_file_chooser_native_new("Save File",
+                                                GTK_WINDOW(gtk_widget_get_toplevel(item->downloads->card)),
+                                                GTK_FILE_CHOOSER_ACTION_SAVE,
+                                                "_Save",
+                                                "_Cancel");
+    gtk_native_dialog_set_modal(GTK_NATIVE_DIALOG(item->chooser), FALSE);
+    gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(item->chooser), TRUE);
+    gtk_file_chooser_set_current_folder(GTK_FILE_CHOOSER(item->chooser), directory);
+    gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(item->chooser), item->filename);
+
+    g_signal_connect(item->chooser, "response", G_CALLBACK(on_destination_chosen), item);
+    gtk_native_dialog_show(GTK_NATIVE_DIALOG(item->chooser));
+    gtk_label_set_text(GTK_LABEL(item->status_label), "Choose where to save...");
+}
+
+static void item_decide_destination(DownloadItem *item) {
+    WebKitDownload *download = item->download;
+
+    // Retries reuse the destination picked the first time, which also lets
+    // the segmented engine find its journal and resume
+    if (item->destination) {
+        char *path = g_filename_from_uri(item->destination, NULL, NULL);
+        if (!path || !item_hand_off(item, path)) {
+            webkit_download_set_allow_overwrite(download, TRUE);
+            webkit_download_set_destination(download, item->destination);
+        }
+        g_free(path);
+        return;
+    }
+
+    char *directory = destination_directory(item->downloads, download);
+
+#if WEBKIT_CHECK_VERSION(2, 40, 0)
+    // The download waits until a destination is set from the response handler
+    if (item->downloads->ask) {
+        ask_destination(item, directory);
+        g_free(directory);
+        return;
+    }
+#endif
+
+    g_mkdir_with_parents(directory, 0700);
+    char *path = unique_destination(item->downloads, directory, item->filename);
+    item_set_destination(item, path);
+
+    g_free(path);
+    g_free(directory);
+}
+
+static gboolean on_download_decide_destination(WebKitDownload *download, gchar *suggested_filename, DownloadItem *item) {
+    if (suggested_filename && *suggested_filename) {
+        g_free(item->filename);
+        item->filename = g_path_get_basename(suggested_filename);
+        gtk_label_set_text(GTK_LABEL(item->filename_label), item->filename);
+    }
+
+    g_free(item->validator);
+    item->validator = g_strdup(response_validator(webkit_download_get_response(download)));
+
+    // A queued download stays paused on its response until item_activate()
+    if (item->state == DOWNLOAD_QUEUED) {
+        item->deferred = TRUE;
+        return TRUE;
+    }
+
+    item_decide_destination(item);
+    return TRUE;
+}
+
+static void item_attach(DownloadItem *item, WebKitDownload *download) {
+    item->download = g_object_ref(download);
+    item->deferred = FALSE;
+
+    g_signal_connect(download, "decide-destination", G_CALLBACK(on_download_decide_destination), item);
+    g_signal_connect(download, "notify::estimated-progress", G_CALLBACK(on_download_progress), item);
+    g_signal_connect(download, "failed", G_CALLBACK(on_download_failed), item);
+    g_signal_connect(download, "finished", G_CALLBACK(on_download_finished), item);
+}
+
+// Gives an attached item one of the transfer slots
+static void item_activate(DownloadItem *item) {
+    item->start_time = g_get_monotonic_time();
+    item->rate_sample_time = item->start_time;
+    item->rate_sample_bytes = 0;
+    item->received = 0;
+    item->total = 0;
+    item->progress = 0;
+    item->rate = 0;
+
+    item_set_state(item, DOWNLOAD_ACTIVE, "Downloading...");
+    show_card(item->downloads);
+
+    if (!item->downloads->stall_id) {
+        item->downloads->stall_id = g_timeout_add_seconds(1, on_stall_check, item->downloads);
+    }
+
+    if (item->deferred) {
+        item->deferred = FALSE;
+        item_decide_destination(item);
+    }
+}
+
+// Starts queued items while there are free slots
+static void downloads_pump(Downloads *downloads) {
+    for (GList *l = downloads->items; l != NULL; l = l->next) {
+        DownloadItem *item = l->data;
+        if (count_in_state(downloads, DOWNLOAD_ACTIVE) >= downloads->max_active) break;
+        if (item->state != DOWNLOAD_QUEUED) continue;
+
+        // A retry has lost its original download and has to request the URI again
+        if (!item->download) {
+            downloads->adopting = item;
+            WebKitDownload *download = webkit_web_context_download_uri(item->context, item->uri);
+            downloads->adopting = NULL;
+
+            // download-started may not have been emitted synchronously
+            if (!item->download) item_attach(item, download);
+            g_object_unref(download);
+        }
+        item_activate(item);
+    }
+}
+
+// Only plain network URIs can be requested again, which a store link
+// falls back to when it fails
+static gboolean is_requeueable(const char *uri) {
+    return g_str_has_prefix(uri, "https://") || g_str_has_prefix(uri, "http://");
+}
+
+static void on_download_started(WebKitWebContext *context, WebKitDownload *download, DownloadSource *source) {
+    Downloads *downloads = source->downloads;
+    if (downloads->adopting) {
+        item_attach(downloads->adopting, download);
+        return;
+    }
+    if (find_item(downloads, download)) return;
+
+    const char *uri = webkit_uri_request_get_uri(webkit_download_get_request(download));
+    DownloadItem *item = item_new(source, uri);
+    item_attach(item, download);
+
+#if WEBKIT_CHECK_VERSION(2, 40, 0)
+    // Over the limit the original download is held at its destination
+    // decision rather than cancelled and requested again, which would lose
+    // a POST body, a one-time signed link or the referer
+    if (count_in_state(downloads, DOWNLOAD_ACTIVE) >= downloads->max_active) {
+        show_card(downloads);
+        return;
+    }
+#endif
+    item_activate(item);
+}
+
+static void on_card_hide(GtkButton *button, Downloads *downloads) {
+    gtk_widget_hide(downloads->card);
+    gtk_widget_show(downloads->ticker);
+}
+
+static void on_card_restore(GtkButton *button, Downloads *downloads) {
+    show_card(downloads);
+}
+
+static void on_clear_finished(GtkButton *button, Downloads *downloads) {
+    GList *l = downloads->items;
+    while (l != NULL) {
+        GList *next = l->next;
+        DownloadItem *item = l->data;
+        if (item->state != DOWNLOAD_ACTIVE && item->state != DOWNLOAD_QUEUED) {
+            item_remove(item);
+        }
+        l = next;
+    }
+}
+
+Downloads *downloads_new(guint max_active) {
+    Downloads *downloads = g_new0(Downloads, 1);
+    downloads->sources = g_ptr_array_new();
+    downloads->max_active = MAX(max_active, 1);
+    downloads->rules = g_ptr_array_new();
+
+    // Download Card
+    GtkWidget *card = gtk_box_new(GTK_ORIENTATION_VERTICAL, 10);
+    gtk_style_context_add_class(gtk_widget_get_style_context(card), "download-card");
+    gtk_widget_set_halign(card, GTK_ALIGN_START);
+    gtk_widget_set_valign(card, GTK_ALIGN_END);
+    gtk_widget_set_margin_start(card, 20);
+    gtk_widget_set_margin_bottom(card, 20);
+    gtk_widget_set_size_request(card, 320, -1);
+
+    // Card Header (Title + Clear + Hide Button)
+    GtkWidget *card_header = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 10);
+    GtkWidget *title_label = gtk_label_new("Downloads");
+    gtk_widget_set_halign(title_label, GTK_ALIGN_START);
+    gtk_box_pack_start(GTK_BOX(card_header), title_label, TRUE, TRUE, 0);
+
+    GtkWidget *hide_button = gtk_button_new_from_icon_name("window-minimize-symbolic", GTK_ICON_SIZE_BUTTON);
+    gtk_widget_set_tooltip_text(hide_button, "Hide to Ticker");
+    g_signal_connect(hide_button, "clicked", G_CALLBACK(on_card_hide), downloads);
+    gtk_box_pack_end(GTK_BOX(card_header), hide_button, FALSE, FALSE, 0);
+
+    GtkWidget *clear_button = gtk_button_new_with_label("Clear");
+    gtk_widget_set_tooltip_text(clear_button, "Remove finished downloads");
+    g_signal_connect(clear_button, "clicked", G_CALLBACK(on_clear_finished), downloads);
+    gtk_box_pack_end(GTK_BOX(card_header), clear_button, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(card), card_header, FALSE, FALSE, 0);
+
+    // Download List
+    GtkWidget *scrolled = gtk_scrolled_window_new(NULL, NULL);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+    gtk_scrolled_window_set_propagate_natural_height(GTK_SCROLLED_WINDOW(scrolled), TRUE);
+    gtk_scrolled_window_set_max_content_height(GTK_SCROLLED_WINDOW(scrolled), 300);
+    downloads->list = gtk_list_box_new();
+    gtk_list_box_set_selection_mode(GTK_LIST_BOX(downloads->list), GTK_SELECTION_NONE);
+    gtk_container_add(GTK_CONTAINER(scrolled), downloads->list);
+    gtk_box_pack_start(GTK_BOX(card), scrolled, TRUE, TRUE, 0);
+
+    gtk_widget_show_all(card);
+    gtk_widget_set_no_show_all(card, TRUE); // Prevent show_all from showing this
+    gtk_widget_hide(card);
+    downloads->card = card;
+
+    // Ticker
+    GtkWidget *ticker = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+    // Class moved to button for better styling
+    gtk_widget_set_halign(ticker, GTK_ALIGN_START);
+    gtk_widget_set_valign(ticker, GTK_ALIGN_END);
+    gtk_widget_set_margin_start(ticker, 20);
+    gtk_widget_set_margin_bottom(ticker, 20);
+
+    GtkWidget *ticker_button = gtk_button_new_with_label("Downloads Manager");
+    gtk_style_context_add_class(gtk_widget_get_style_context(ticker_button), "download-ticker");
+    g_signal_connect(ticker_button, "clicked", G_CALLBACK(on_card_restore), downloads);
+    gtk_box_pack_start(GTK_BOX(ticker), ticker_button, TRUE, TRUE, 0);
+    downloads->ticker_button = ticker_button;
+
+    gtk_widget_show_all(ticker);
+    gtk_widget_set_no_show_all(ticker, TRUE); // Prevent show_all from showing this
+    gtk_widget_hide(ticker);
+    downloads->ticker = ticker;
+
+    return downloads;
+}
+
+void downloads_add_context(Downloads *downloads, WebKitWebContext *context, const char *cookie_file,
+                           DownloadStore *store) {
+    DownloadSource *source = g_new0(DownloadSource, 1);
+    source->downloads = downloads;
+    source->context = g_object_ref(context);
+    source->cookie_file = g_strdup(cookie_file);
+    source->store = store;
+    g_ptr_array_add(downloads->sources, source);
+
+    g_signal_connect(context, "download-started", G_CALLBACK(on_download_started), source);
+}
+
+void downloads_remove_context(Downloads *downloads, WebKitWebContext *context) {
+    for (guint i = 0; i < downloads->sources->len; i++) {
+        DownloadSource *source = g_ptr_array_index(downloads->sources, i);
+        if (source->context != context) continue;
+
+        g_signal_handlers_disconnect_by_data(context, source);
+        g_ptr_array_remove_index(downloads->sources, i);
+        g_object_unref(source->context);
+        g_free(source->cookie_file);
+        g_free(source);
+        return;
+    }
+}
+
+void downloads_add_to_overlay(Downloads *downloads, GtkOverlay *overlay) {
+    downloads->overlay = GTK_WIDGET(overlay);
+    gtk_overlay_add_overlay(overlay, downloads->card);
+    gtk_overlay_add_overlay(overlay, downloads->ticker);
+}
+
+void downloads_set_directory(Downloads *downloads, const char *directory) {
+    g_free(downloads->directory);
+    downloads->directory = directory && *directory ? g_strdup(directory) : NULL;
+}
+
+void downloads_set_ask(Downloads *downloads, gboolean ask) {
+    downloads->ask = ask;
+}
+
+void downloads_add_rule(Downloads *downloads, const char *match, const char *directory) {
+    DownloadRule *rule = g_new0(DownloadRule, 1);
+    rule->match = g_strdup(match);
+    rule->directory = g_strdup(directory);
+    g_ptr_array_add(downloads->rules, rule);
+}
+
+void downloads_set_segmenting(Downloads *downloads, guint64 threshold) {
+    downloads->segment_threshold = threshold;
+}
@@ -0,0 +1,47 @@
+#ifndef LEAF_CLASS_DOWNLOADS_H
+#define LEAF_CLASS_DOWNLOADS_H
+
+#include <gtk/gtk.h>
+#include <webkit2/webkit2.h>
+
+#include "download-store.h"
+
+// Download manager for one or more WebKitWebContexts. Every download gets
+// its own entry with stats and a row in the card overlay; at most max_active
+// transfers run at once and the rest wait in a queue. The card and the
+// ticker shown while the card is hidden are both views over the same list.
+typedef struct _Downloads Downloads;
+
+Downloads *downloads_new(guint max_active);
+
+// Manages the downloads started in context; cookie_file is that context's
+// cookie database, read by the segmented engine. Finished downloads go into
+// store (see download-store.h), and a file whose URL and validator match one
+// in there is linked into place instead of downloaded again; NULL leaves the
+// store off for this context. After removal, transfers already listed still
+// finish.
+void downloads_add_context(Downloads *downloads, WebKitWebContext *context, const char *cookie_file,
+                           DownloadStore *store);
+void downloads_remove_context(Downloads *downloads, WebKitWebContext *context);
+
+// Adds the card and ticker overlays on top of the web view
+void downloads_add_to_overlay(Downloads *downloads, GtkOverlay *overlay);
+
+// Destination policy. Downloads are saved without a prompt into the first
+// matching rule's directory, or into directory (NULL for the XDG download
+// dir), renamed "name (N).ext" on collision. With ask set, a non-modal file
+// chooser is shown instead and the download waits for it.
+//
+// Rule matches are "course:<Classroom course id>", "type:<mime/type>" or
+// "type:<mime>/*"; course rules win over type rules.
+void downloads_set_directory(Downloads *downloads, const char *directory);
+void downloads_set_ask(Downloads *downloads, gboolean ask);
+void downloads_add_rule(Downloads *downloads, const char *match, const char *directory);
+
+// Files of at least threshold bytes from servers that accept byte ranges are
+// taken over from WebKit by the segmented, resumable engine, which reads the
+// session cookies of the context the download came from. A threshold of 0
+// disables it.
+void downloads_set_segmenting(Downloads *downloads, guint64 threshold);
+
+#endif
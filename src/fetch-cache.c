@@ -0,0 +1,376 @@
+#include "fetch-cache.h"
+
+#include "config-store.h"
+
+#include <libsoup/soup.h>
+#include <glib/gstdio.h>
+
+// Cached responses are served without revalidation for this long
+#define FETCH_CACHE_FRESH_SECONDS (24 * 60 * 60)
+// Larger responses are passed through but not stored
+#define FETCH_CACHE_MAX_ENTRY_BYTES (4 * 1024 * 1024)
+#define FETCH_CACHE_INDEX_SAVE_DELAY_MS 2000
+
+typedef struct {
+    char *url;
+    char *content_type;
+    char *etag;
+    char *last_modified;
+    gint64 fetched;  // Unix time in seconds
+    guint64 size;
+} FetchEntry;
+
+struct _FetchCache {
+    char *dir;
+    char *index_path;
+    guint64 max_bytes;
+    guint64 total_bytes;
+    SoupSession *session;
+    GHashTable *entries;  // key -> FetchEntry
+    GHashTable *pending;  // key -> GPtrArray of WebKitURISchemeRequest waiting on one fetch
+    gboolean index_loaded;
+    ConfigStore *index_store;
+};
+
+typedef struct {
+    FetchCache *cache;
+    char *key;
+    char *url;
+    SoupMessage *message;
+} FetchJob;
+
+// A response body being written; its entry is indexed once the body is on disk
+typedef struct {
+    FetchCache *cache;
+    char *key;
+    FetchEntry *entry;
+} BodyWrite;
+
+static void fetch_entry_free(FetchEntry *entry) {
+    g_free(entry->url);
+    g_free(entry->content_type);
+    g_free(entry->etag);
+    g_free(entry->last_modified);
+    g_free(entry);
+}
+
+static char *body_path(FetchCache *cache, const char *key) {
+    return g_build_filename(cache->dir, key, NULL);
+}
+
+static void load_index(FetchCache *cache) {
+    GKeyFile *key_file = g_key_file_new();
+    cache->index_loaded = TRUE;
+
+    if (g_key_file_load_from_file(key_file, cache->index_path, G_KEY_FILE_NONE, NULL)) {
+        gchar **groups = g_key_file_get_groups(key_file, NULL);
+        for (int i = 0; groups[i] != NULL; i++) {
+            FetchEntry *entry = g_new0(FetchEntry, 1);
+            entry->url = g_key_file_get_string(key_file, groups[i], "URL", NULL);
+            entry->content_type = g_key_file_get_string(key_file, groups[i], "ContentType", NULL);
+            entry->etag = g_key_file_get_string(key_file, groups[i], "ETag", NULL);
+            entry->last_modified = g_key_file_get_string(key_file, groups[i], "LastModified", NULL);
+            entry->fetched = g_key_file_get_int64(key_file, groups[i], "Fetched", NULL);
+            entry->size = g_key_file_get_uint64(key_file, groups[i], "Size", NULL);
+
+            cache->total_bytes += entry->size;
+            g_hash_table_replace(cache->entries, g_strdup(groups[i]), entry);
+        }
+        g_strfreev(groups);
+    }
+
+    g_key_file_free(key_file);
+
+    // Bodies whose write finished after the last index save, or never finished
+    GDir *dir = g_dir_open(cache->dir, 0, NULL);
+    const char *name;
+    while (dir && (name = g_dir_read_name(dir)) != NULL) {
+        if (g_str_equal(name, "index.ini") || g_hash_table_contains(cache->entries, name)) continue;
+        char *path = g_build_filename(cache->dir, name, NULL);
+        g_unlink(path);
+        g_free(path);
+    }
+    if (dir) g_dir_close(dir);
+}
+
+static void fill_index(GKeyFile *key_file, gpointer user_data) {
+    FetchCache *cache = user_data;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, cache->entries);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        FetchEntry *entry = value;
+        g_key_file_set_string(key_file, key, "URL", entry->url);
+        if (entry->content_type) g_key_file_set_string(key_file, key, "ContentType", entry->content_type);
+        if (entry->etag) g_key_file_set_string(key_file, key, "ETag", entry->etag);
+        if (entry->last_modified) g_key_file_set_string(key_file, key, "LastModified", entry->last_modified);
+        g_key_file_set_int64(key_file, key, "Fetched", entry->fetched);
+        g_key_file_set_uint64(key_file, key, "Size", entry->size);
+    }
+}
+
+static void schedule_index_save(FetchCache *cache) {
+    config_store_mark_dirty(cache->index_store);
+}
+
+static void remove_entry(FetchCache *cache, const char *key) {
+    FetchEntry *entry = g_hash_table_lookup(cache->entries, key);
+    if (!entry) return;
+
+    char *path = body_path(cache, key);
+    g_unlink(path);
+    g_free(path);
+
+    cache->total_bytes -= MIN(entry->size, cache->total_bytes);
+    g_hash_table_remove(cache->entries, key);
+    schedule_index_save(cache);
+}
+
+// Evicts the least recently fetched entries until the cache fits its budget
+static void evict(FetchCache *cache, const char *keep_key) {
+    while (cache->total_bytes > cache->max_bytes) {
+        GHashTableIter iter;
+        gpointer key, value;
+        const char *oldest_key = NULL;
+        gint64 oldest = G_MAXINT64;
+
+        g_hash_table_iter_init(&iter, cache->entries);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            FetchEntry *entry = value;
+            if (g_strcmp0(key, keep_key) != 0 && entry->fetched < oldest) {
+                oldest = entry->fetched;
+                oldest_key = key;
+            }
+        }
+
+        if (!oldest_key) break;
+        char *victim = g_strdup(oldest_key);
+        remove_entry(cache, victim);
+        g_free(victim);
+    }
+}
+
+static void finish_with_stream(WebKitURISchemeRequest *request, GInputStream *stream, gint64 size, const char *content_type) {
+    WebKitURISchemeResponse *response = webkit_uri_scheme_response_new(stream, size);
+    SoupMessageHeaders *headers = soup_message_headers_new(SOUP_MESSAGE_HEADERS_RESPONSE);
+
+    // DarkReader reads these from a page origin, so the bridge has to opt in
+    // to CORS, for the requesting origin only (is_allowed checked it)
+    SoupMessageHeaders *request_headers = webkit_uri_scheme_request_get_http_headers(request);
+    const char *origin = request_headers ? soup_message_headers_get_one(request_headers, "Origin") : NULL;
+    if (origin) soup_message_headers_append(headers, "Access-Control-Allow-Origin", origin);
+    soup_message_headers_append(headers, "Vary", "Origin");
+    webkit_uri_scheme_response_set_http_headers(response, headers);
+    webkit_uri_scheme_response_set_status(response, 200, NULL);
+    webkit_uri_scheme_response_set_content_type(response, content_type ? content_type : "application/octet-stream");
+
+    webkit_uri_scheme_request_finish_with_response(request, response);
+    g_object_unref(response);
+}
+
+static gboolean finish_from_disk(FetchCache *cache, WebKitURISchemeRequest *request, const char *key) {
+    FetchEntry *entry = g_hash_table_lookup(cache->entries, key);
+    if (!entry) return FALSE;
+
+    char *path = body_path(cache, key);
+    GFile *file = g_file_new_for_path(path);
+    // Opening is cheap; WebKit reads the stream asynchronously
+    GFileInputStream *stream = g_file_read(file, NULL, NULL);
+    g_object_unref(file);
+    g_free(path);
+
+    if (!stream) {
+        remove_entry(cache, key);
+        return FALSE;
+    }
+
+    finish_with_stream(request, G_INPUT_STREAM(stream), entry->size, entry->content_type);
+    g_object_unref(stream);
+    return TRUE;
+}
+
+static void finish_error(WebKitURISchemeRequest *request, const char *message) {
+    GError *error = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_FAILED, message);
+    webkit_uri_scheme_request_finish_error(request, error);
+    g_error_free(error);
+}
+
+static void on_body_written(GObject *object, GAsyncResult *result, gpointer user_data) {
+    BodyWrite *write = user_data;
+    FetchCache *cache = write->cache;
+    GError *error = NULL;
+
+    if (g_file_replace_contents_finish(G_FILE(object), result, NULL, &error)) {
+        FetchEntry *previous = g_hash_table_lookup(cache->entries, write->key);
+        if (previous) cache->total_bytes -= MIN(previous->size, cache->total_bytes);
+        cache->total_bytes += write->entry->size;
+        g_hash_table_replace(cache->entries, g_strdup(write->key), write->entry);
+
+        evict(cache, write->key);
+        schedule_index_save(cache);
+    } else {
+        g_debug("fetch-cache: could not store %s: %s", write->entry->url, error->message);
+        g_error_free(error);
+        fetch_entry_free(write->entry);
+    }
+
+    g_free(write->key);
+    g_free(write);
+}
+
+static void store_entry(FetchCache *cache, const char *key, const char *url, SoupMessage *message, GBytes *body) {
+    SoupMessageHeaders *headers = soup_message_get_response_headers(message);
+    FetchEntry *entry = g_new0(FetchEntry, 1);
+
+    entry->url = g_strdup(url);
+    entry->content_type = g_strdup(soup_message_headers_get_content_type(headers, NULL));
+    entry->etag = g_strdup(soup_message_headers_get_one(headers, "ETag"));
+    entry->last_modified = g_strdup(soup_message_headers_get_one(headers, "Last-Modified"));
+    entry->fetched = g_get_real_time() / G_USEC_PER_SEC;
+    entry->size = g_bytes_get_size(body);
+
+    BodyWrite *write = g_new0(BodyWrite, 1);
+    write->cache = cache;
+    write->key = g_strdup(key);
+    write->entry = entry;
+
+    g_mkdir_with_parents(cache->dir, 0700);
+    char *path = body_path(cache, key);
+    GFile *file = g_file_new_for_path(path);
+    g_file_replace_contents_bytes_async(file, body, NULL, FALSE, G_FILE_CREATE_PRIVATE, NULL, on_body_written, write);
+    g_object_unref(file);
+    g_free(path);
+}
+
+static void on_fetch_finished(GObject *object, GAsyncResult *result, gpointer user_data) {
+    FetchJob *job = user_data;
+    FetchCache *cache = job->cache;
+    GError *error = NULL;
+    GBytes *body = soup_session_send_and_read_finish(SOUP_SESSION(object), result, &error);
+    guint status = soup_message_get_status(job->message);
+    GPtrArray *waiting = NULL;
+
+    g_hash_table_steal_extended(cache->pending, job->key, NULL, (gpointer *)&waiting);
+
+    if (body && status == SOUP_STATUS_NOT_MODIFIED && g_hash_table_contains(cache->entries, job->key)) {
+        FetchEntry *entry = g_hash_table_lookup(cache->entries, job->key);
+        entry->fetched = g_get_real_time() / G_USEC_PER_SEC;
+        schedule_index_save(cache);
+        g_clear_pointer(&body, g_bytes_unref);
+    } else if (body && SOUP_STATUS_IS_SUCCESSFUL(status)) {
+        if (g_bytes_get_size(body) <= FETCH_CACHE_MAX_ENTRY_BYTES) {
+            store_entry(cache, job->key, job->url, job->message, body);
+        }
+    } else {
+        // Network failure: fall back to a stale copy when there is one
+        g_clear_pointer(&body, g_bytes_unref);
+        if (error) {
+            g_debug("fetch-cache: %s: %s", job->url, error->message);
+        }
+    }
+
+    SoupMessageHeaders *headers = soup_message_get_response_headers(job->message);
+    for (guint i = 0; waiting && i < waiting->len; i++) {
+        WebKitURISchemeRequest *request = g_ptr_array_index(waiting, i);
+        if (body) {
+            GInputStream *stream = g_memory_input_stream_new_from_bytes(body);
+            finish_with_stream(request, stream, g_bytes_get_size(body),
+                               soup_message_headers_get_content_type(headers, NULL));
+            g_object_unref(stream);
+        } else if (!finish_from_disk(cache, request, job->key)) {
+            finish_error(request, error ? error->message : "Fetch failed");
+        }
+    }
+
+    if (waiting) g_ptr_array_unref(waiting);
+    if (body) g_bytes_unref(body);
+    if (error) g_error_free(error);
+    g_object_unref(job->message);
+    g_free(job->key);
+    g_free(job->url);
+    g_free(job);
+}
+
+FetchCache *fetch_cache_new(const char *cache_dir, guint64 max_bytes) {
+    FetchCache *cache = g_new0(FetchCache, 1);
+    cache->dir = g_build_filename(cache_dir, "fetch", NULL);
+    cache->index_path = g_build_filename(cache->dir, "index.ini", NULL);
+    cache->max_bytes = max_bytes;
+    cache->session = soup_session_new_with_options("max-conns-per-host", 4, NULL);
+    cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)fetch_entry_free);
+    cache->pending = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)g_ptr_array_unref);
+    cache->index_store = config_store_new_key_file(cache->index_path, FETCH_CACHE_INDEX_SAVE_DELAY_MS, fill_index, cache);
+    return cache;
+}
+
+// The bridge only answers requests whose Origin is a Google page, and only
+// for https targets, so arbitrary sites (or frames embedded in a Google
+// page) cannot use it to read cross-origin or local resources
+static gboolean is_allowed(WebKitURISchemeRequest *request, const char *url) {
+    SoupMessageHeaders *headers = webkit_uri_scheme_request_get_http_headers(request);
+    const char *origin_uri = headers ? soup_message_headers_get_one(headers, "Origin") : NULL;
+    gboolean allowed = FALSE;
+
+    if (!url || !g_str_has_prefix(url, "https://") || !origin_uri) return FALSE;
+
+    GUri *origin = g_uri_parse(origin_uri, G_URI_FLAGS_NONE, NULL);
+    if (origin) {
+        const char *host = g_uri_get_host(origin);
+        allowed = g_strcmp0(g_uri_get_scheme(origin), "https") == 0 && host &&
+                  (g_str_equal(host, "google.com") || g_str_has_suffix(host, ".google.com"));
+        g_uri_unref(origin);
+    }
+    return allowed;
+}
+
+void fetch_cache_handle_request(FetchCache *cache, WebKitURISchemeRequest *request, const char *url) {
+    if (!is_allowed(request, url)) {
+        finish_error(request, "Fetch not allowed");
+        return;
+    }
+
+    if (!cache->index_loaded) load_index(cache);
+
+    char *key = g_compute_checksum_for_string(G_CHECKSUM_SHA1, url, -1);
+    FetchEntry *entry = g_hash_table_lookup(cache->entries, key);
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+
+    if (entry && now - entry->fetched < FETCH_CACHE_FRESH_SECONDS && finish_from_disk(cache, request, key)) {
+        g_free(key);
+        return;
+    }
+
+    // Coalesce concurrent requests for the same URL (e.g. several frames)
+    GPtrArray *waiting = g_hash_table_lookup(cache->pending, key);
+    if (waiting) {
+        g_ptr_array_add(waiting, g_object_ref(request));
+        g_free(key);
+        return;
+    }
+
+    SoupMessage *message = soup_message_new("GET", url);
+    if (!message) {
+        finish_error(request, "Invalid URL");
+        g_free(key);
+        return;
+    }
+
+    entry = g_hash_table_lookup(cache->entries, key);
+    if (entry) {
+        SoupMessageHeaders *headers = soup_message_get_request_headers(message);
+        if (entry->etag) soup_message_headers_replace(headers, "If-None-Match", entry->etag);
+        if (entry->last_modified) soup_message_headers_replace(headers, "If-Modified-Since", entry->last_modified);
+    }
+
+    waiting = g_ptr_array_new_with_free_func(g_object_unref);
+    g_ptr_array_add(waiting, g_object_ref(request));
+    g_hash_table_insert(cache->pending, g_strdup(key), waiting);
+
+    FetchJob *job = g_new0(FetchJob, 1);
+    job->cache = cache;
+    job->key = key;
+    job->url = g_strdup(url);
+    job->message = message;
+    soup_session_send_and_read_async(cache->session, message, G_PRIORITY_LOW, NULL, on_fetch_finished, job);
+}
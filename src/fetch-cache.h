@@ -0,0 +1,17 @@
+#ifndef LEAF_CLASS_FETCH_CACHE_H
+#define LEAF_CLASS_FETCH_CACHE_H
+
+#include <webkit2/webkit2.h>
+
+// Native fetch bridge for DarkReader, served as leaf://fetch?url=<url>.
+// Cross-origin stylesheets and images are fetched once with libsoup and kept
+// in a size-bounded on-disk cache keyed by URL and revalidated with
+// ETag/Last-Modified, so DarkReader no longer refetches them on every
+// navigation or trips over CORS.
+typedef struct _FetchCache FetchCache;
+
+FetchCache *fetch_cache_new(const char *cache_dir, guint64 max_bytes);
+
+void fetch_cache_handle_request(FetchCache *cache, WebKitURISchemeRequest *request, const char *url);
+
+#endif
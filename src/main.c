@@ -1,76 +1,168 @@
+#include <glib-unix.h>
 #include <gtk/gtk.h>
 #include <webkit2/webkit2.h>
 
+#include "config-store.h"
+#include "dark-mode.h"
+#include "downloads.h"
+#include "fetch-cache.h"
+#include "offline-cache.h"
+#include "poller.h"
+#include "profiles.h"
+#include "recovery.h"
+#include "resource-profile.h"
+#include "search.h"
+#include "storage.h"
+#include "tabs.h"
+#include "theme.h"
+#include "trace.h"
+#include "warmup.h"
+
+#include <signal.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
 typedef struct {
     char *theme;
     int width;
     int height;
     char *last_url;
+    gboolean static_dark;
+    int max_downloads;
+    char *download_dir;
+    gboolean ask_download;
+    GKeyFile *download_rules;  // [DownloadRules] match=directory, kept verbatim
+    int segment_threshold_mb;
+    int download_store_mb;  // 0 disables the store of earlier downloads
+    char *resource_profile;
+    int memory_budget_mb;  // 0 uses the profile's budget
+    int hibernate_minutes;  // 0 keeps background tabs alive
+    int offline_max_mb;     // 0 disables offline snapshots
+    double zoom;
+    gchar **prefetch_hosts;  // resolved at startup, besides the learned ones
+    int storage_quota_mb;  // website data; 0 for no limit
+    gboolean run_in_background;  // closing the window only hides it
+    char *feed_url;              // polled while hidden; NULL or empty for none
+    int poll_seconds;
 } AppConfig;
 
-static AppConfig config = {NULL, 1024, 768, NULL};
+static AppConfig config = {NULL, 1024, 768, NULL, FALSE, 3, NULL, FALSE, NULL, 16, 1024, NULL, 0, 10, 100, 1.0, NULL, 512, FALSE, NULL, 900};
+
+static const char *const default_prefetch_hosts[] = {
+    "classroom.google.com",
+    "accounts.google.com",
+    "www.gstatic.com",
+    "ssl.gstatic.com",
+    "fonts.gstatic.com",
+    "lh3.googleusercontent.com",
+    "drive.google.com",
+    "docs.google.com",
+    NULL
+};
+
+// Shared by every tab: views are built from their profile's context and
+// content manager plus these settings, and the header bar follows whichever
+// tab is focused. context and tabs are the current profile's.
+typedef struct {
+    GtkWidget *window;
+    GtkWidget *url_entry;
+    GtkWidget *spinner;
+    GtkWidget *profile_label;
+    GtkWidget *tab_bars;  // one tab strip per warm profile
+    GtkWidget *pages;     // likewise for the page stacks
+    WebKitWebContext *context;
+    WebKitSettings *settings;
+    Tabs *tabs;
+    Profiles *profiles;
+    Profile *profile;
+    GMenu *profiles_menu;
+    Downloads *downloads;
+} Browser;
+
+static Browser browser = {0};
+
+// Theme, dark mode and zoom reach the tabs of every warm profile, not just
+// the current one
+static void foreach_warm_view(GFunc func, gpointer user_data) {
+    if (!browser.profiles) return;
+
+    GPtrArray *accounts = profiles_get_all(browser.profiles);
+    for (guint i = 0; i < accounts->len; i++) {
+        Profile *account = g_ptr_array_index(accounts, i);
+        if (account->tabs) tabs_foreach_view(account->tabs, func, user_data);
+    }
+}
+
+// Bundled themes, darkreader.js and the icon are compiled in as a GResource
+// (see resources/leaf-class.gresource.xml) and are also served to pages
+// under leaf://resources/<path>. leaf://fetch?url=<url> is DarkReader's
+// native fetch bridge.
+#define LEAF_CLASS_RESOURCE_PREFIX "/com/example/LeafClass"
+#define LEAF_CLASS_URI_SCHEME "leaf"
+#define FETCH_CACHE_MAX_BYTES (32 * 1024 * 1024)
+#define MEMORY_MONITOR_INTERVAL_SECONDS 5
+#define HOME_URL "https://classroom.google.com/"
+#define CONFIG_SAVE_DELAY_MS 1000
+#define ZOOM_MIN 0.3
+#define ZOOM_MAX 3.0
+#define ZOOM_STEP 1.1
 
 static char *get_config_path() {
     return g_build_filename(g_get_user_config_dir(), "leaf-class", "config.ini", NULL);
 }
 
-typedef struct {
-    GtkWidget *overlay;
-    GtkWidget *card;
-    GtkWidget *ticker;
-    GtkWidget *filename_label;
-    GtkWidget *status_label;
-    GtkWidget *progress_bar;
-    GtkWidget *speed_label;
-    GtkWidget *time_label;
-    GtkWidget *ticker_button;
-    GtkWidget *cancel_button;
-    GtkWidget *dismiss_button;
-    WebKitDownload *current_download;
-    guint64 start_time;
-    guint64 last_update_time;
-    guint64 last_bytes;
-} DownloadWidgets;
-
-// ... helpers ...
-static char *format_size(guint64 bytes) {
-    const char *units[] = {"B", "KB", "MB", "GB", "TB"};
-    int i = 0;
-    double size = bytes;
-    while (size >= 1024 && i < 4) {
-        size /= 1024;
-        i++;
-    }
-    return g_strdup_printf("%.1f %s", size, units[i]);
-}
-
-static char *format_time(guint64 seconds) {
-    if (seconds < 60) return g_strdup_printf("%lds", seconds);
-    if (seconds < 3600) return g_strdup_printf("%ldm %lds", seconds / 60, seconds % 60);
-    return g_strdup_printf("%ldh %ldm", seconds / 3600, (seconds % 3600) / 60);
+static char *serialize_config(gsize *length, gpointer user_data) {
+    GKeyFile *key_file = g_key_file_new();
+    g_key_file_set_string(key_file, "General", "Theme", config.theme ? config.theme : "light");
+    g_key_file_set_integer(key_file, "General", "Width", config.width);
+    g_key_file_set_integer(key_file, "General", "Height", config.height);
+    g_key_file_set_string(key_file, "General", "LastURL", config.last_url ? config.last_url : HOME_URL);
+    g_key_file_set_boolean(key_file, "General", "StaticDark", config.static_dark);
+    g_key_file_set_double(key_file, "General", "Zoom", config.zoom);
+    g_key_file_set_integer(key_file, "Downloads", "MaxActive", config.max_downloads);
+    g_key_file_set_string(key_file, "Downloads", "Directory", config.download_dir ? config.download_dir : "");
+    g_key_file_set_boolean(key_file, "Downloads", "AskForDestination", config.ask_download);
+    g_key_file_set_integer(key_file, "Downloads", "SegmentThresholdMB", config.segment_threshold_mb);
+    g_key_file_set_integer(key_file, "Downloads", "StoreMB", config.download_store_mb);
+    g_key_file_set_string(key_file, "Resources", "Profile", config.resource_profile ? config.resource_profile : "balanced");
+    g_key_file_set_integer(key_file, "Resources", "BudgetMB", config.memory_budget_mb);
+    g_key_file_set_integer(key_file, "Tabs", "HibernateMinutes", config.hibernate_minutes);
+    g_key_file_set_integer(key_file, "Offline", "MaxMB", config.offline_max_mb);
+    g_key_file_set_integer(key_file, "Storage", "QuotaMB", config.storage_quota_mb);
+    g_key_file_set_boolean(key_file, "Background", "Enabled", config.run_in_background);
+    g_key_file_set_string(key_file, "Background", "FeedURL", config.feed_url ? config.feed_url : "");
+    g_key_file_set_integer(key_file, "Background", "PollSeconds", config.poll_seconds);
+    if (config.prefetch_hosts) {
+        g_key_file_set_string_list(key_file, "Network", "PrefetchHosts", (const gchar *const *)config.prefetch_hosts,
+                                   g_strv_length(config.prefetch_hosts));
+    }
+    
+    gchar **rule_keys = config.download_rules ? g_key_file_get_keys(config.download_rules, "DownloadRules", NULL, NULL) : NULL;
+    for (int i = 0; rule_keys && rule_keys[i] != NULL; i++) {
+        char *directory = g_key_file_get_string(config.download_rules, "DownloadRules", rule_keys[i], NULL);
+        g_key_file_set_string(key_file, "DownloadRules", rule_keys[i], directory);
+        g_free(directory);
+    }
+    g_strfreev(rule_keys);
+    
+    char *data = g_key_file_to_data(key_file, length, NULL);
+    g_key_file_free(key_file);
+    return data;
 }
 
+// Settings are written in the background CONFIG_SAVE_DELAY_MS after the
+// last change, and flushed synchronously on shutdown
+static ConfigStore *config_store = NULL;
+
 static void save_config() {
-    char *config_path = get_config_path();
-    char *config_dir = g_path_get_dirname(config_path);
-    
-    if (g_mkdir_with_parents(config_dir, 0700) == 0) {
-        GKeyFile *key_file = g_key_file_new();
-        g_key_file_set_string(key_file, "General", "Theme", config.theme ? config.theme : "light");
-        g_key_file_set_integer(key_file, "General", "Width", config.width);
-        g_key_file_set_integer(key_file, "General", "Height", config.height);
-        g_key_file_set_string(key_file, "General", "LastURL", config.last_url ? config.last_url : "https://classroom.google.com/");
-        
-        gsize length;
-        char *data = g_key_file_to_data(key_file, &length, NULL);
-        g_file_set_contents(config_path, data, length, NULL);
-        
-        g_free(data);
-        g_key_file_free(key_file);
+    if (!config_store) {
+        char *config_path = get_config_path();
+        config_store = config_store_new(config_path, CONFIG_SAVE_DELAY_MS, serialize_config, NULL);
+        g_free(config_path);
     }
-    
-    g_free(config_dir);
-    g_free(config_path);
+    config_store_mark_dirty(config_store);
 }
 
 static void load_config() {
@@ -89,63 +181,137 @@ static void load_config() {
             
         if (config.last_url) g_free(config.last_url);
         config.last_url = g_key_file_get_string(key_file, "General", "LastURL", NULL);
+        
+        config.static_dark = g_key_file_get_boolean(key_file, "General", "StaticDark", NULL);
+        
+        if (g_key_file_has_key(key_file, "General", "Zoom", NULL))
+            config.zoom = CLAMP(g_key_file_get_double(key_file, "General", "Zoom", NULL), ZOOM_MIN, ZOOM_MAX);
+        
+        if (g_key_file_has_key(key_file, "Downloads", "MaxActive", NULL))
+            config.max_downloads = g_key_file_get_integer(key_file, "Downloads", "MaxActive", NULL);
+        
+        if (config.download_dir) g_free(config.download_dir);
+        config.download_dir = g_key_file_get_string(key_file, "Downloads", "Directory", NULL);
+        config.ask_download = g_key_file_get_boolean(key_file, "Downloads", "AskForDestination", NULL);
+        
+        if (g_key_file_has_key(key_file, "Downloads", "SegmentThresholdMB", NULL))
+            config.segment_threshold_mb = g_key_file_get_integer(key_file, "Downloads", "SegmentThresholdMB", NULL);
+        
+        if (g_key_file_has_key(key_file, "Downloads", "StoreMB", NULL))
+            config.download_store_mb = g_key_file_get_integer(key_file, "Downloads", "StoreMB", NULL);
+        
+        if (config.resource_profile) g_free(config.resource_profile);
+        config.resource_profile = g_key_file_get_string(key_file, "Resources", "Profile", NULL);
+        config.memory_budget_mb = g_key_file_get_integer(key_file, "Resources", "BudgetMB", NULL);
+        
+        if (g_key_file_has_key(key_file, "Tabs", "HibernateMinutes", NULL))
+            config.hibernate_minutes = g_key_file_get_integer(key_file, "Tabs", "HibernateMinutes", NULL);
+        
+        if (g_key_file_has_key(key_file, "Offline", "MaxMB", NULL))
+            config.offline_max_mb = g_key_file_get_integer(key_file, "Offline", "MaxMB", NULL);
+        if (g_key_file_has_key(key_file, "Storage", "QuotaMB", NULL))
+            config.storage_quota_mb = g_key_file_get_integer(key_file, "Storage", "QuotaMB", NULL);
+        
+        config.run_in_background = g_key_file_get_boolean(key_file, "Background", "Enabled", NULL);
+        if (config.feed_url) g_free(config.feed_url);
+        config.feed_url = g_key_file_get_string(key_file, "Background", "FeedURL", NULL);
+        if (g_key_file_has_key(key_file, "Background", "PollSeconds", NULL))
+            config.poll_seconds = g_key_file_get_integer(key_file, "Background", "PollSeconds", NULL);
+        
+        g_strfreev(config.prefetch_hosts);
+        config.prefetch_hosts = g_key_file_get_string_list(key_file, "Network", "PrefetchHosts", NULL, NULL);
+        
+        if (config.download_rules) g_key_file_free(config.download_rules);
+        config.download_rules = g_key_file_new();
+        gchar **rule_keys = g_key_file_get_keys(key_file, "DownloadRules", NULL, NULL);
+        for (int i = 0; rule_keys && rule_keys[i] != NULL; i++) {
+            char *directory = g_key_file_get_string(key_file, "DownloadRules", rule_keys[i], NULL);
+            g_key_file_set_string(config.download_rules, "DownloadRules", rule_keys[i], directory);
+            g_free(directory);
+        }
+        g_strfreev(rule_keys);
     }
     
     if (!config.theme) config.theme = g_strdup("light");
-    if (!config.last_url) config.last_url = g_strdup("https://classroom.google.com/");
+    if (!config.last_url) config.last_url = g_strdup(HOME_URL);
+    if (!config.resource_profile) config.resource_profile = g_strdup("balanced");
+    if (!config.prefetch_hosts) config.prefetch_hosts = g_strdupv((gchar **)default_prefetch_hosts);
     
     g_key_file_free(key_file);
     g_free(config_path);
 }
 
-static void go_home(GtkWidget *widget, WebKitWebView *webview) {
-    webkit_web_view_load_uri(webview, "https://classroom.google.com/");
+static void go_home(GtkWidget *widget, gpointer user_data) {
+    WebKitWebView *webview = tabs_get_current_view(browser.tabs);
+    if (webview) webkit_web_view_load_uri(webview, HOME_URL);
 }
 
-static void copy_url(GtkWidget *widget, WebKitWebView *web_view) {
-    const gchar *uri = webkit_web_view_get_uri(web_view);
+static void go_back(GtkWidget *widget, gpointer user_data) {
+    WebKitWebView *webview = tabs_get_current_view(browser.tabs);
+    if (webview) webkit_web_view_go_back(webview);
+}
+
+static void go_forward(GtkWidget *widget, gpointer user_data) {
+    WebKitWebView *webview = tabs_get_current_view(browser.tabs);
+    if (webview) webkit_web_view_go_forward(webview);
+}
+
+static void copy_url(GtkWidget *widget, gpointer user_data) {
+    WebKitWebView *webview = tabs_get_current_view(browser.tabs);
+    const gchar *uri = webview ? webkit_web_view_get_uri(webview) : NULL;
+    if (!uri) return;
     GtkClipboard *clipboard = gtk_clipboard_get(GDK_SELECTION_CLIPBOARD);
     gtk_clipboard_set_text(clipboard, uri, -1);
 }
 
-static void set_theme(const char *theme_name, WebKitWebView *webview) {
-    GtkCssProvider *provider = gtk_css_provider_new();
-    GdkDisplay *display = gdk_display_get_default();
-    GdkScreen *screen = gdk_display_get_default_screen(display);
-    
-    #define LEAF_CLASS_DATA_DIR "/usr/share/leaf-class"
-    char *css_path = g_build_filename(LEAF_CLASS_DATA_DIR, "css", theme_name, NULL);
-    gtk_css_provider_load_from_path(provider, css_path, NULL);
-    gtk_style_context_add_provider_for_screen(screen, GTK_STYLE_PROVIDER(provider), GTK_STYLE_PROVIDER_PRIORITY_USER);
-    
-    g_object_unref(provider);
-    g_free(css_path);
+static ThemeEngine *theme_engine = NULL;
 
-    // WebView Theme Adaptation
+// WebView Theme Adaptation
+static void set_view_background(gpointer webview, gpointer user_data) {
     GdkRGBA color;
-    if (g_strcmp0(theme_name, "transparent.css") == 0) {
+    if (g_strcmp0(config.theme, "transparent") == 0) {
         gdk_rgba_parse(&color, "rgba(0,0,0,0)");
-    } else if (g_strcmp0(theme_name, "dark.css") == 0) {
+    } else if (g_strcmp0(config.theme, "dark") == 0) {
         gdk_rgba_parse(&color, "#242424");
     } else {
         gdk_rgba_parse(&color, "#ffffff");
     }
-    webkit_web_view_set_background_color(webview, &color);
+    webkit_web_view_set_background_color(WEBKIT_WEB_VIEW(webview), &color);
 }
 
-static void enable_dark_mode(WebKitWebView *webview) {
-    const char *script = "DarkReader.enable({brightness: 100, contrast: 100, sepia: 0});";
-    webkit_web_view_evaluate_javascript(webview, script, -1, NULL, NULL, NULL, NULL, NULL);
+static void set_theme(const char *theme_name) {
+    if (!theme_engine) {
+        GdkScreen *screen = gdk_display_get_default_screen(gdk_display_get_default());
+        theme_engine = theme_engine_new(screen, LEAF_CLASS_RESOURCE_PREFIX, g_getenv("LEAF_CLASS_THEME_DIR"));
+    }
+    theme_engine_set_theme(theme_engine, theme_name);
+
+    foreach_warm_view(set_view_background, NULL);
 }
 
-static void disable_dark_mode(WebKitWebView *webview) {
-    const char *script = "DarkReader.disable();";
-    webkit_web_view_evaluate_javascript(webview, script, -1, NULL, NULL, NULL, NULL, NULL);
+// DarkReader is mapped straight from the resource section and shared by
+// every profile's DarkMode
+static GBytes *darkreader = NULL;
+
+static Profile *view_profile(WebKitWebView *webview);
+
+static void apply_dark_mode(gpointer webview, gpointer user_data) {
+    dark_mode_apply(view_profile(webview)->dark_mode, WEBKIT_WEB_VIEW(webview));
+}
+
+static void on_theme_painted(GdkFrameClock *clock, gpointer user_data) {
+    g_signal_handlers_disconnect_by_func(clock, on_theme_painted, user_data);
+    trace_instant(NULL, "ui", "theme painted", NULL);
+}
+
+static gboolean on_theme_frame(GtkWidget *widget, GdkFrameClock *clock, gpointer user_data) {
+    g_signal_connect(clock, "after-paint", G_CALLBACK(on_theme_painted), NULL);
+    return G_SOURCE_REMOVE;
 }
 
 static void on_theme_changed(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
     const char *theme = g_variant_get_string(parameter, NULL);
-    WebKitWebView *webview = WEBKIT_WEB_VIEW(user_data);
+    gint64 start = g_get_monotonic_time();
 
     // Update state to reflect selection
     g_simple_action_set_state(action, parameter);
@@ -153,246 +319,641 @@ static void on_theme_changed(GSimpleAction *action, GVariant *parameter, gpointe
     if (config.theme) g_free(config.theme);
     config.theme = g_strdup(theme);
     
-    char *css_file = g_strdup_printf("%s.css", theme);
-    set_theme(css_file, webview);
-    g_free(css_file);
+    set_theme(theme);
     
-    if (g_strcmp0(theme, "dark") == 0) {
-        enable_dark_mode(webview);
-    } else {
-        disable_dark_mode(webview);
+    GPtrArray *accounts = profiles_get_all(browser.profiles);
+    for (guint i = 0; i < accounts->len; i++) {
+        Profile *account = g_ptr_array_index(accounts, i);
+        if (account->dark_mode) dark_mode_set_enabled(account->dark_mode, g_strcmp0(theme, "dark") == 0);
     }
+    foreach_warm_view(apply_dark_mode, NULL);
     
     save_config();
+
+    if (trace_is_enabled()) {
+        trace_complete(NULL, "ui", "theme toggle", start, g_get_monotonic_time(), "theme", theme, NULL);
+        gtk_widget_add_tick_callback(browser.window, on_theme_frame, NULL, NULL);
+    }
 }
 
-static gboolean on_window_delete(GtkWidget *widget, GdkEvent *event, gpointer user_data) {
-    WebKitWebView *webview = WEBKIT_WEB_VIEW(user_data);
-    
-    gtk_window_get_size(GTK_WINDOW(widget), &config.width, &config.height);
-    
-    if (config.last_url) g_free(config.last_url);
-    config.last_url = g_strdup(webkit_web_view_get_uri(webview));
-    
+static MemoryMonitor *memory_monitor = NULL;
+
+static guint64 memory_budget_bytes(const ResourceProfile *profile) {
+    guint budget_mb = config.memory_budget_mb > 0 ? (guint)config.memory_budget_mb : profile->budget_mb;
+    return (guint64)budget_mb * 1024 * 1024;
+}
+
+static void on_memory_over_budget(guint64 rss_bytes, gpointer user_data) {
+    // Background tabs go first, then decoded images, scripts and the page
+    // cache in every web process
+    tabs_hibernate_background(browser.tabs);
+
+    WebKitWebsiteDataManager *manager = webkit_web_context_get_website_data_manager(browser.context);
+    webkit_website_data_manager_clear(manager, WEBKIT_WEBSITE_DATA_MEMORY_CACHE, 0, NULL, NULL, NULL);
+
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+}
+
+static void on_web_process_terminated(WebKitWebView *webview, WebKitWebProcessTerminationReason reason,
+                                      gpointer user_data) {
+    if (webview == tabs_get_current_view(browser.tabs)) gtk_spinner_stop(GTK_SPINNER(browser.spinner));
+
+    // Make room before the page comes back, or it will be killed again
+    if (reason == WEBKIT_WEB_PROCESS_EXCEEDED_MEMORY_LIMIT) on_memory_over_budget(0, NULL);
+}
+
+static void on_resource_profile_changed(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
+    const ResourceProfile *profile = resource_profile_lookup(g_variant_get_string(parameter, NULL));
+
+    g_simple_action_set_state(action, g_variant_new_string(profile->name));
+
+    if (config.resource_profile) g_free(config.resource_profile);
+    config.resource_profile = g_strdup(profile->name);
+
+    // Process memory limits are fixed at startup; the rest applies now
+    GPtrArray *accounts = profiles_get_all(browser.profiles);
+    for (guint i = 0; i < accounts->len; i++) {
+        Profile *account = g_ptr_array_index(accounts, i);
+        if (account->context) resource_profile_apply(profile, account->context, browser.settings);
+    }
+    memory_monitor_set_budget(memory_monitor, memory_budget_bytes(profile));
+
     save_config();
-    
-    return FALSE; // Propagate event to destroy window
 }
 
-// Correct approach for splash timeout
-static gboolean close_splash_and_show_main(gpointer user_data) {
-    GtkWidget **windows = (GtkWidget **)user_data;
-    GtkWidget *splash = windows[0];
-    GtkWidget *main_window = windows[1];
+static void on_static_dark_changed(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
+    GVariant *state = g_action_get_state(G_ACTION(action));
+    gboolean use_static = !g_variant_get_boolean(state);
+    g_variant_unref(state);
+
+    g_simple_action_set_state(action, g_variant_new_boolean(use_static));
+    config.static_dark = use_static;
+    GPtrArray *accounts = profiles_get_all(browser.profiles);
+    for (guint i = 0; i < accounts->len; i++) {
+        Profile *account = g_ptr_array_index(accounts, i);
+        if (account->dark_mode) dark_mode_set_static(account->dark_mode, use_static);
+    }
     
-    gtk_widget_destroy(splash);
-    gtk_widget_show_all(main_window);
+    save_config();
+}
+
+static void on_ask_download_changed(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
+    Downloads *downloads = user_data;
+    GVariant *state = g_action_get_state(G_ACTION(action));
+    gboolean ask = !g_variant_get_boolean(state);
+    g_variant_unref(state);
+
+    g_simple_action_set_state(action, g_variant_new_boolean(ask));
+    config.ask_download = ask;
+    downloads_set_ask(downloads, ask);
     
-    g_free(windows);
+    save_config();
+}
+
+// Only real pages are reopened at startup, not offline snapshots
+static void remember_url(const char *uri) {
+    if (!uri || !(g_str_has_prefix(uri, "https://") || g_str_has_prefix(uri, "http://"))) return;
+    if (browser.profile) profiles_set_last_url(browser.profiles, browser.profile, uri);
+    if (g_strcmp0(uri, config.last_url) == 0) return;
+
+    g_free(config.last_url);
+    config.last_url = g_strdup(uri);
+    save_config();
+}
+
+static gboolean on_window_configure(GtkWidget *widget, GdkEvent *event, gpointer user_data) {
+    int width, height;
+
+    // Keep the last normal size so an unmaximized window comes back right
+    if (gtk_window_is_maximized(GTK_WINDOW(widget))) return FALSE;
+
+    gtk_window_get_size(GTK_WINDOW(widget), &width, &height);
+    if (width != config.width || height != config.height) {
+        config.width = width;
+        config.height = height;
+        save_config();
+    }
     return FALSE;
 }
 
-static void on_download_dismiss(GtkButton *button, DownloadWidgets *widgets) {
-    gtk_widget_hide(widgets->card);
-    gtk_widget_hide(widgets->ticker);
+static void set_view_zoom(gpointer webview, gpointer user_data) {
+    webkit_web_view_set_zoom_level(WEBKIT_WEB_VIEW(webview), config.zoom);
 }
 
-static void on_download_cancel(GtkButton *button, DownloadWidgets *widgets) {
-    if (widgets->current_download) {
-        webkit_download_cancel(widgets->current_download);
+static void on_zoom(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
+    const char *name = g_action_get_name(G_ACTION(action));
+
+    if (g_strcmp0(name, "zoom-in") == 0) {
+        config.zoom = MIN(config.zoom * ZOOM_STEP, ZOOM_MAX);
+    } else if (g_strcmp0(name, "zoom-out") == 0) {
+        config.zoom = MAX(config.zoom / ZOOM_STEP, ZOOM_MIN);
+    } else {
+        config.zoom = 1.0;
     }
-    gtk_widget_hide(widgets->card);
-    gtk_widget_hide(widgets->ticker);
+
+    foreach_warm_view(set_view_zoom, NULL);
+    save_config();
 }
 
-static void on_download_hide(GtkButton *button, DownloadWidgets *widgets) {
-    gtk_widget_hide(widgets->card);
-    gtk_widget_show(widgets->ticker);
+// Background mode: closing the window hides it and hibernates every tab,
+// so the web processes exit while the application stays up. A feed poller
+// stands in for the pages until the window is shown again.
+#define BACKGROUND_NOTIFICATION_ID "new-posts"
+#define BACKGROUND_NOTIFICATION_MAX_LINES 3
+
+static gboolean browser_hidden = FALSE;
+
+static void on_new_posts(GPtrArray *items, gpointer user_data) {
+    PollerItem *last = g_ptr_array_index(items, items->len - 1);
+    GNotification *notification;
+
+    if (items->len == 1) {
+        notification = g_notification_new("New in Classroom");
+        g_notification_set_body(notification, last->title ? last->title : last->link);
+    } else {
+        char *title = g_strdup_printf("%u new posts in Classroom", items->len);
+        GString *body = g_string_new(NULL);
+        for (guint i = items->len; i > 0 && items->len - i < BACKGROUND_NOTIFICATION_MAX_LINES; i--) {
+            PollerItem *item = g_ptr_array_index(items, i - 1);
+            if (!item->title) continue;
+            if (body->len) g_string_append_c(body, '\n');
+            g_string_append(body, item->title);
+        }
+        notification = g_notification_new(title);
+        g_notification_set_body(notification, body->str);
+        g_string_free(body, TRUE);
+        g_free(title);
+    }
+
+    // The newest post opens in a tab; without a link just show the window
+    if (last->link) {
+        g_notification_set_default_action_and_target(notification, "app.open-link", "s", last->link);
+    } else {
+        g_notification_set_default_action(notification, "app.show");
+    }
+    g_application_send_notification(g_application_get_default(), BACKGROUND_NOTIFICATION_ID, notification);
+    g_object_unref(notification);
 }
 
-static void on_download_restore(GtkButton *button, DownloadWidgets *widgets) {
-    gtk_widget_hide(widgets->ticker);
-    gtk_widget_show(widgets->card);
+static void hide_browser(void) {
+    GtkApplication *app = GTK_APPLICATION(g_application_get_default());
+
+    // Popups and dialogs belong to the pages that are going away
+    GList *windows = g_list_copy(gtk_application_get_windows(app));
+    for (GList *l = windows; l != NULL; l = l->next) {
+        if (l->data != browser.window) gtk_widget_destroy(GTK_WIDGET(l->data));
+    }
+    g_list_free(windows);
+
+    gtk_widget_hide(browser.window);
+    browser_hidden = TRUE;
+    tabs_suspend(browser.tabs);
+
+    // The feed is read with the current profile's sign-in, the one whose
+    // window is being hidden
+    Profile *account = browser.profile;
+    if (!config.feed_url || !*config.feed_url) return;
+    if (!account->poller) {
+        char *cookie_file = g_build_filename(account->data_dir, "cookies.sqlite", NULL);
+        account->poller = poller_new(cookie_file, webkit_settings_get_user_agent(browser.settings), on_new_posts, NULL);
+        g_free(cookie_file);
+    }
+    poller_start(account->poller, config.feed_url, (guint)MAX(config.poll_seconds, 0));
 }
 
-static void on_download_failed(WebKitDownload *download, GError *error, DownloadWidgets *widgets) {
-    if (g_error_matches(error, WEBKIT_DOWNLOAD_ERROR, WEBKIT_DOWNLOAD_ERROR_CANCELLED_BY_USER)) {
-        // If cancelled by user, just hide everything
-        gtk_widget_hide(widgets->card);
-        gtk_widget_hide(widgets->ticker);
-        return;
+static void show_browser(void) {
+    if (browser_hidden) {
+        browser_hidden = FALSE;
+        if (browser.profile->poller) poller_stop(browser.profile->poller);
+        g_application_withdraw_notification(g_application_get_default(), BACKGROUND_NOTIFICATION_ID);
+        tabs_resume(browser.tabs);
     }
-    gtk_label_set_text(GTK_LABEL(widgets->status_label), "Failed");
-    gtk_widget_hide(widgets->ticker);
-    gtk_widget_show(widgets->card);
-    
-    gtk_widget_hide(widgets->cancel_button);
-    gtk_widget_show(widgets->dismiss_button);
+    gtk_window_present(GTK_WINDOW(browser.window));
 }
 
-static void on_download_finished(WebKitDownload *download, DownloadWidgets *widgets) {
-    gtk_label_set_text(GTK_LABEL(widgets->status_label), "Finished");
-    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(widgets->progress_bar), 1.0);
-    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(widgets->progress_bar), "100%");
-    gtk_widget_hide(widgets->ticker);
-    gtk_widget_show(widgets->card);
+static gboolean on_window_delete(GtkWidget *widget, GdkEvent *event, gpointer user_data) {
+    WebKitWebView *webview = tabs_get_current_view(browser.tabs);
+    if (webview) remember_url(webkit_web_view_get_uri(webview));
     
-    gtk_widget_hide(widgets->cancel_button);
-    gtk_widget_show(widgets->dismiss_button);
+    if (config.run_in_background) {
+        hide_browser();
+        return TRUE;
+    }
+    return FALSE; // Propagate event to destroy window
 }
 
-static void on_download_progress(WebKitDownload *download, GParamSpec *pspec, DownloadWidgets *widgets) {
-    double progress = webkit_download_get_estimated_progress(download);
-    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(widgets->progress_bar), progress);
-    char *progress_text = g_strdup_printf("%.0f%%", progress * 100);
-    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(widgets->progress_bar), progress_text);
-    g_free(progress_text);
+static void on_background_changed(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
+    GVariant *state = g_action_get_state(G_ACTION(action));
+    gboolean enabled = !g_variant_get_boolean(state);
+    g_variant_unref(state);
 
-    guint64 current_bytes = webkit_download_get_received_data_length(download);
-    guint64 total_bytes = 0; // WebKitDownload doesn't expose total size directly in 4.1 easily via getter, but response does.
-    WebKitURIResponse *response = webkit_download_get_response(download);
-    if (response) total_bytes = webkit_uri_response_get_content_length(response);
+    g_simple_action_set_state(action, g_variant_new_boolean(enabled));
+    config.run_in_background = enabled;
+    save_config();
+}
 
-    guint64 now = g_get_monotonic_time();
-    if (now - widgets->last_update_time > 1000000) { // Update speed every second
-        double speed = (double)(current_bytes - widgets->last_bytes) / ((now - widgets->last_update_time) / 1000000.0);
-        char *speed_str = format_size((guint64)speed);
-        char *speed_label_text = g_strdup_printf("%s/s", speed_str);
-        gtk_label_set_text(GTK_LABEL(widgets->speed_label), speed_label_text);
-        g_free(speed_str);
-        g_free(speed_label_text);
+static void on_show(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
+    show_browser();
+}
 
-        if (speed > 0 && total_bytes > current_bytes) {
-            guint64 remaining = (total_bytes - current_bytes) / speed;
-            char *time_str = format_time(remaining);
-            gtk_label_set_text(GTK_LABEL(widgets->time_label), time_str);
-            g_free(time_str);
-        }
+static void on_open_link(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
+    // The link comes from the feed (and app.open-link can be activated over
+    // D-Bus), so never run a javascript: or open a local file from it
+    const char *url = g_variant_get_string(parameter, NULL);
+    if (!g_str_has_prefix(url, "https://") && !g_str_has_prefix(url, "http://")) return;
 
-        widgets->last_update_time = now;
-        widgets->last_bytes = current_bytes;
+    tabs_open(browser.tabs, url, TRUE);
+    show_browser();
+}
+
+static void on_quit(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
+    WebKitWebView *webview = tabs_get_current_view(browser.tabs);
+    if (webview && !browser_hidden) remember_url(webkit_web_view_get_uri(webview));
+    g_application_quit(g_application_get_default());
+}
+
+static void on_shutdown(GApplication *application, gpointer user_data) {
+    config_store_flush_all();
+}
+
+// SIGTERM and SIGINT quit like Ctrl+Q, so settings are flushed and the
+// trace is closed (bench/run.py stops the browser this way)
+static gboolean on_terminate_signal(gpointer user_data) {
+    g_application_quit(G_APPLICATION(user_data));
+    return G_SOURCE_CONTINUE;
+}
+
+// Startup is gated on real readiness signals (first commit or load failure)
+// instead of a fixed delay, with a hard upper bound so a slow network never
+// leaves the user staring at the splash. Each phase is timestamped relative
+// to process start; run with G_MESSAGES_DEBUG=all to see the breakdown.
+#define STARTUP_SPLASH_MAX_MS 4000
+
+typedef struct {
+    gint64 origin;
+    gint64 config_loaded;
+    gint64 context_created;
+    gint64 darkreader_loaded;
+    gint64 ui_built;
+    gint64 web_process_spawned;
+    gint64 first_commit;
+    gint64 first_paint;
+    GtkWidget *splash;
+    GtkWidget *main_window;
+    guint timeout_id;
+    gboolean revealed;
+} StartupState;
+
+static StartupState startup = {0};
+
+// --url, opened instead of the last visited page
+static char *start_url = NULL;
+
+static void startup_mark(gint64 *phase, const char *name) {
+    if (*phase) return;
+    *phase = g_get_monotonic_time();
+    g_debug("startup: %-22s %8.1f ms", name, (*phase - startup.origin) / 1000.0);
+    trace_instant(NULL, "startup", name, NULL);
+}
+
+static void on_first_paint(GdkFrameClock *clock, gpointer user_data) {
+    g_signal_handlers_disconnect_by_func(clock, on_first_paint, user_data);
+    startup_mark(&startup.first_paint, "first paint");
+}
+
+static gboolean on_first_frame(GtkWidget *widget, GdkFrameClock *clock, gpointer user_data) {
+    g_signal_connect(clock, "after-paint", G_CALLBACK(on_first_paint), NULL);
+    return G_SOURCE_REMOVE;
+}
+
+static void startup_reveal_main(const char *reason) {
+    if (startup.revealed) return;
+    startup.revealed = TRUE;
+
+    if (startup.timeout_id) {
+        g_source_remove(startup.timeout_id);
+        startup.timeout_id = 0;
     }
-    
-    // Update ticker text
-    char *ticker_text = g_strdup_printf("Downloading... %.0f%%", progress * 100);
-    gtk_button_set_label(GTK_BUTTON(widgets->ticker_button), ticker_text);
-    g_free(ticker_text);
+
+    g_debug("startup: revealing main window (%s)", reason);
+    gtk_widget_destroy(startup.splash);
+    startup.splash = NULL;
+    gtk_widget_show_all(startup.main_window);
+    gtk_widget_add_tick_callback(startup.main_window, on_first_frame, NULL, NULL);
+}
+
+static gboolean on_splash_timeout(gpointer user_data) {
+    startup.timeout_id = 0;
+    startup_reveal_main("timeout");
+    return G_SOURCE_REMOVE;
 }
+
+static void on_web_process_spawned(WebKitWebContext *context, gpointer user_data) {
+    startup_mark(&startup.web_process_spawned, "web process spawned");
+}
+
+static Recovery *recovery = NULL;
+
+#define PROFILE_DATA_KEY "leaf-profile"
+
+// Offline snapshots, dark mode, learned hosts and the storage quota belong
+// to the view's profile
+static Profile *view_profile(WebKitWebView *webview) {
+    return g_object_get_data(G_OBJECT(webview), PROFILE_DATA_KEY);
+}
+
 static gboolean on_load_failed(WebKitWebView *webview, WebKitLoadEvent load_event, char *failing_uri, GError *error, gpointer user_data) {
+    trace_instant(webview, "navigation", "failed", "url", failing_uri, "error", error->message, NULL);
+
+    // Superseded by another navigation, nothing to report
+    if (g_error_matches(error, WEBKIT_NETWORK_ERROR, WEBKIT_NETWORK_ERROR_CANCELLED)) return FALSE;
+
+    if (error->domain == WEBKIT_NETWORK_ERROR) {
+        // Serve the last snapshot of the page if there is one
+        char *snapshot = offline_cache_lookup(view_profile(webview)->offline_cache, failing_uri);
+        if (snapshot) {
+            g_debug("offline: serving snapshot of %s", failing_uri);
+            webkit_web_view_load_uri(webview, snapshot);
+            g_free(snapshot);
+            startup_reveal_main("load failed");
+            return TRUE;
+        }
+    }
+
     if (error->domain == WEBKIT_NETWORK_ERROR || error->domain == WEBKIT_POLICY_ERROR) {
         // Simple offline/error page
         const char *html = 
             "<html><body style='background-color:#242424; color:white; font-family:sans-serif; text-align:center; padding-top:50px;'>"
+            "<img src='leaf://resources/icons/leaf-class.png' width='96' height='96'>"
             "<h1>🍂 Leaf Class 🍂</h1>"
             "<h2>Unable to load page</h2>"
             "<p>Please check your internet connection.</p>"
             "<button onclick='location.reload()' style='padding:10px 20px; cursor:pointer; background:#4CAF50; border:none; color:white; font-size:16px; border-radius:4px;'>Try Again</button>"
             "</body></html>";
         webkit_web_view_load_html(webview, html, failing_uri);
+        startup_reveal_main("load failed");
         return TRUE;
     }
     return FALSE;
 }
 
+// Navigation Timing of the main frame, relative to its timeOrigin, plus
+// performance.now() to line it up with the monotonic clock
+#define NAVIGATION_TIMING_SCRIPT \
+    "(() => {" \
+    "  const n = performance.getEntriesByType('navigation')[0];" \
+    "  if (!n) return null;" \
+    "  const t = n.toJSON();" \
+    "  t.now = performance.now();" \
+    "  const dr = window.__leafDarkReaderTiming;" \
+    "  t.darkReaderStart = dr ? dr.start : -1;" \
+    "  t.darkReaderDuration = dr ? dr.duration : -1;" \
+    "  return t;" \
+    "})()"
+
+static double timing_get(JSCValue *timing, const char *name) {
+    JSCValue *value = jsc_value_object_get_property(timing, name);
+    double ms = jsc_value_is_number(value) ? jsc_value_to_double(value) : -1;
+    g_object_unref(value);
+    return ms;
+}
+
+static void trace_timing_span(WebKitWebView *webview, JSCValue *timing, gint64 origin,
+                              const char *name, const char *start_name, const char *end_name) {
+    double start = timing_get(timing, start_name);
+    double end = timing_get(timing, end_name);
+    if (start <= 0 || end < start) return;
+
+    trace_complete(webview, "page", name, origin + (gint64)(start * 1000), origin + (gint64)(end * 1000), NULL);
+}
+
+static void on_navigation_timing(GObject *source, GAsyncResult *result, gpointer user_data) {
+    WebKitWebView *webview = WEBKIT_WEB_VIEW(source);
+    JSCValue *timing = webkit_web_view_evaluate_javascript_finish(webview, result, NULL);
+    if (!timing) return;
+
+    if (jsc_value_is_object(timing)) {
+        // Ignores the IPC delay, which is small next to the spans themselves
+        gint64 origin = g_get_monotonic_time() - (gint64)(timing_get(timing, "now") * 1000);
+
+        trace_timing_span(webview, timing, origin, "redirect", "redirectStart", "redirectEnd");
+        trace_timing_span(webview, timing, origin, "dns", "domainLookupStart", "domainLookupEnd");
+        trace_timing_span(webview, timing, origin, "connect", "connectStart", "connectEnd");
+        trace_timing_span(webview, timing, origin, "tls", "secureConnectionStart", "connectEnd");
+        trace_timing_span(webview, timing, origin, "request", "requestStart", "responseStart");
+        trace_timing_span(webview, timing, origin, "response", "responseStart", "responseEnd");
+        trace_timing_span(webview, timing, origin, "dom-interactive", "responseEnd", "domInteractive");
+        trace_timing_span(webview, timing, origin, "DOMContentLoaded", "domContentLoadedEventStart", "domContentLoadedEventEnd");
+        trace_timing_span(webview, timing, origin, "load-event", "loadEventStart", "loadEventEnd");
+
+        double dark_start = timing_get(timing, "darkReaderStart");
+        double dark_duration = timing_get(timing, "darkReaderDuration");
+        if (dark_start >= 0 && dark_duration >= 0) {
+            gint64 start = origin + (gint64)(dark_start * 1000);
+            trace_complete(webview, "page", "DarkReader.enable", start, start + (gint64)(dark_duration * 1000), NULL);
+        }
+    }
+
+    g_object_unref(timing);
+}
+
 static void on_load_changed(WebKitWebView *webview, WebKitLoadEvent load_event, gpointer user_data) {
-    // user_data is now a struct or array containing url_entry and spinner
-    GtkWidget **widgets = (GtkWidget **)user_data;
-    GtkEntry *url_entry = GTK_ENTRY(widgets[0]);
-    GtkSpinner *spinner = GTK_SPINNER(widgets[1]);
+    // The entry and spinner only follow the focused tab
+    gboolean current = webview == tabs_get_current_view(browser.tabs);
+    GtkEntry *url_entry = GTK_ENTRY(browser.url_entry);
+    GtkSpinner *spinner = GTK_SPINNER(browser.spinner);
+    const char *uri = webkit_web_view_get_uri(webview);
     
     if (load_event == WEBKIT_LOAD_STARTED) {
-        gtk_spinner_start(spinner);
+        trace_begin(webview, "navigation", "load", "url", uri, NULL);
+        if (current) gtk_spinner_start(spinner);
+    } else if (load_event == WEBKIT_LOAD_REDIRECTED) {
+        trace_instant(webview, "navigation", "redirected", "url", uri, NULL);
     } else if (load_event == WEBKIT_LOAD_COMMITTED) {
-        const char *uri = webkit_web_view_get_uri(webview);
-        if (uri) {
+        trace_instant(webview, "navigation", "committed", "url", uri, NULL);
+        if (uri && current) {
             gtk_entry_set_text(url_entry, uri);
+            remember_url(uri);
         }
+        storage_note_uri(view_profile(webview)->storage, uri);
+        startup_mark(&startup.first_commit, "first commit");
+        startup_reveal_main("first commit");
     } else if (load_event == WEBKIT_LOAD_FINISHED) {
-        gtk_spinner_stop(spinner);
-        if (g_strcmp0(config.theme, "dark") == 0) {
-            enable_dark_mode(webview);
+        trace_end(webview, "navigation", "load", "url", uri, NULL);
+        if (current) gtk_spinner_stop(spinner);
+        dark_mode_page_loaded(view_profile(webview)->dark_mode, webview);
+        offline_cache_page_changed(view_profile(webview)->offline_cache, webview);
+        search_index_page_changed(view_profile(webview)->search, webview);
+
+        if (trace_is_enabled()) {
+            webkit_web_view_evaluate_javascript(webview, NAVIGATION_TIMING_SCRIPT, -1, NULL, NULL, NULL,
+                                                on_navigation_timing, NULL);
         }
     }
 }
 
+// Classroom navigates inside the page, so snapshot and index on URI changes too
+static void on_uri_changed(WebKitWebView *webview, GParamSpec *pspec, gpointer user_data) {
+    if (webkit_web_view_is_loading(webview)) return;
+
+    Profile *account = view_profile(webview);
+    offline_cache_page_changed(account->offline_cache, webview);
+    search_index_page_changed(account->search, webview);
+}
+
+static void on_tab_switched(WebKitWebView *webview, gpointer user_data) {
+    if (user_data != browser.profile) return;
+
+    const char *uri = webkit_web_view_get_uri(webview);
+    gtk_entry_set_text(GTK_ENTRY(browser.url_entry), uri ? uri : "");
+    remember_url(uri);
+
+    if (webkit_web_view_is_loading(webview)) {
+        gtk_spinner_start(GTK_SPINNER(browser.spinner));
+    } else {
+        gtk_spinner_stop(GTK_SPINNER(browser.spinner));
+    }
+}
+
 static gboolean on_web_view_close(WebKitWebView *webview, gpointer user_data) {
-    // Prevent JavaScript from closing the window (e.g. window.close())
-    // This is important for auth flows that try to close the popup
+    // Prevent JavaScript from closing a tab (e.g. window.close());
+    // popups close themselves through on_popup_close()
     return TRUE; 
 }
 
-static GtkWidget *on_web_view_create(WebKitWebView *webview, WebKitNavigationAction *navigation_action, gpointer user_data) {
-    WebKitURIRequest *request = webkit_navigation_action_get_request(navigation_action);
-    const char *uri = webkit_uri_request_get_uri(request);
-    
-    if (uri) {
-        webkit_web_view_load_uri(webview, uri);
+// Popups (sign-in, Drive pickers, window.open) get a related view in a
+// small transient window. It shares the opener's web process, so the
+// window.opener handshake works and the page underneath is left untouched.
+#define POPUP_DEFAULT_WIDTH 520
+#define POPUP_DEFAULT_HEIGHT 640
+
+static GtkWidget *on_web_view_create(WebKitWebView *webview, WebKitNavigationAction *navigation_action, gpointer user_data);
+
+static void on_popup_title_changed(WebKitWebView *popup, GParamSpec *pspec, gpointer user_data) {
+    const char *title = webkit_web_view_get_title(popup);
+    gtk_window_set_title(GTK_WINDOW(user_data), title && *title ? title : "Leaf Class");
+}
+
+static void on_popup_ready_to_show(WebKitWebView *popup, gpointer user_data) {
+    GtkWindow *window = GTK_WINDOW(user_data);
+    WebKitWindowProperties *properties = webkit_web_view_get_window_properties(popup);
+    GdkRectangle geometry;
+
+    webkit_window_properties_get_geometry(properties, &geometry);
+    if (geometry.width > 0 && geometry.height > 0) {
+        gtk_window_set_default_size(window, geometry.width, geometry.height);
     }
-    
-    return NULL; // Prevent new window creation
+    gtk_widget_show_all(GTK_WIDGET(window));
 }
 
-static gboolean on_download_decide_destination(WebKitDownload *download, gchar *suggested_filename, DownloadWidgets *widgets) {
-    GtkFileChooserNative *native;
-    GtkFileChooserAction action = GTK_FILE_CHOOSER_ACTION_SAVE;
-    gint res;
+static void on_popup_close(WebKitWebView *popup, gpointer user_data) {
+    gtk_widget_destroy(GTK_WIDGET(user_data));
+}
 
-    native = gtk_file_chooser_native_new("Save File",
-                                         GTK_WINDOW(gtk_widget_get_toplevel(widgets->overlay)),
-                                         action,
-                                         "_Save",
-                                         "_Cancel");
+static GtkWidget *on_web_view_create(WebKitWebView *webview, WebKitNavigationAction *navigation_action, gpointer user_data) {
+    GtkWindow *parent = GTK_WINDOW(user_data);
+    // The related view shares the opener's context and content manager
+    GtkWidget *popup = webkit_web_view_new_with_related_view(webview);
+    g_object_set_data(G_OBJECT(popup), PROFILE_DATA_KEY, view_profile(webview));
 
-    if (suggested_filename) {
-        gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(native), suggested_filename);
-    } else {
-        gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(native), "download");
-    }
+    GtkWidget *window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+    gtk_window_set_transient_for(GTK_WINDOW(window), parent);
+    gtk_window_set_destroy_with_parent(GTK_WINDOW(window), TRUE);
+    gtk_window_set_default_size(GTK_WINDOW(window), POPUP_DEFAULT_WIDTH, POPUP_DEFAULT_HEIGHT);
+    gtk_window_set_title(GTK_WINDOW(window), "Leaf Class");
+    gtk_container_add(GTK_CONTAINER(window), popup);
+
+    set_view_background(popup, NULL);
+    set_view_zoom(popup, NULL);
+    warmup_watch_view(view_profile(webview)->warmup, popup);
+    recovery_watch_view(recovery, popup);
+    g_signal_connect(popup, "load-changed", G_CALLBACK(on_load_changed), NULL);
+    g_signal_connect(popup, "load-failed", G_CALLBACK(on_load_failed), NULL);
+    g_signal_connect(popup, "notify::title", G_CALLBACK(on_popup_title_changed), window);
+    g_signal_connect(popup, "ready-to-show", G_CALLBACK(on_popup_ready_to_show), window);
+    g_signal_connect(popup, "close", G_CALLBACK(on_popup_close), window);
+    g_signal_connect(popup, "create", G_CALLBACK(on_web_view_create), window);
+
+    // WebKit loads the request into the returned view
+    return popup;
+}
 
-    res = gtk_native_dialog_run(GTK_NATIVE_DIALOG(native));
-    if (res == GTK_RESPONSE_ACCEPT) {
-        char *filename = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(native));
-        char *uri = g_filename_to_uri(filename, NULL, NULL);
-        webkit_download_set_destination(download, uri);
-        g_free(filename);
-        g_free(uri);
-        
-        // Update UI
-        gtk_label_set_text(GTK_LABEL(widgets->filename_label), suggested_filename ? suggested_filename : "download");
-        gtk_label_set_text(GTK_LABEL(widgets->status_label), "Downloading...");
-        
-        gtk_widget_show(widgets->cancel_button);
-        gtk_widget_hide(widgets->dismiss_button);
-        
-        gtk_widget_show(widgets->card);
-        
-        widgets->start_time = g_get_monotonic_time();
-        widgets->last_update_time = widgets->start_time;
-        widgets->last_bytes = 0;
-        
-        g_object_unref(native);
-        return TRUE; // Handled
+static gboolean on_decide_policy(WebKitWebView *webview, WebKitPolicyDecision *decision, WebKitPolicyDecisionType type, gpointer user_data) {
+    if (type != WEBKIT_POLICY_DECISION_TYPE_NEW_WINDOW_ACTION) return FALSE;
+
+    // Middle or Ctrl+click on a link opens it in a background tab
+    WebKitNavigationAction *action = webkit_navigation_policy_decision_get_navigation_action(WEBKIT_NAVIGATION_POLICY_DECISION(decision));
+    if (webkit_navigation_action_get_mouse_button(action) != 2 &&
+        !(webkit_navigation_action_get_modifiers(action) & GDK_CONTROL_MASK)) {
+        return FALSE;
     }
 
-    g_object_unref(native);
-    webkit_download_cancel(download);
-    return TRUE; // Handled (cancelled)
+    const char *uri = webkit_uri_request_get_uri(webkit_navigation_action_get_request(action));
+    tabs_open(browser.tabs, uri, FALSE);
+    webkit_policy_decision_ignore(decision);
+    return TRUE;
 }
 
-static void on_download_started(WebKitWebContext *context, WebKitDownload *download, DownloadWidgets *widgets) {
-    widgets->current_download = download;
-    g_signal_connect(download, "decide-destination", G_CALLBACK(on_download_decide_destination), widgets);
-    g_signal_connect(download, "notify::estimated-progress", G_CALLBACK(on_download_progress), widgets);
-    g_signal_connect(download, "failed", G_CALLBACK(on_download_failed), widgets);
-    g_signal_connect(download, "finished", G_CALLBACK(on_download_finished), widgets);
+static WebKitWebView *create_tab_view(gpointer user_data) {
+    Profile *account = user_data;
+    WebKitWebView *webview = g_object_new(WEBKIT_TYPE_WEB_VIEW,
+        "web-context", account->context,
+        "user-content-manager", account->content_manager,
+        "settings", browser.settings,
+        NULL);
+    g_object_set_data(G_OBJECT(webview), PROFILE_DATA_KEY, account);
+
+    set_view_background(webview, NULL);
+    set_view_zoom(webview, NULL);
+    warmup_watch_view(account->warmup, webview);
+    recovery_watch_view(recovery, webview);
+
+    g_signal_connect(webview, "load-changed", G_CALLBACK(on_load_changed), NULL);
+    g_signal_connect(webview, "load-failed", G_CALLBACK(on_load_failed), NULL);
+    g_signal_connect(webview, "decide-policy", G_CALLBACK(on_decide_policy), NULL);
+    g_signal_connect(webview, "notify::uri", G_CALLBACK(on_uri_changed), NULL);
+    
+    // Handle popups and closing
+    g_signal_connect(webview, "create", G_CALLBACK(on_web_view_create), browser.window);
+    g_signal_connect(webview, "close", G_CALLBACK(on_web_view_close), browser.window);
+
+    return webview;
 }
 
 static void on_reload(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
-    webkit_web_view_reload(WEBKIT_WEB_VIEW(user_data));
+    WebKitWebView *webview = tabs_get_current_view(browser.tabs);
+    if (webview) webkit_web_view_reload(webview);
 }
 
-static void on_focus_url(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
-    gtk_widget_grab_focus(GTK_WIDGET(user_data));
+static void on_new_tab(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
+    tabs_open(browser.tabs, HOME_URL, TRUE);
+}
+
+static void on_close_tab(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
+    tabs_close_current(browser.tabs);
+}
+
+static void on_next_tab(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
+    tabs_focus_next(browser.tabs);
+}
+
+static void on_search(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
+    search_index_show(browser.profile->search);
+}
+
+static void on_search_open(const char *url, gpointer user_data) {
+    // The index only holds web pages; never run a javascript: or open a
+    // local file from a result
+    if (!g_str_has_prefix(url, "https://") && !g_str_has_prefix(url, "http://")) return;
+
+    WebKitWebView *webview = tabs_get_current_view(browser.tabs);
+    if (webview) {
+        webkit_web_view_load_uri(webview, url);
+    } else {
+        tabs_open(browser.tabs, url, TRUE);
+    }
 }
 
 static void create_modal_window(GtkWindow *parent, const char *title, GtkWidget *content) {
@@ -422,7 +983,13 @@ static void on_show_shortcuts(GSimpleAction *action, GVariant *parameter, gpoint
     
     const char *shortcuts[] = {
         "Ctrl+R: Reload Page",
-        "Ctrl+L: Focus URL Bar",
+        "Ctrl+L: Search Visited Pages",
+        "Ctrl+T: New Tab",
+        "Ctrl+W: Close Tab",
+        "Ctrl+Q: Quit",
+        "Ctrl+Tab: Next Tab",
+        "Ctrl++ / Ctrl+-: Zoom In / Out",
+        "Ctrl+0: Reset Zoom",
         "Alt+Left: Go Back",
         "Alt+Right: Go Forward",
         NULL
@@ -437,6 +1004,10 @@ static void on_show_shortcuts(GSimpleAction *action, GVariant *parameter, gpoint
     create_modal_window(parent, "Keyboard Shortcuts", box);
 }
 
+static void on_show_storage(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
+    create_modal_window(GTK_WINDOW(user_data), "Storage", storage_diagnostics_new(browser.profile->storage));
+}
+
 static void on_show_about(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
     GtkWindow *parent = GTK_WINDOW(user_data);
     GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 10);
@@ -463,8 +1034,226 @@ static void on_show_about(GSimpleAction *action, GVariant *parameter, gpointer u
     create_modal_window(parent, "About", box);
 }
 
-static void activate(GtkApplication *app, gpointer user_data) {
+static void serve_resource(WebKitURISchemeRequest *request, const char *path) {
+    char *resource_path = g_strconcat(LEAF_CLASS_RESOURCE_PREFIX, path, NULL);
+    GError *error = NULL;
+
+    // Resources live in the mapped binary, so the stream reads them in place
+    GBytes *bytes = g_resources_lookup_data(resource_path, G_RESOURCE_LOOKUP_FLAGS_NONE, &error);
+    if (bytes) {
+        gsize size = g_bytes_get_size(bytes);
+        char *content_type = g_content_type_guess(path, g_bytes_get_data(bytes, NULL), size, NULL);
+        char *mime_type = g_content_type_get_mime_type(content_type);
+        GInputStream *stream = g_memory_input_stream_new_from_bytes(bytes);
+
+        webkit_uri_scheme_request_finish(request, stream, size, mime_type);
+
+        g_object_unref(stream);
+        g_free(mime_type);
+        g_free(content_type);
+        g_bytes_unref(bytes);
+    } else {
+        webkit_uri_scheme_request_finish_error(request, error);
+        g_error_free(error);
+    }
+
+    g_free(resource_path);
+}
+
+static void on_leaf_scheme_request(WebKitURISchemeRequest *request, gpointer user_data) {
+    Profile *account = user_data;
+    GUri *uri = g_uri_parse(webkit_uri_scheme_request_get_uri(request), G_URI_FLAGS_ENCODED_QUERY, NULL);
+    const char *host = uri ? g_uri_get_host(uri) : NULL;
+
+    if (g_strcmp0(host, "fetch") == 0) {
+        const char *query = g_uri_get_query(uri);
+        GHashTable *params = g_uri_parse_params(query ? query : "", -1, "&", G_URI_PARAMS_NONE, NULL);
+        fetch_cache_handle_request(account->fetch_cache, request, params ? g_hash_table_lookup(params, "url") : NULL);
+        if (params) g_hash_table_unref(params);
+    } else {
+        serve_resource(request, webkit_uri_scheme_request_get_path(request));
+    }
+
+    if (uri) g_uri_unref(uri);
+}
+
+// --- Profiles ---
+
+// Everything kept apart per profile besides cookies and website data:
+// Classroom URLs are the same for every account, so snapshots, the search
+// index, cached fetches, stored downloads and dark sheets generated from
+// signed-in pages must not be shared. Created on first wake and kept for
+// the session, so a profile woken again picks up where it left off.
+static void create_profile_data(Profile *account) {
+    if (account->manager) return;
+
+    account->manager = webkit_website_data_manager_new(
+        "base-data-directory", account->data_dir,
+        "base-cache-directory", account->cache_dir,
+        NULL);
+    account->content_manager = webkit_user_content_manager_new();
+    account->dark_mode = dark_mode_new(account->content_manager, darkreader, account->cache_dir);
+    dark_mode_set_static(account->dark_mode, config.static_dark);
+    dark_mode_set_enabled(account->dark_mode, g_strcmp0(config.theme, "dark") == 0);
+    recovery_add_content_manager(recovery, account->content_manager);
+
+    account->fetch_cache = fetch_cache_new(account->cache_dir, FETCH_CACHE_MAX_BYTES);
+    if (config.download_store_mb > 0) {
+        char *download_store_dir = g_build_filename(account->cache_dir, "downloads", NULL);
+        account->download_store = download_store_new(download_store_dir, (guint64)config.download_store_mb * 1024 * 1024);
+        g_free(download_store_dir);
+    }
+
+    account->offline_cache = offline_cache_new(account->data_dir, (guint64)MAX(config.offline_max_mb, 0) * 1024 * 1024);
+    account->search = search_index_new(account->data_dir);
+    if (browser.url_entry) search_index_attach(account->search, browser.url_entry, on_search_open, NULL);
+    account->storage = storage_new(account->manager, account->data_dir, account->cache_dir,
+                                   (guint64)MAX(config.storage_quota_mb, 0) * 1024 * 1024);
+}
+
+static WebKitWebContext *create_profile_context(Profile *account) {
+    const ResourceProfile *profile = resource_profile_lookup(config.resource_profile);
+    WebKitWebContext *context = resource_profile_create_context(profile, account->manager);
+    g_signal_connect(context, "initialize-web-extensions", G_CALLBACK(on_web_process_spawned), NULL);
+
+    webkit_web_context_register_uri_scheme(context, LEAF_CLASS_URI_SCHEME, on_leaf_scheme_request, account, NULL);
+    WebKitSecurityManager *security_manager = webkit_web_context_get_security_manager(context);
+    webkit_security_manager_register_uri_scheme_as_secure(security_manager, LEAF_CLASS_URI_SCHEME);
+    webkit_security_manager_register_uri_scheme_as_cors_enabled(security_manager, LEAF_CLASS_URI_SCHEME);
+
+    // Cookie manager configuration
+    WebKitCookieManager *cookie_manager = webkit_web_context_get_cookie_manager(context);
+    char *cookie_file = g_build_filename(account->data_dir, "cookies.sqlite", NULL);
+    webkit_cookie_manager_set_persistent_storage(cookie_manager, cookie_file, WEBKIT_COOKIE_PERSISTENT_STORAGE_SQLITE);
+    webkit_cookie_manager_set_accept_policy(cookie_manager, WEBKIT_COOKIE_POLICY_ACCEPT_ALWAYS);
+    downloads_add_context(browser.downloads, context, cookie_file, account->download_store);
+    g_free(cookie_file);
+
+    resource_profile_apply(profile, context, browser.settings);
+    return context;
+}
+
+static void wake_profile(Profile *account, gpointer user_data) {
+    create_profile_data(account);
+    account->context = create_profile_context(account);
+
+    // Resolve the hosts the first load will need while the UI is built
+    if (!account->warmup) {
+        account->warmup = warmup_new(account->context, account->data_dir, (const char *const *)config.prefetch_hosts);
+    }
+    account->tabs = tabs_new((guint)MAX(config.hibernate_minutes, 0) * 60, create_tab_view, on_tab_switched, account);
+
+    gtk_widget_show_all(tabs_get_bar(account->tabs));
+    gtk_widget_show(tabs_get_stack(account->tabs));
+    gtk_container_add(GTK_CONTAINER(browser.tab_bars), tabs_get_bar(account->tabs));
+    gtk_container_add(GTK_CONTAINER(browser.pages), tabs_get_stack(account->tabs));
+}
+
+static void release_profile(Profile *account, gpointer user_data) {
+    tabs_free(account->tabs);
+    account->tabs = NULL;
+    downloads_remove_context(browser.downloads, account->context);
+    g_clear_object(&account->context);
+}
+
+static void show_profile(Profile *account) {
+    browser.profile = account;
+    browser.context = account->context;
+    browser.tabs = account->tabs;
+    gtk_stack_set_visible_child(GTK_STACK(browser.tab_bars), tabs_get_bar(account->tabs));
+    gtk_stack_set_visible_child(GTK_STACK(browser.pages), tabs_get_stack(account->tabs));
+
+    gtk_label_set_text(GTK_LABEL(browser.profile_label), account->name);
+    gtk_widget_set_visible(browser.profile_label, profiles_get_all(browser.profiles)->len > 1);
+}
+
+// The profile left behind keeps its context with its tabs suspended, so
+// coming back to it is one page load
+static void switch_profile(Profile *account) {
+    Profile *previous = browser.profile;
+    if (account == previous) return;
+
+    WebKitWebView *webview = tabs_get_current_view(previous->tabs);
+    if (webview) remember_url(webkit_web_view_get_uri(webview));
+    tabs_suspend(previous->tabs);
+
+    gboolean cold = account->context == NULL;
+    profiles_switch(browser.profiles, account);
+    show_profile(account);
+
+    if (cold) {
+        tabs_open(account->tabs, account->last_url ? account->last_url : HOME_URL, TRUE);
+    } else {
+        tabs_resume(account->tabs);
+    }
+}
+
+static void on_profile_changed(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
+    Profile *account = profiles_find(browser.profiles, g_variant_get_string(parameter, NULL));
+    if (!account) return;
+
+    g_simple_action_set_state(action, g_variant_new_string(account->name));
+    switch_profile(account);
+}
+
+static void append_profile_item(Profile *account) {
+    GMenuItem *item = g_menu_item_new(account->name, NULL);
+    g_menu_item_set_action_and_target_value(item, "app.profile", g_variant_new_string(account->name));
+    g_menu_append_item(browser.profiles_menu, item);
+    g_object_unref(item);
+}
+
+static void on_new_profile_response(GtkDialog *dialog, gint response, gpointer user_data) {
+    GtkEntry *entry = GTK_ENTRY(user_data);
+
+    if (response == GTK_RESPONSE_ACCEPT) {
+        char *name = g_strstrip(g_strdup(gtk_entry_get_text(entry)));
+        Profile *account = profiles_add(browser.profiles, name);
+        g_free(name);
+
+        if (!account) {
+            gtk_entry_set_icon_from_icon_name(entry, GTK_ENTRY_ICON_SECONDARY, "dialog-error-symbolic");
+            gtk_entry_set_icon_tooltip_text(entry, GTK_ENTRY_ICON_SECONDARY,
+                                            "Use a new name of letters, digits, spaces, - and _");
+            return;
+        }
+
+        append_profile_item(account);
+        g_action_group_activate_action(G_ACTION_GROUP(g_application_get_default()), "profile",
+                                       g_variant_new_string(account->name));
+    }
+    gtk_widget_destroy(GTK_WIDGET(dialog));
+}
+
+static void on_new_profile(GSimpleAction *action, GVariant *parameter, gpointer user_data) {
+    GtkWidget *dialog = gtk_dialog_new_with_buttons("New Profile", GTK_WINDOW(user_data),
+                                                    GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT | GTK_DIALOG_USE_HEADER_BAR,
+                                                    "_Cancel", GTK_RESPONSE_CANCEL,
+                                                    "_Create", GTK_RESPONSE_ACCEPT,
+                                                    NULL);
+    gtk_dialog_set_default_response(GTK_DIALOG(dialog), GTK_RESPONSE_ACCEPT);
+
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 10);
+    g_object_set(box, "margin", 20, NULL);
+    GtkWidget *hint = gtk_label_new("A profile has its own sign-ins, cookies and cache, e.g. for a second Google account.");
+    gtk_label_set_line_wrap(GTK_LABEL(hint), TRUE);
+    gtk_label_set_max_width_chars(GTK_LABEL(hint), 40);
+    gtk_label_set_xalign(GTK_LABEL(hint), 0);
+    gtk_box_pack_start(GTK_BOX(box), hint, FALSE, FALSE, 0);
+
+    GtkWidget *entry = gtk_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(entry), "Name, e.g. Personal");
+    gtk_entry_set_activates_default(GTK_ENTRY(entry), TRUE);
+    gtk_box_pack_start(GTK_BOX(box), entry, FALSE, FALSE, 0);
+    gtk_container_add(GTK_CONTAINER(gtk_dialog_get_content_area(GTK_DIALOG(dialog))), box);
+
+    g_signal_connect(dialog, "response", G_CALLBACK(on_new_profile_response), entry);
+    gtk_widget_show_all(dialog);
+}
+
+static void build_browser(GtkApplication *app) {
     load_config();
+    startup_mark(&startup.config_loaded, "config load");
 
     // --- Splash Screen ---
     GtkWidget *splash = gtk_window_new(GTK_WINDOW_TOPLEVEL);
@@ -482,13 +1271,19 @@ static void activate(GtkApplication *app, gpointer user_data) {
     gtk_widget_set_halign(splash_label, GTK_ALIGN_CENTER);
     gtk_box_pack_start(GTK_BOX(splash_box), splash_label, TRUE, TRUE, 0);
     
+    GdkPixbuf *icon = gdk_pixbuf_new_from_resource(LEAF_CLASS_RESOURCE_PREFIX "/icons/leaf-class.png", NULL);
+    if (icon) {
+        gtk_window_set_default_icon(icon);
+        g_object_unref(icon);
+    }
+    
     gtk_widget_show_all(splash);
     // ---------------------
 
     GtkWidget *window;
-    GtkWidget *webview;
 
     window = gtk_application_window_new(app);
+    browser.window = window;
     gtk_window_set_title(GTK_WINDOW(window), "🍂 Leaf Class 🍂");
     gtk_window_set_default_size(GTK_WINDOW(window), config.width, config.height);
 
@@ -499,51 +1294,33 @@ static void activate(GtkApplication *app, gpointer user_data) {
     g_mkdir_with_parents(data_dir, 0700);
     g_mkdir_with_parents(cache_dir, 0700);
 
-    WebKitWebsiteDataManager *manager = webkit_website_data_manager_new(
-        "base-data-directory", data_dir,
-        "base-cache-directory", cache_dir,
-        NULL);
+    const ResourceProfile *profile = resource_profile_lookup(config.resource_profile);
+    resource_profile_apply_network(profile);
 
-    WebKitWebContext *context = webkit_web_context_new_with_website_data_manager(manager);
-    
-    // Inject DarkReader
-    #define LEAF_CLASS_DATA_DIR "/usr/share/leaf-class"
-
-    char *darkreader_path = g_build_filename(LEAF_CLASS_DATA_DIR, "darkreader.js", NULL);
-    char *darkreader_content = NULL;
-    if (g_file_get_contents(darkreader_path, &darkreader_content, NULL, NULL)) {
-        WebKitUserContentManager *content_manager = webkit_user_content_manager_new();
-        WebKitUserScript *script = webkit_user_script_new(
-            darkreader_content, 
-            WEBKIT_USER_CONTENT_INJECT_TOP_FRAME, 
-            WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_END, 
-            NULL, NULL);
-        webkit_user_content_manager_add_script(content_manager, script);
-        webkit_user_script_unref(script);
-        g_free(darkreader_content);
-        
-        webview = g_object_new(WEBKIT_TYPE_WEB_VIEW,
-            "web-context", context,
-            "user-content-manager", content_manager,
-            NULL);
-            
-        g_object_unref(content_manager);
-    } else {
-        g_warning("Could not load darkreader.js from %s", darkreader_path);
-        webview = webkit_web_view_new_with_context(context);
-    }
-    g_free(darkreader_path);
-    
-    // Cookie manager configuration
-    WebKitCookieManager *cookie_manager = webkit_web_context_get_cookie_manager(context);
-    char *cookie_file = g_build_filename(data_dir, "cookies.sqlite", NULL);
-    webkit_cookie_manager_set_persistent_storage(cookie_manager, cookie_file, WEBKIT_COOKIE_PERSISTENT_STORAGE_SQLITE);
-    webkit_cookie_manager_set_accept_policy(cookie_manager, WEBKIT_COOKIE_POLICY_ACCEPT_ALWAYS);
-    g_free(cookie_file);
-    
-    WebKitSettings *settings = webkit_web_view_get_settings(WEBKIT_WEB_VIEW(webview));
+    WebKitSettings *settings = webkit_settings_new();
+    browser.settings = settings;
     webkit_settings_set_enable_developer_extras(settings, TRUE);
     webkit_settings_set_enable_smooth_scrolling(settings, TRUE);
+
+    // Only injected while the dark theme is active; see create_profile_data()
+    darkreader = g_resources_lookup_data(LEAF_CLASS_RESOURCE_PREFIX "/js/darkreader.js",
+                                         G_RESOURCE_LOOKUP_FLAGS_NONE, NULL);
+    recovery = recovery_new(on_web_process_terminated, NULL);
+    startup_mark(&startup.darkreader_loaded, "darkreader.js mapped");
+
+    // Each warm profile gets a context and a tab strip and page stack in
+    // these; see wake_profile()
+    browser.downloads = downloads_new(MAX(config.max_downloads, 1));
+    browser.tab_bars = gtk_stack_new();
+    gtk_stack_set_homogeneous(GTK_STACK(browser.tab_bars), FALSE);
+    browser.pages = gtk_stack_new();
+    browser.profiles = profiles_new(data_dir, cache_dir, wake_profile, release_profile, NULL);
+    Profile *current = profiles_get_current(browser.profiles);
+    profiles_switch(browser.profiles, current);
+    startup_mark(&startup.context_created, "context + data manager");
+
+    memory_monitor = memory_monitor_new(MEMORY_MONITOR_INTERVAL_SECONDS, on_memory_over_budget, NULL);
+    memory_monitor_set_budget(memory_monitor, memory_budget_bytes(profile));
     
     // Create Header Bar
     GtkWidget *header_bar = gtk_header_bar_new();
@@ -553,17 +1330,17 @@ static void activate(GtkApplication *app, gpointer user_data) {
 
     // Back Button
     GtkWidget *back_button = gtk_button_new_from_icon_name("go-previous-symbolic", GTK_ICON_SIZE_BUTTON);
-    g_signal_connect_swapped(back_button, "clicked", G_CALLBACK(webkit_web_view_go_back), webview);
+    g_signal_connect(back_button, "clicked", G_CALLBACK(go_back), NULL);
     gtk_header_bar_pack_start(GTK_HEADER_BAR(header_bar), back_button);
 
     // Forward Button
     GtkWidget *forward_button = gtk_button_new_from_icon_name("go-next-symbolic", GTK_ICON_SIZE_BUTTON);
-    g_signal_connect_swapped(forward_button, "clicked", G_CALLBACK(webkit_web_view_go_forward), webview);
+    g_signal_connect(forward_button, "clicked", G_CALLBACK(go_forward), NULL);
     gtk_header_bar_pack_start(GTK_HEADER_BAR(header_bar), forward_button);
 
     // Home Button
     GtkWidget *home_button = gtk_button_new_from_icon_name("go-home-symbolic", GTK_ICON_SIZE_BUTTON);
-    g_signal_connect(home_button, "clicked", G_CALLBACK(go_home), webview);
+    g_signal_connect(home_button, "clicked", G_CALLBACK(go_home), NULL);
     gtk_header_bar_pack_end(GTK_HEADER_BAR(header_bar), home_button);
 
     // URL Entry
@@ -576,62 +1353,164 @@ static void activate(GtkApplication *app, gpointer user_data) {
     GtkWidget *spinner = gtk_spinner_new();
     gtk_header_bar_pack_start(GTK_HEADER_BAR(header_bar), spinner);
 
-    // Connect load-changed to update entry, spinner and handle dark mode
-    // We need to pass both url_entry and spinner, so we use an array of widgets
-    // Note: This array must persist or be freed. Since it's main window, we can just malloc it and let it leak (OS cleans up) or attach it to the window.
-    // For simplicity in this C snippet, we'll use a static buffer or malloc.
-    GtkWidget **load_data = g_new(GtkWidget*, 2);
-    load_data[0] = url_entry;
-    load_data[1] = spinner;
-    
-    g_signal_connect_data(webview, "load-changed", G_CALLBACK(on_load_changed), load_data, (GClosureNotify)g_free, 0);
-    g_signal_connect(webview, "load-failed", G_CALLBACK(on_load_failed), NULL);
-    
-    // Handle popups and closing
-    g_signal_connect(webview, "create", G_CALLBACK(on_web_view_create), window);
-    g_signal_connect(webview, "close", G_CALLBACK(on_web_view_close), window);
+    browser.url_entry = url_entry;
+    browser.spinner = spinner;
+    search_index_attach(current->search, url_entry, on_search_open, NULL);
+
+    // Tabs, next to the navigation buttons; each tab's view is wired up in
+    // create_tab_view()
+    gtk_header_bar_pack_start(GTK_HEADER_BAR(header_bar), browser.tab_bars);
+
+    // Shows which profile is current once there is more than one
+    browser.profile_label = gtk_label_new(NULL);
+    gtk_style_context_add_class(gtk_widget_get_style_context(browser.profile_label), "dim-label");
+    gtk_widget_set_no_show_all(browser.profile_label, TRUE);
+    gtk_header_bar_pack_end(GTK_HEADER_BAR(header_bar), browser.profile_label);
+    show_profile(current);
+
+    // Start the first load now; the menus and the download overlay are
+    // built while the request is in flight
+    const char *last_url = current->last_url ? current->last_url : config.last_url;
+    tabs_open(browser.tabs, start_url ? start_url : last_url, TRUE);
 
     // Copy Button
     GtkWidget *copy_button = gtk_button_new_from_icon_name("edit-copy-symbolic", GTK_ICON_SIZE_BUTTON);
-    g_signal_connect(copy_button, "clicked", G_CALLBACK(copy_url), webview);
+    g_signal_connect(copy_button, "clicked", G_CALLBACK(copy_url), NULL);
     gtk_header_bar_pack_end(GTK_HEADER_BAR(header_bar), copy_button);
 
     // Actions and Accelerators
     GSimpleAction *act_reload = g_simple_action_new("reload", NULL);
-    g_signal_connect(act_reload, "activate", G_CALLBACK(on_reload), webview);
+    g_signal_connect(act_reload, "activate", G_CALLBACK(on_reload), NULL);
     g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_reload));
     const char *accels_reload[] = {"<Ctrl>r", "F5", NULL};
     gtk_application_set_accels_for_action(app, "app.reload", accels_reload);
 
-    GSimpleAction *act_focus_url = g_simple_action_new("focus-url", NULL);
-    g_signal_connect(act_focus_url, "activate", G_CALLBACK(on_focus_url), url_entry);
-    g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_focus_url));
-    const char *accels_focus[] = {"<Ctrl>l", NULL};
-    gtk_application_set_accels_for_action(app, "app.focus-url", accels_focus);
+    GSimpleAction *act_new_tab = g_simple_action_new("new-tab", NULL);
+    g_signal_connect(act_new_tab, "activate", G_CALLBACK(on_new_tab), NULL);
+    g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_new_tab));
+    const char *accels_new_tab[] = {"<Ctrl>t", NULL};
+    gtk_application_set_accels_for_action(app, "app.new-tab", accels_new_tab);
+
+    GSimpleAction *act_close_tab = g_simple_action_new("close-tab", NULL);
+    g_signal_connect(act_close_tab, "activate", G_CALLBACK(on_close_tab), NULL);
+    g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_close_tab));
+    const char *accels_close_tab[] = {"<Ctrl>w", NULL};
+    gtk_application_set_accels_for_action(app, "app.close-tab", accels_close_tab);
+
+    GSimpleAction *act_next_tab = g_simple_action_new("next-tab", NULL);
+    g_signal_connect(act_next_tab, "activate", G_CALLBACK(on_next_tab), NULL);
+    g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_next_tab));
+    const char *accels_next_tab[] = {"<Ctrl>Tab", "<Ctrl>Page_Down", NULL};
+    gtk_application_set_accels_for_action(app, "app.next-tab", accels_next_tab);
+
+    const char *zoom_actions[] = {"zoom-in", "zoom-out", "zoom-reset"};
+    const char *accels_zoom[][4] = {
+        {"<Ctrl>plus", "<Ctrl>equal", "<Ctrl>KP_Add", NULL},
+        {"<Ctrl>minus", "<Ctrl>KP_Subtract", NULL},
+        {"<Ctrl>0", "<Ctrl>KP_0", NULL},
+    };
+    for (guint i = 0; i < G_N_ELEMENTS(zoom_actions); i++) {
+        GSimpleAction *act_zoom = g_simple_action_new(zoom_actions[i], NULL);
+        g_signal_connect(act_zoom, "activate", G_CALLBACK(on_zoom), NULL);
+        g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_zoom));
+
+        char *detailed = g_strconcat("app.", zoom_actions[i], NULL);
+        gtk_application_set_accels_for_action(app, detailed, accels_zoom[i]);
+        g_free(detailed);
+    }
+
+    GSimpleAction *act_search = g_simple_action_new("search", NULL);
+    g_signal_connect(act_search, "activate", G_CALLBACK(on_search), NULL);
+    g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_search));
+    const char *accels_search[] = {"<Ctrl>l", NULL};
+    gtk_application_set_accels_for_action(app, "app.search", accels_search);
 
     GSimpleAction *act_shortcuts = g_simple_action_new("shortcuts", NULL);
     g_signal_connect(act_shortcuts, "activate", G_CALLBACK(on_show_shortcuts), window);
     g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_shortcuts));
 
+    GSimpleAction *act_background = g_simple_action_new_stateful("background", NULL, g_variant_new_boolean(config.run_in_background));
+    g_signal_connect(act_background, "activate", G_CALLBACK(on_background_changed), NULL);
+    g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_background));
+
+    GSimpleAction *act_show = g_simple_action_new("show", NULL);
+    g_signal_connect(act_show, "activate", G_CALLBACK(on_show), NULL);
+    g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_show));
+
+    GSimpleAction *act_open_link = g_simple_action_new("open-link", G_VARIANT_TYPE_STRING);
+    g_signal_connect(act_open_link, "activate", G_CALLBACK(on_open_link), NULL);
+    g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_open_link));
+
+    GSimpleAction *act_quit = g_simple_action_new("quit", NULL);
+    g_signal_connect(act_quit, "activate", G_CALLBACK(on_quit), NULL);
+    g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_quit));
+    const char *accels_quit[] = {"<Ctrl>q", NULL};
+    gtk_application_set_accels_for_action(app, "app.quit", accels_quit);
+
+    GSimpleAction *act_switch_profile = g_simple_action_new_stateful("profile", G_VARIANT_TYPE_STRING, g_variant_new_string(current->name));
+    g_signal_connect(act_switch_profile, "activate", G_CALLBACK(on_profile_changed), NULL);
+    g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_switch_profile));
+
+    GSimpleAction *act_new_profile = g_simple_action_new("new-profile", NULL);
+    g_signal_connect(act_new_profile, "activate", G_CALLBACK(on_new_profile), window);
+    g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_new_profile));
+
+    GSimpleAction *act_storage = g_simple_action_new("storage", NULL);
+    g_signal_connect(act_storage, "activate", G_CALLBACK(on_show_storage), window);
+    g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_storage));
+
     GSimpleAction *act_about = g_simple_action_new("about", NULL);
     g_signal_connect(act_about, "activate", G_CALLBACK(on_show_about), window);
     g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_about));
 
     // Theme Menu Action
     GSimpleAction *act_theme = g_simple_action_new_stateful("theme", G_VARIANT_TYPE_STRING, g_variant_new_string(config.theme));
-    g_signal_connect(act_theme, "activate", G_CALLBACK(on_theme_changed), webview);
+    g_signal_connect(act_theme, "activate", G_CALLBACK(on_theme_changed), NULL);
     g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_theme));
 
+    GSimpleAction *act_static_dark = g_simple_action_new_stateful("static-dark", NULL, g_variant_new_boolean(config.static_dark));
+    g_signal_connect(act_static_dark, "activate", G_CALLBACK(on_static_dark_changed), NULL);
+    g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_static_dark));
+
+    GSimpleAction *act_profile = g_simple_action_new_stateful("resource-profile", G_VARIANT_TYPE_STRING, g_variant_new_string(profile->name));
+    g_signal_connect(act_profile, "activate", G_CALLBACK(on_resource_profile_changed), NULL);
+    g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_profile));
+
     // Menu Structure
     GMenu *menu = g_menu_new();
     
+    GMenu *accounts_menu = g_menu_new();
+    browser.profiles_menu = g_menu_new();
+    GPtrArray *accounts = profiles_get_all(browser.profiles);
+    for (guint i = 0; i < accounts->len; i++) append_profile_item(g_ptr_array_index(accounts, i));
+    g_menu_append_section(accounts_menu, NULL, G_MENU_MODEL(browser.profiles_menu));
+    g_menu_append(accounts_menu, "New Profile…", "app.new-profile");
+    g_menu_append_submenu(menu, "Profiles", G_MENU_MODEL(accounts_menu));
+    
     GMenu *theme_menu = g_menu_new();
     g_menu_append(theme_menu, "Light", "app.theme::light");
     g_menu_append(theme_menu, "Dark", "app.theme::dark");
+    g_menu_append(theme_menu, "Fast Dark Mode (cached)", "app.static-dark");
     g_menu_append_submenu(menu, "Themes", G_MENU_MODEL(theme_menu));
     
+    GMenu *profile_menu = g_menu_new();
+    g_menu_append(profile_menu, "Minimal", "app.resource-profile::minimal");
+    g_menu_append(profile_menu, "Balanced", "app.resource-profile::balanced");
+    g_menu_append(profile_menu, "Performance", "app.resource-profile::performance");
+    g_menu_append_submenu(menu, "Memory Use", G_MENU_MODEL(profile_menu));
+    
+    GMenu *zoom_menu = g_menu_new();
+    g_menu_append(zoom_menu, "Zoom In", "app.zoom-in");
+    g_menu_append(zoom_menu, "Zoom Out", "app.zoom-out");
+    g_menu_append(zoom_menu, "Reset Zoom", "app.zoom-reset");
+    g_menu_append_submenu(menu, "Zoom", G_MENU_MODEL(zoom_menu));
+    
+    g_menu_append(menu, "Ask Where to Save Downloads", "app.ask-download");
+    g_menu_append(menu, "Storage", "app.storage");
+    g_menu_append(menu, "Run in Background", "app.background");
     g_menu_append(menu, "Keyboard Shortcuts", "app.shortcuts");
     g_menu_append(menu, "About", "app.about");
+    g_menu_append(menu, "Quit", "app.quit");
 
     GtkWidget *menu_button = gtk_menu_button_new();
     GtkWidget *menu_icon = gtk_image_new_from_icon_name("open-menu-symbolic", GTK_ICON_SIZE_BUTTON);
@@ -641,129 +1520,117 @@ static void activate(GtkApplication *app, gpointer user_data) {
     gtk_header_bar_pack_end(GTK_HEADER_BAR(header_bar), menu_button);
     
     // Set initial theme
-    char *css_file = g_strdup_printf("%s.css", config.theme);
-    set_theme(css_file, WEBKIT_WEB_VIEW(webview));
-    g_free(css_file);
+    set_theme(config.theme);
     
     // Download UI Setup
-    DownloadWidgets *dl_widgets = g_new0(DownloadWidgets, 1);
-    
     GtkWidget *overlay = gtk_overlay_new();
-    dl_widgets->overlay = overlay;
-    gtk_container_add(GTK_CONTAINER(overlay), webview);
-    
-    // Download Card
-    GtkWidget *card = gtk_box_new(GTK_ORIENTATION_VERTICAL, 10);
-    gtk_style_context_add_class(gtk_widget_get_style_context(card), "download-card");
-    gtk_widget_set_halign(card, GTK_ALIGN_START);
-    gtk_widget_set_valign(card, GTK_ALIGN_END);
-    gtk_widget_set_margin_start(card, 20);
-    gtk_widget_set_margin_bottom(card, 20);
-    gtk_widget_set_size_request(card, 300, -1);
-    
-    // Card Header (Filename + Hide Button)
-    GtkWidget *card_header = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 10);
-    GtkWidget *filename_label = gtk_label_new("filename.ext");
-    gtk_label_set_ellipsize(GTK_LABEL(filename_label), PANGO_ELLIPSIZE_MIDDLE);
-    gtk_box_pack_start(GTK_BOX(card_header), filename_label, TRUE, TRUE, 0);
-    dl_widgets->filename_label = filename_label;
-    
-    GtkWidget *hide_button = gtk_button_new_from_icon_name("window-minimize-symbolic", GTK_ICON_SIZE_BUTTON);
-    gtk_widget_set_tooltip_text(hide_button, "Hide to Ticker");
-    g_signal_connect(hide_button, "clicked", G_CALLBACK(on_download_hide), dl_widgets);
-    gtk_box_pack_end(GTK_BOX(card_header), hide_button, FALSE, FALSE, 0);
-    gtk_box_pack_start(GTK_BOX(card), card_header, FALSE, FALSE, 0);
-    
-    // Status & Progress
-    GtkWidget *status_label = gtk_label_new("Downloading...");
-    gtk_widget_set_halign(status_label, GTK_ALIGN_START);
-    dl_widgets->status_label = status_label;
-    gtk_box_pack_start(GTK_BOX(card), status_label, FALSE, FALSE, 0);
-    
-    GtkWidget *progress_bar = gtk_progress_bar_new();
-    gtk_progress_bar_set_show_text(GTK_PROGRESS_BAR(progress_bar), TRUE);
-    dl_widgets->progress_bar = progress_bar;
-    gtk_box_pack_start(GTK_BOX(card), progress_bar, FALSE, FALSE, 0);
-    
-    // Info (Speed, Time)
-    GtkWidget *info_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 10);
-    GtkWidget *speed_label = gtk_label_new("-");
-    dl_widgets->speed_label = speed_label;
-    gtk_box_pack_start(GTK_BOX(info_box), speed_label, TRUE, TRUE, 0);
-    
-    GtkWidget *time_label = gtk_label_new("-");
-    dl_widgets->time_label = time_label;
-    gtk_box_pack_start(GTK_BOX(info_box), time_label, TRUE, TRUE, 0);
-    gtk_box_pack_start(GTK_BOX(card), info_box, FALSE, FALSE, 0);
-    
-    // Buttons (Pause/Cancel/Dismiss)
-    GtkWidget *btn_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 10);
-    
-    GtkWidget *cancel_button = gtk_button_new_with_label("Cancel");
-    g_signal_connect(cancel_button, "clicked", G_CALLBACK(on_download_cancel), dl_widgets);
-    gtk_box_pack_end(GTK_BOX(btn_box), cancel_button, FALSE, FALSE, 0);
-    dl_widgets->cancel_button = cancel_button;
-    
-    GtkWidget *dismiss_button = gtk_button_new_with_label("Dismiss");
-    g_signal_connect(dismiss_button, "clicked", G_CALLBACK(on_download_dismiss), dl_widgets);
-    gtk_box_pack_end(GTK_BOX(btn_box), dismiss_button, FALSE, FALSE, 0);
-    dl_widgets->dismiss_button = dismiss_button;
-    
-    gtk_box_pack_start(GTK_BOX(card), btn_box, FALSE, FALSE, 0);
-    
-    dl_widgets->card = card;
-    gtk_overlay_add_overlay(GTK_OVERLAY(overlay), card);
-    gtk_widget_set_no_show_all(card, FALSE); // Prevent show_all from showing this
-    gtk_widget_hide(card);
-    
-    // Ticker
-    GtkWidget *ticker = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
-    // Class moved to button for better styling
-    gtk_widget_set_halign(ticker, GTK_ALIGN_START);
-    gtk_widget_set_valign(ticker, GTK_ALIGN_END);
-    gtk_widget_set_margin_start(ticker, 20);
-    gtk_widget_set_margin_bottom(ticker, 20);
-    
-    GtkWidget *ticker_button = gtk_button_new_with_label("Downloads Manager");
-    gtk_style_context_add_class(gtk_widget_get_style_context(ticker_button), "download-ticker");
-    g_signal_connect(ticker_button, "clicked", G_CALLBACK(on_download_restore), dl_widgets);
-    gtk_box_pack_start(GTK_BOX(ticker), ticker_button, TRUE, TRUE, 0);
-    dl_widgets->ticker_button = ticker_button;
-    
-    dl_widgets->ticker = ticker;
-    gtk_overlay_add_overlay(GTK_OVERLAY(overlay), ticker);
-    gtk_widget_set_no_show_all(ticker, FALSE); // Prevent show_all from showing this
-    gtk_widget_hide(ticker);
-    
-    // Connect download-started
-    g_signal_connect(context, "download-started", G_CALLBACK(on_download_started), dl_widgets);
+    gtk_container_add(GTK_CONTAINER(overlay), browser.pages);
+    
+    Downloads *downloads = browser.downloads;
+    downloads_add_to_overlay(downloads, GTK_OVERLAY(overlay));
+    downloads_set_directory(downloads, config.download_dir);
+    downloads_set_ask(downloads, config.ask_download);
+    
+    downloads_set_segmenting(downloads, (guint64)MAX(config.segment_threshold_mb, 0) * 1024 * 1024);
+    
+    gchar **rule_keys = config.download_rules ? g_key_file_get_keys(config.download_rules, "DownloadRules", NULL, NULL) : NULL;
+    for (int i = 0; rule_keys && rule_keys[i] != NULL; i++) {
+        char *directory = g_key_file_get_string(config.download_rules, "DownloadRules", rule_keys[i], NULL);
+        downloads_add_rule(downloads, rule_keys[i], directory);
+        g_free(directory);
+    }
+    g_strfreev(rule_keys);
+    
+    GSimpleAction *act_ask_download = g_simple_action_new_stateful("ask-download", NULL, g_variant_new_boolean(config.ask_download));
+    g_signal_connect(act_ask_download, "activate", G_CALLBACK(on_ask_download_changed), downloads);
+    g_action_map_add_action(G_ACTION_MAP(app), G_ACTION(act_ask_download));
     
     gtk_container_add(GTK_CONTAINER(window), overlay);
 
-    webkit_web_view_load_uri(WEBKIT_WEB_VIEW(webview), config.last_url);
+    startup_mark(&startup.ui_built, "widgets built");
 
-    g_signal_connect(window, "delete-event", G_CALLBACK(on_window_delete), webview);
+    // The splash goes away on the first commit (see on_load_changed) or
+    // after STARTUP_SPLASH_MAX_MS, whichever comes first
+    startup.splash = splash;
+    startup.main_window = window;
+    startup.timeout_id = g_timeout_add(STARTUP_SPLASH_MAX_MS, on_splash_timeout, NULL);
 
-    // Schedule splash close and main window show
-    GtkWidget **windows = g_new(GtkWidget*, 2);
-    windows[0] = splash;
-    windows[1] = window;
-    g_timeout_add(1500, close_splash_and_show_main, windows);
+    g_signal_connect(window, "delete-event", G_CALLBACK(on_window_delete), NULL);
+    g_signal_connect(window, "configure-event", G_CALLBACK(on_window_configure), NULL);
 
     g_free(data_dir);
     g_free(cache_dir);
-    g_object_unref(manager);
-    g_object_unref(context);
+}
+
+// Later launches only forward their URLs to the running instance over
+// D-Bus and exit, without ever initialising GTK or WebKit
+static void activate(GtkApplication *app, gpointer user_data) {
+    if (!browser.window) {
+        build_browser(app);
+    } else if (startup.revealed) {
+        show_browser();
+    }
+}
+
+static void on_open(GApplication *application, GFile **files, gint n_files, const gchar *hint, gpointer user_data) {
+    int first = 0;
+
+    if (!browser.window) {
+        // Cold start: the first URL replaces the last visited page
+        g_free(start_url);
+        start_url = g_file_get_uri(files[0]);
+        build_browser(GTK_APPLICATION(application));
+        first = 1;
+    }
+
+    for (int i = first; i < n_files; i++) {
+        char *uri = g_file_get_uri(files[i]);
+        tabs_open(browser.tabs, uri, i == n_files - 1);
+        g_free(uri);
+    }
+
+    if (startup.revealed) show_browser();
+}
+
+static gint on_handle_local_options(GApplication *application, GVariantDict *options, gpointer user_data) {
+    if (g_variant_dict_lookup(options, "url", "s", &start_url)) {
+        // --url behaves like a positional URL when an instance is running
+        if (g_application_register(application, NULL, NULL) && g_application_get_is_remote(application)) {
+            GFile *file = g_file_new_for_commandline_arg(start_url);
+            g_application_open(application, &file, 1, "");
+            g_object_unref(file);
+            return 0;
+        }
+    }
+
+    const char *trace_path = NULL;
+    if (g_variant_dict_lookup(options, "trace", "^&ay", &trace_path)) {
+        trace_open(trace_path);
+        trace_complete(NULL, "startup", "command line", startup.origin, g_get_monotonic_time(), NULL);
+    }
+
+    return -1; // Carry on with the default handling
 }
 
 int main(int argc, char **argv) {
     GtkApplication *app;
     int status;
 
-    app = gtk_application_new("com.example.LeafClass", G_APPLICATION_DEFAULT_FLAGS);
+    startup.origin = g_get_monotonic_time();
+    app = gtk_application_new("com.example.LeafClass", G_APPLICATION_HANDLES_OPEN);
+    g_application_add_main_option(G_APPLICATION(app), "url", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
+                                  "Open URL instead of the last visited page", "URL");
+    g_application_add_main_option(G_APPLICATION(app), "trace", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+                                  "Write a Chrome trace-event JSON file", "FILE");
+    g_signal_connect(app, "handle-local-options", G_CALLBACK(on_handle_local_options), NULL);
     g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
+    g_signal_connect(app, "open", G_CALLBACK(on_open), NULL);
+    g_signal_connect(app, "shutdown", G_CALLBACK(on_shutdown), NULL);
+    g_unix_signal_add(SIGTERM, on_terminate_signal, app);
+    g_unix_signal_add(SIGINT, on_terminate_signal, app);
     status = g_application_run(G_APPLICATION(app), argc, argv);
     g_object_unref(app);
+    trace_close();
 
     return status;
 }
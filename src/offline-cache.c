@@ -0,0 +1,323 @@
+#include "offline-cache.h"
+
+#include "config-store.h"
+
+#include <glib/gstdio.h>
+#include <string.h>
+
+// Wait for single-page navigations and late content before snapshotting
+#define OFFLINE_CACHE_SETTLE_SECONDS 3
+#define OFFLINE_CACHE_INDEX_SAVE_DELAY_MS 2000
+#define OFFLINE_CACHE_SAVE_SOURCE_KEY "leaf-offline-save"
+#define OFFLINE_CACHE_DATA_KEY "leaf-offline-cache"
+
+typedef struct {
+    char *url;
+    gint64 saved;  // Unix time in seconds
+    gint64 used;   // last saved or served, for eviction
+    guint64 size;
+} OfflineEntry;
+
+struct _OfflineCache {
+    char *dir;
+    char *index_path;
+    guint64 max_bytes;
+    guint64 total_bytes;
+    GHashTable *entries;  // key -> OfflineEntry
+    gboolean index_loaded;
+    ConfigStore *index_store;
+};
+
+typedef struct {
+    OfflineCache *cache;
+    char *key;
+    char *url;
+    char *tmp_path;
+} SnapshotJob;
+
+static void offline_entry_free(OfflineEntry *entry) {
+    g_free(entry->url);
+    g_free(entry);
+}
+
+static void snapshot_job_free(SnapshotJob *job) {
+    g_free(job->key);
+    g_free(job->url);
+    g_free(job->tmp_path);
+    g_free(job);
+}
+
+static char *snapshot_path(OfflineCache *cache, const char *key) {
+    char *filename = g_strconcat(key, ".mhtml", NULL);
+    char *path = g_build_filename(cache->dir, filename, NULL);
+    g_free(filename);
+    return path;
+}
+
+// Fragments never change what is on the page
+static char *cache_key(const char *url, char **normalized) {
+    const char *hash = strchr(url, '#');
+    char *stripped = hash ? g_strndup(url, hash - url) : g_strdup(url);
+    char *key = g_compute_checksum_for_string(G_CHECKSUM_SHA1, stripped, -1);
+    if (normalized) {
+        *normalized = stripped;
+    } else {
+        g_free(stripped);
+    }
+    return key;
+}
+
+// Snapshots written just before a quit that never reached the index, and
+// index entries whose file is gone, would otherwise slip past max_bytes
+static void remove_orphans(OfflineCache *cache) {
+    GDir *dir = g_dir_open(cache->dir, 0, NULL);
+    GHashTable *seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    const char *name;
+    while (dir && (name = g_dir_read_name(dir)) != NULL) {
+        if (g_str_has_suffix(name, ".mhtml")) {
+            char *key = g_strndup(name, strlen(name) - strlen(".mhtml"));
+            if (g_hash_table_contains(cache->entries, key)) {
+                g_hash_table_add(seen, key);
+                continue;
+            }
+            g_free(key);
+        } else if (!g_str_has_suffix(name, ".mhtml.tmp")) {
+            continue;
+        }
+
+        char *path = g_build_filename(cache->dir, name, NULL);
+        g_unlink(path);
+        g_free(path);
+    }
+    if (dir) g_dir_close(dir);
+
+    GHashTableIter iter;
+    gpointer key, value;
+    gboolean changed = FALSE;
+    g_hash_table_iter_init(&iter, cache->entries);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        if (g_hash_table_contains(seen, key)) continue;
+        cache->total_bytes -= ((OfflineEntry *)value)->size;
+        g_hash_table_iter_remove(&iter);
+        changed = TRUE;
+    }
+    g_hash_table_unref(seen);
+
+    if (changed) config_store_mark_dirty(cache->index_store);
+}
+
+static void load_index(OfflineCache *cache) {
+    if (cache->index_loaded) return;
+    cache->index_loaded = TRUE;
+
+    GKeyFile *key_file = g_key_file_new();
+    if (g_key_file_load_from_file(key_file, cache->index_path, G_KEY_FILE_NONE, NULL)) {
+        gchar **groups = g_key_file_get_groups(key_file, NULL);
+        for (int i = 0; groups[i] != NULL; i++) {
+            OfflineEntry *entry = g_new0(OfflineEntry, 1);
+            entry->url = g_key_file_get_string(key_file, groups[i], "URL", NULL);
+            entry->saved = g_key_file_get_int64(key_file, groups[i], "Saved", NULL);
+            entry->used = g_key_file_get_int64(key_file, groups[i], "Used", NULL);
+            entry->size = g_key_file_get_uint64(key_file, groups[i], "Size", NULL);
+
+            cache->total_bytes += entry->size;
+            g_hash_table_replace(cache->entries, g_strdup(groups[i]), entry);
+        }
+        g_strfreev(groups);
+    }
+
+    g_key_file_free(key_file);
+    remove_orphans(cache);
+}
+
+static void fill_index(GKeyFile *key_file, gpointer user_data) {
+    OfflineCache *cache = user_data;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, cache->entries);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        OfflineEntry *entry = value;
+        g_key_file_set_string(key_file, key, "URL", entry->url);
+        g_key_file_set_int64(key_file, key, "Saved", entry->saved);
+        g_key_file_set_int64(key_file, key, "Used", entry->used);
+        g_key_file_set_uint64(key_file, key, "Size", entry->size);
+    }
+}
+
+static void schedule_index_save(OfflineCache *cache) {
+    config_store_mark_dirty(cache->index_store);
+}
+
+static void remove_entry(OfflineCache *cache, const char *key) {
+    OfflineEntry *entry = g_hash_table_lookup(cache->entries, key);
+    if (!entry) return;
+
+    char *path = snapshot_path(cache, key);
+    g_unlink(path);
+    g_free(path);
+
+    cache->total_bytes -= MIN(entry->size, cache->total_bytes);
+    g_hash_table_remove(cache->entries, key);
+    schedule_index_save(cache);
+}
+
+// Evicts the least recently used snapshots until the store fits its budget
+static void evict(OfflineCache *cache, const char *keep_key) {
+    while (cache->total_bytes > cache->max_bytes) {
+        GHashTableIter iter;
+        gpointer key, value;
+        const char *oldest_key = NULL;
+        gint64 oldest = G_MAXINT64;
+
+        g_hash_table_iter_init(&iter, cache->entries);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            OfflineEntry *entry = value;
+            if (g_strcmp0(key, keep_key) != 0 && entry->used < oldest) {
+                oldest = entry->used;
+                oldest_key = key;
+            }
+        }
+
+        if (!oldest_key) break;
+        char *victim = g_strdup(oldest_key);
+        remove_entry(cache, victim);
+        g_free(victim);
+    }
+}
+
+// Pages worth keeping: anything inside a Classroom course (stream,
+// classwork, assignment and material pages all live under /c/<id>), and
+// local servers so the cache can be tried out without Classroom
+static gboolean should_snapshot(const char *url) {
+    GUri *uri = g_uri_parse(url, G_URI_FLAGS_NONE, NULL);
+    if (!uri) return FALSE;
+
+    const char *scheme = g_uri_get_scheme(uri);
+    const char *host = g_uri_get_host(uri);
+    const char *path = g_uri_get_path(uri);
+    gboolean wanted = FALSE;
+
+    if (g_strcmp0(scheme, "https") == 0 && g_strcmp0(host, "classroom.google.com") == 0) {
+        wanted = strstr(path, "/c/") != NULL;
+    } else if (g_strcmp0(scheme, "http") == 0 || g_strcmp0(scheme, "https") == 0) {
+        wanted = g_strcmp0(host, "localhost") == 0 || g_strcmp0(host, "127.0.0.1") == 0;
+    }
+
+    g_uri_unref(uri);
+    return wanted;
+}
+
+static void on_snapshot_saved(GObject *source, GAsyncResult *result, gpointer user_data) {
+    SnapshotJob *job = user_data;
+    OfflineCache *cache = job->cache;
+    GError *error = NULL;
+
+    if (!webkit_web_view_save_to_file_finish(WEBKIT_WEB_VIEW(source), result, &error)) {
+        g_debug("offline: snapshot of %s failed: %s", job->url, error->message);
+        g_error_free(error);
+        g_unlink(job->tmp_path);
+        snapshot_job_free(job);
+        return;
+    }
+
+    GStatBuf st;
+    char *path = snapshot_path(cache, job->key);
+    if (g_stat(job->tmp_path, &st) != 0 || (guint64)st.st_size > cache->max_bytes || g_rename(job->tmp_path, path) != 0) {
+        g_unlink(job->tmp_path);
+        g_free(path);
+        snapshot_job_free(job);
+        return;
+    }
+    g_free(path);
+
+    OfflineEntry *old = g_hash_table_lookup(cache->entries, job->key);
+    if (old) cache->total_bytes -= MIN(old->size, cache->total_bytes);
+
+    OfflineEntry *entry = g_new0(OfflineEntry, 1);
+    entry->url = g_strdup(job->url);
+    entry->saved = g_get_real_time() / G_USEC_PER_SEC;
+    entry->used = entry->saved;
+    entry->size = st.st_size;
+    cache->total_bytes += entry->size;
+    g_hash_table_replace(cache->entries, g_strdup(job->key), entry);
+
+    g_debug("offline: saved %s (%" G_GUINT64_FORMAT " KB)", job->url, entry->size / 1024);
+    evict(cache, job->key);
+    schedule_index_save(cache);
+    snapshot_job_free(job);
+}
+
+static gboolean on_settled(gpointer user_data) {
+    WebKitWebView *webview = WEBKIT_WEB_VIEW(user_data);
+    OfflineCache *cache = g_object_get_data(G_OBJECT(webview), OFFLINE_CACHE_DATA_KEY);
+
+    // The source is finishing by itself, don't let the data destructor remove it
+    g_object_steal_data(G_OBJECT(webview), OFFLINE_CACHE_SAVE_SOURCE_KEY);
+
+    const char *url = webkit_web_view_get_uri(webview);
+    if (!url || !should_snapshot(url) || webkit_web_view_is_loading(webview)) return G_SOURCE_REMOVE;
+
+    load_index(cache);
+    g_mkdir_with_parents(cache->dir, 0700);
+
+    SnapshotJob *job = g_new0(SnapshotJob, 1);
+    job->cache = cache;
+    job->key = cache_key(url, &job->url);
+    char *filename = g_strconcat(job->key, ".mhtml.tmp", NULL);
+    job->tmp_path = g_build_filename(cache->dir, filename, NULL);
+    g_free(filename);
+
+    GFile *file = g_file_new_for_path(job->tmp_path);
+    webkit_web_view_save_to_file(webview, file, WEBKIT_SAVE_MODE_MHTML, NULL, on_snapshot_saved, job);
+    g_object_unref(file);
+    return G_SOURCE_REMOVE;
+}
+
+static void remove_source(gpointer data) {
+    g_source_remove(GPOINTER_TO_UINT(data));
+}
+
+OfflineCache *offline_cache_new(const char *data_dir, guint64 max_bytes) {
+    OfflineCache *cache = g_new0(OfflineCache, 1);
+    cache->dir = g_build_filename(data_dir, "offline", NULL);
+    cache->index_path = g_build_filename(cache->dir, "index.ini", NULL);
+    cache->max_bytes = max_bytes;
+    cache->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)offline_entry_free);
+    cache->index_store = config_store_new_key_file(cache->index_path, OFFLINE_CACHE_INDEX_SAVE_DELAY_MS, fill_index, cache);
+    return cache;
+}
+
+void offline_cache_page_changed(OfflineCache *cache, WebKitWebView *webview) {
+    const char *url = webkit_web_view_get_uri(webview);
+    if (cache->max_bytes == 0 || !url || !should_snapshot(url)) return;
+
+    // Restart the settle timer; destroying the view removes it
+    g_object_set_data(G_OBJECT(webview), OFFLINE_CACHE_DATA_KEY, cache);
+    guint id = g_timeout_add_seconds(OFFLINE_CACHE_SETTLE_SECONDS, on_settled, webview);
+    g_object_set_data_full(G_OBJECT(webview), OFFLINE_CACHE_SAVE_SOURCE_KEY, GUINT_TO_POINTER(id), remove_source);
+}
+
+char *offline_cache_lookup(OfflineCache *cache, const char *url) {
+    load_index(cache);
+
+    char *key = cache_key(url, NULL);
+    OfflineEntry *entry = g_hash_table_lookup(cache->entries, key);
+    char *uri = NULL;
+
+    if (entry) {
+        char *path = snapshot_path(cache, key);
+        if (g_file_test(path, G_FILE_TEST_EXISTS)) {
+            entry->used = g_get_real_time() / G_USEC_PER_SEC;
+            schedule_index_save(cache);
+            uri = g_filename_to_uri(path, NULL, NULL);
+        } else {
+            remove_entry(cache, key);
+        }
+        g_free(path);
+    }
+
+    g_free(key);
+    return uri;
+}
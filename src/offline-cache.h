@@ -0,0 +1,21 @@
+#ifndef LEAF_CLASS_OFFLINE_CACHE_H
+#define LEAF_CLASS_OFFLINE_CACHE_H
+
+#include <webkit2/webkit2.h>
+
+// MHTML snapshots of visited Classroom pages (course streams, assignments,
+// materials) kept under the user data dir, so they can still be read when
+// the network is gone. Snapshots are keyed by URL, evicted least recently
+// used first once the store outgrows max_bytes.
+typedef struct _OfflineCache OfflineCache;
+
+OfflineCache *offline_cache_new(const char *data_dir, guint64 max_bytes);
+
+// Call on every finished load and URI change; the page is snapshotted once
+// it has settled for a few seconds
+void offline_cache_page_changed(OfflineCache *cache, WebKitWebView *webview);
+
+// Returns the file URI of the snapshot for url, or NULL
+char *offline_cache_lookup(OfflineCache *cache, const char *url);
+
+#endif
@@ -0,0 +1,269 @@
+#include "poller.h"
+
+#include <libsoup/soup.h>
+#include <string.h>
+
+#define POLLER_MIN_INTERVAL_SECONDS 30
+
+struct _Poller {
+    SoupSession *session;
+    PollerNewItems new_items;
+    gpointer user_data;
+
+    char *url;
+    guint interval_seconds;
+    guint timeout_id;
+    GCancellable *cancellable;  // set while a fetch is in flight
+    SoupMessage *message;
+
+    GHashTable *seen;  // item ids
+    gboolean baseline;  // the next fetch records items without reporting them
+    char *etag;
+    char *last_modified;
+};
+
+typedef struct {
+    GPtrArray *items;
+    PollerItem *item;  // entry being read
+    GString *text;
+    gboolean capturing;
+} FeedParser;
+
+static void poller_item_free(PollerItem *item) {
+    g_free(item->id);
+    g_free(item->title);
+    g_free(item->link);
+    g_free(item);
+}
+
+// Namespace prefixes don't matter for the few elements we read
+static const char *local_name(const char *element) {
+    const char *colon = strrchr(element, ':');
+    return colon ? colon + 1 : element;
+}
+
+static void feed_start_element(GMarkupParseContext *context, const gchar *element, const gchar **names,
+                               const gchar **values, gpointer user_data, GError **error) {
+    FeedParser *parser = user_data;
+    const char *name = local_name(element);
+
+    if (strcmp(name, "entry") == 0 || strcmp(name, "item") == 0) {
+        if (parser->item) poller_item_free(parser->item);
+        parser->item = g_new0(PollerItem, 1);
+        return;
+    }
+    if (!parser->item) return;
+
+    if (strcmp(name, "link") == 0) {
+        // Atom puts the address in href; RSS in the element text
+        const char *href = NULL;
+        const char *rel = NULL;
+        for (int i = 0; names[i] != NULL; i++) {
+            if (strcmp(names[i], "href") == 0) href = values[i];
+            if (strcmp(names[i], "rel") == 0) rel = values[i];
+        }
+        if (href) {
+            if (!parser->item->link && (!rel || strcmp(rel, "alternate") == 0)) parser->item->link = g_strdup(href);
+            return;
+        }
+    } else if (strcmp(name, "id") != 0 && strcmp(name, "guid") != 0 && strcmp(name, "title") != 0) {
+        return;
+    }
+
+    g_string_truncate(parser->text, 0);
+    parser->capturing = TRUE;
+}
+
+static void feed_end_element(GMarkupParseContext *context, const gchar *element, gpointer user_data,
+                             GError **error) {
+    FeedParser *parser = user_data;
+    const char *name = local_name(element);
+    if (!parser->item) return;
+
+    if (strcmp(name, "entry") == 0 || strcmp(name, "item") == 0) {
+        PollerItem *item = parser->item;
+        parser->item = NULL;
+        if (!item->id) item->id = g_strdup(item->link ? item->link : item->title);
+        if (item->id) {
+            g_ptr_array_add(parser->items, item);
+        } else {
+            poller_item_free(item);
+        }
+        return;
+    }
+    if (!parser->capturing) return;
+    parser->capturing = FALSE;
+
+    char *text = g_strstrip(g_strdup(parser->text->str));
+    char **field = NULL;
+    if (strcmp(name, "id") == 0 || strcmp(name, "guid") == 0) field = &parser->item->id;
+    else if (strcmp(name, "title") == 0) field = &parser->item->title;
+    else if (strcmp(name, "link") == 0) field = &parser->item->link;
+
+    if (field && !*field && *text) {
+        *field = text;
+    } else {
+        g_free(text);
+    }
+}
+
+static void feed_text(GMarkupParseContext *context, const gchar *text, gsize length, gpointer user_data,
+                      GError **error) {
+    FeedParser *parser = user_data;
+    if (parser->capturing) g_string_append_len(parser->text, text, length);
+}
+
+static const GMarkupParser feed_parser = {feed_start_element, feed_end_element, feed_text, NULL, NULL};
+
+// Entries in document order (newest first in most feeds)
+static GPtrArray *parse_feed(GBytes *body, GError **error) {
+    FeedParser parser = {0};
+    parser.items = g_ptr_array_new_with_free_func((GDestroyNotify)poller_item_free);
+    parser.text = g_string_new(NULL);
+
+    gsize length;
+    const char *data = g_bytes_get_data(body, &length);
+    GMarkupParseContext *context = g_markup_parse_context_new(&feed_parser, G_MARKUP_TREAT_CDATA_AS_TEXT, &parser, NULL);
+    gboolean ok = g_markup_parse_context_parse(context, data, length, error) &&
+                  g_markup_parse_context_end_parse(context, error);
+
+    g_markup_parse_context_free(context);
+    if (parser.item) poller_item_free(parser.item);
+    g_string_free(parser.text, TRUE);
+
+    if (!ok) {
+        g_ptr_array_unref(parser.items);
+        return NULL;
+    }
+    return parser.items;
+}
+
+static void remember_validators(Poller *poller) {
+    SoupMessageHeaders *headers = soup_message_get_response_headers(poller->message);
+    g_free(poller->etag);
+    g_free(poller->last_modified);
+    poller->etag = g_strdup(soup_message_headers_get_one(headers, "ETag"));
+    poller->last_modified = g_strdup(soup_message_headers_get_one(headers, "Last-Modified"));
+}
+
+static void report_new_items(Poller *poller, GPtrArray *items) {
+    GPtrArray *fresh = g_ptr_array_new_with_free_func((GDestroyNotify)poller_item_free);
+
+    for (guint i = items->len; i > 0; i--) {
+        PollerItem *item = g_ptr_array_index(items, i - 1);
+        if (g_hash_table_contains(poller->seen, item->id)) continue;
+        g_hash_table_add(poller->seen, g_strdup(item->id));
+        if (!poller->baseline) g_ptr_array_add(fresh, g_ptr_array_steal_index(items, i - 1));
+    }
+
+    g_debug("poller: %u entries, %u new%s", items->len, fresh->len, poller->baseline ? " (baseline)" : "");
+    poller->baseline = FALSE;
+    if (fresh->len > 0) poller->new_items(fresh, poller->user_data);
+    g_ptr_array_unref(fresh);
+}
+
+static void on_feed_fetched(GObject *source, GAsyncResult *result, gpointer user_data) {
+    Poller *poller = user_data;
+    GError *error = NULL;
+    GBytes *body = soup_session_send_and_read_finish(SOUP_SESSION(source), result, &error);
+
+    // Stopped meanwhile
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_error_free(error);
+        return;
+    }
+
+    guint status = soup_message_get_status(poller->message);
+    if (error) {
+        g_debug("poller: %s: %s", poller->url, error->message);
+        g_clear_error(&error);
+    } else if (status == SOUP_STATUS_NOT_MODIFIED) {
+        g_debug("poller: %s not modified", poller->url);
+    } else if (SOUP_STATUS_IS_SUCCESSFUL(status)) {
+        GPtrArray *items = parse_feed(body, &error);
+        if (items) {
+            remember_validators(poller);
+            report_new_items(poller, items);
+            g_ptr_array_unref(items);
+        } else {
+            g_warning("Could not read the feed at %s: %s", poller->url, error->message);
+            g_clear_error(&error);
+        }
+    } else {
+        // 401/403 mostly mean the saved session has expired
+        g_debug("poller: %s returned HTTP %u", poller->url, status);
+    }
+
+    if (body) g_bytes_unref(body);
+    g_clear_object(&poller->message);
+    g_clear_object(&poller->cancellable);
+}
+
+static gboolean poll_now(gpointer user_data) {
+    Poller *poller = user_data;
+    if (poller->cancellable) return G_SOURCE_CONTINUE;  // previous fetch still running
+
+    poller->message = soup_message_new("GET", poller->url);
+    if (!poller->message) {
+        g_warning("Not a valid feed URL: %s", poller->url);
+        poller->timeout_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    SoupMessageHeaders *headers = soup_message_get_request_headers(poller->message);
+    soup_message_headers_replace(headers, "Accept", "application/atom+xml, application/rss+xml, application/xml;q=0.9, */*;q=0.1");
+    if (poller->etag) soup_message_headers_replace(headers, "If-None-Match", poller->etag);
+    if (poller->last_modified) soup_message_headers_replace(headers, "If-Modified-Since", poller->last_modified);
+
+    poller->cancellable = g_cancellable_new();
+    soup_session_send_and_read_async(poller->session, poller->message, G_PRIORITY_LOW, poller->cancellable,
+                                     on_feed_fetched, poller);
+    return G_SOURCE_CONTINUE;
+}
+
+Poller *poller_new(const char *cookie_file, const char *user_agent, PollerNewItems new_items, gpointer user_data) {
+    Poller *poller = g_new0(Poller, 1);
+    poller->new_items = new_items;
+    poller->user_data = user_data;
+    poller->seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    poller->session = soup_session_new_with_options("user-agent", user_agent, "max-conns-per-host", 1, NULL);
+    if (cookie_file) {
+        // WebKit owns this database; only read from it
+        SoupCookieJar *jar = soup_cookie_jar_db_new(cookie_file, TRUE);
+        soup_session_add_feature(poller->session, SOUP_SESSION_FEATURE(jar));
+        g_object_unref(jar);
+    }
+    return poller;
+}
+
+void poller_start(Poller *poller, const char *url, guint interval_seconds) {
+    poller_stop(poller);
+    if (!url || !*url) return;
+
+    g_free(poller->url);
+    poller->url = g_strdup(url);
+    poller->interval_seconds = MAX(interval_seconds, POLLER_MIN_INTERVAL_SECONDS);
+    poller->baseline = TRUE;
+    g_hash_table_remove_all(poller->seen);
+    g_clear_pointer(&poller->etag, g_free);
+    g_clear_pointer(&poller->last_modified, g_free);
+
+    g_debug("poller: checking %s every %u s", poller->url, poller->interval_seconds);
+    poll_now(poller);
+    if (poller->message) {
+        poller->timeout_id = g_timeout_add_seconds(poller->interval_seconds, poll_now, poller);
+    }
+}
+
+void poller_stop(Poller *poller) {
+    if (poller->timeout_id) {
+        g_source_remove(poller->timeout_id);
+        poller->timeout_id = 0;
+    }
+    if (poller->cancellable) {
+        g_cancellable_cancel(poller->cancellable);
+        g_clear_object(&poller->cancellable);
+    }
+    g_clear_object(&poller->message);
+}
@@ -0,0 +1,26 @@
+#ifndef LEAF_CLASS_POLLER_H
+#define LEAF_CLASS_POLLER_H
+
+#include <glib.h>
+
+// Checks an Atom or RSS feed on a timer with a plain libsoup session that
+// reads the browser's cookie database, so it is signed in like the pages
+// were without keeping a web process around. The first fetch after
+// poller_start() only records what is already there; entries that show up
+// later are reported once each, oldest first.
+typedef struct _Poller Poller;
+
+typedef struct {
+    char *id;
+    char *title;
+    char *link;  // may be NULL
+} PollerItem;
+
+// items holds PollerItem and is freed after the call
+typedef void (*PollerNewItems)(GPtrArray *items, gpointer user_data);
+
+Poller *poller_new(const char *cookie_file, const char *user_agent, PollerNewItems new_items, gpointer user_data);
+void poller_start(Poller *poller, const char *url, guint interval_seconds);
+void poller_stop(Poller *poller);
+
+#endif
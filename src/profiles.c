@@ -0,0 +1,204 @@
+#include "profiles.h"
+
+#include "config-store.h"
+
+#define PROFILES_SAVE_DELAY_MS 5000
+#define PROFILES_WARM 2
+#define PROFILE_NAME_MAX_CHARS 32
+
+struct _Profiles {
+    char *data_dir;
+    char *cache_dir;
+    char *path;
+    ProfilesWake wake;
+    ProfilesRelease release;
+    gpointer user_data;
+
+    GPtrArray *all;  // Profile, "Default" first
+    Profile *current;
+    ConfigStore *store;
+};
+
+static void profile_free(Profile *profile) {
+    g_free(profile->name);
+    g_free(profile->data_dir);
+    g_free(profile->cache_dir);
+    g_free(profile->last_url);
+    g_free(profile);
+}
+
+static char *group_for(const Profile *profile) {
+    return g_strconcat("Profile ", profile->name, NULL);
+}
+
+// --- profiles.ini ---
+
+static void fill_profiles(GKeyFile *key_file, gpointer user_data) {
+    Profiles *profiles = user_data;
+    const char **names = g_new0(const char *, profiles->all->len + 1);
+
+    for (guint i = 0; i < profiles->all->len; i++) {
+        Profile *profile = g_ptr_array_index(profiles->all, i);
+        names[i] = profile->name;
+        if (profile->last_url) {
+            char *group = group_for(profile);
+            g_key_file_set_string(key_file, group, "LastURL", profile->last_url);
+            g_free(group);
+        }
+    }
+    g_key_file_set_string_list(key_file, "Profiles", "Names", names, profiles->all->len);
+    g_key_file_set_string(key_file, "Profiles", "Current", profiles->current ? profiles->current->name : PROFILES_DEFAULT);
+    g_free(names);
+}
+
+static void schedule_save(Profiles *profiles) {
+    config_store_mark_dirty(profiles->store);
+}
+
+// Names become directory names, so only letters, digits, spaces, '-' and
+// '_' are allowed, and not at the start
+static gboolean is_valid_name(const char *name) {
+    if (!name || !g_utf8_validate(name, -1, NULL)) return FALSE;
+
+    glong length = g_utf8_strlen(name, -1);
+    if (length == 0 || length > PROFILE_NAME_MAX_CHARS || !g_unichar_isalnum(g_utf8_get_char(name))) return FALSE;
+
+    for (const char *c = name; *c; c = g_utf8_next_char(c)) {
+        gunichar ch = g_utf8_get_char(c);
+        if (!g_unichar_isalnum(ch) && ch != ' ' && ch != '-' && ch != '_') return FALSE;
+    }
+    return TRUE;
+}
+
+static Profile *append_profile(Profiles *profiles, const char *name) {
+    Profile *profile = g_new0(Profile, 1);
+    profile->name = g_strdup(name);
+
+    if (g_str_equal(name, PROFILES_DEFAULT)) {
+        profile->data_dir = g_strdup(profiles->data_dir);
+        profile->cache_dir = g_strdup(profiles->cache_dir);
+    } else {
+        profile->data_dir = g_build_filename(profiles->data_dir, "profiles", name, NULL);
+        profile->cache_dir = g_build_filename(profiles->cache_dir, "profiles", name, NULL);
+    }
+
+    g_ptr_array_add(profiles->all, profile);
+    return profile;
+}
+
+static void load_profiles(Profiles *profiles) {
+    GKeyFile *key_file = g_key_file_new();
+    g_key_file_load_from_file(key_file, profiles->path, G_KEY_FILE_NONE, NULL);
+
+    append_profile(profiles, PROFILES_DEFAULT);
+    gchar **names = g_key_file_get_string_list(key_file, "Profiles", "Names", NULL, NULL);
+    for (int i = 0; names && names[i] != NULL; i++) {
+        if (is_valid_name(names[i]) && !profiles_find(profiles, names[i])) append_profile(profiles, names[i]);
+    }
+    g_strfreev(names);
+
+    for (guint i = 0; i < profiles->all->len; i++) {
+        Profile *profile = g_ptr_array_index(profiles->all, i);
+        char *group = group_for(profile);
+        profile->last_url = g_key_file_get_string(key_file, group, "LastURL", NULL);
+        g_free(group);
+    }
+
+    char *current = g_key_file_get_string(key_file, "Profiles", "Current", NULL);
+    profiles->current = profiles_find(profiles, current ? current : PROFILES_DEFAULT);
+    if (!profiles->current) profiles->current = g_ptr_array_index(profiles->all, 0);
+    g_free(current);
+
+    g_key_file_free(key_file);
+}
+
+// --- Public API ---
+
+Profiles *profiles_new(const char *data_dir, const char *cache_dir, ProfilesWake wake, ProfilesRelease release,
+                       gpointer user_data) {
+    Profiles *profiles = g_new0(Profiles, 1);
+    profiles->data_dir = g_strdup(data_dir);
+    profiles->cache_dir = g_strdup(cache_dir);
+    profiles->path = g_build_filename(data_dir, "profiles.ini", NULL);
+    profiles->wake = wake;
+    profiles->release = release;
+    profiles->user_data = user_data;
+    profiles->all = g_ptr_array_new_with_free_func((GDestroyNotify)profile_free);
+    profiles->store = config_store_new_key_file(profiles->path, PROFILES_SAVE_DELAY_MS, fill_profiles, profiles);
+
+    load_profiles(profiles);
+    return profiles;
+}
+
+GPtrArray *profiles_get_all(Profiles *profiles) {
+    return profiles->all;
+}
+
+Profile *profiles_get_current(Profiles *profiles) {
+    return profiles->current;
+}
+
+Profile *profiles_find(Profiles *profiles, const char *name) {
+    if (!name) return NULL;
+
+    char *folded = g_utf8_casefold(name, -1);
+    Profile *found = NULL;
+    for (guint i = 0; i < profiles->all->len && !found; i++) {
+        Profile *profile = g_ptr_array_index(profiles->all, i);
+        char *other = g_utf8_casefold(profile->name, -1);
+        if (g_str_equal(folded, other)) found = profile;
+        g_free(other);
+    }
+
+    g_free(folded);
+    return found;
+}
+
+Profile *profiles_add(Profiles *profiles, const char *name) {
+    if (!is_valid_name(name) || profiles_find(profiles, name)) return NULL;
+
+    Profile *profile = append_profile(profiles, name);
+    schedule_save(profiles);
+    return profile;
+}
+
+static gint compare_recent(gconstpointer a, gconstpointer b) {
+    const Profile *x = *(Profile *const *)a;
+    const Profile *y = *(Profile *const *)b;
+    return (x->used < y->used) - (x->used > y->used);
+}
+
+void profiles_switch(Profiles *profiles, Profile *profile) {
+    if (!profile->context) {
+        g_mkdir_with_parents(profile->data_dir, 0700);
+        g_mkdir_with_parents(profile->cache_dir, 0700);
+        profiles->wake(profile, profiles->user_data);
+        g_debug("profiles: woke %s", profile->name);
+    }
+
+    if (profiles->current != profile) schedule_save(profiles);
+    profiles->current = profile;
+    profile->used = g_get_monotonic_time();
+
+    GPtrArray *warm = g_ptr_array_new();
+    for (guint i = 0; i < profiles->all->len; i++) {
+        Profile *other = g_ptr_array_index(profiles->all, i);
+        if (other->context) g_ptr_array_add(warm, other);
+    }
+    g_ptr_array_sort(warm, compare_recent);
+
+    for (guint i = PROFILES_WARM; i < warm->len; i++) {
+        Profile *cold = g_ptr_array_index(warm, i);
+        g_debug("profiles: releasing %s", cold->name);
+        profiles->release(cold, profiles->user_data);
+    }
+    g_ptr_array_unref(warm);
+}
+
+void profiles_set_last_url(Profiles *profiles, Profile *profile, const char *uri) {
+    if (!uri || g_strcmp0(uri, profile->last_url) == 0) return;
+
+    g_free(profile->last_url);
+    profile->last_url = g_strdup(uri);
+    schedule_save(profiles);
+}
@@ -0,0 +1,77 @@
+#ifndef LEAF_CLASS_PROFILES_H
+#define LEAF_CLASS_PROFILES_H
+
+#include <webkit2/webkit2.h>
+
+#include "dark-mode.h"
+#include "download-store.h"
+#include "fetch-cache.h"
+#include "offline-cache.h"
+#include "poller.h"
+#include "search.h"
+#include "storage.h"
+#include "tabs.h"
+#include "warmup.h"
+
+// Named browser profiles, e.g. a school and a personal Google account. Each
+// has its own website data and cache directory, so its own cookies and
+// sign-ins: "Default" keeps <data_dir> and <cache_dir>, the others live in
+// profiles/<name> below them. The list, the current profile and each
+// profile's last page are kept in <data_dir>/profiles.ini, which is written
+// through a ConfigStore and so flushed at shutdown.
+//
+// A profile is warm while it has a context and tabs. The current profile
+// and the one used before it stay warm, so switching back and forth costs a
+// page load rather than a sign-in; older ones are released. What is created
+// on first wake besides those (data manager, content manager, dark mode
+// sheets, fetch cache, download store, offline snapshots, search index,
+// storage quota, learned hosts) is kept for the session.
+typedef struct _Profiles Profiles;
+
+#define PROFILES_DEFAULT "Default"
+
+typedef struct {
+    char *name;
+    char *data_dir;
+    char *cache_dir;
+    char *last_url;  // NULL until a page is remembered
+    gint64 used;     // when it last became current
+
+    // Owned by the wake/release callbacks
+    WebKitWebsiteDataManager *manager;
+    WebKitUserContentManager *content_manager;
+    DarkMode *dark_mode;
+    FetchCache *fetch_cache;
+    DownloadStore *download_store;  // NULL when the store is off
+    OfflineCache *offline_cache;
+    SearchIndex *search;
+    Storage *storage;
+    Warmup *warmup;
+    Poller *poller;  // NULL until the window is first hidden on this profile
+    WebKitWebContext *context;  // NULL while cold
+    Tabs *tabs;                 // likewise
+} Profile;
+
+// Sets profile->context and profile->tabs
+typedef void (*ProfilesWake)(Profile *profile, gpointer user_data);
+// Tears down profile->tabs and profile->context
+typedef void (*ProfilesRelease)(Profile *profile, gpointer user_data);
+
+Profiles *profiles_new(const char *data_dir, const char *cache_dir, ProfilesWake wake, ProfilesRelease release,
+                       gpointer user_data);
+
+// Profile, "Default" first and the rest in the order they were added
+GPtrArray *profiles_get_all(Profiles *profiles);
+Profile *profiles_get_current(Profiles *profiles);
+Profile *profiles_find(Profiles *profiles, const char *name);
+
+// Adds a profile with no data yet; NULL if the name is taken or unusable as
+// a directory name
+Profile *profiles_add(Profiles *profiles, const char *name);
+
+// Makes profile current, waking it if needed, and releases every profile
+// but the two used most recently
+void profiles_switch(Profiles *profiles, Profile *profile);
+void profiles_set_last_url(Profiles *profiles, Profile *profile, const char *uri);
+
+#endif
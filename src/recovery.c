@@ -0,0 +1,205 @@
+#include "recovery.h"
+
+#include "trace.h"
+
+#define RECOVERY_MESSAGE_HANDLER "leafScroll"
+#define RECOVERY_DATA_KEY "leaf-recovery"
+// First reload right away, then doubling up to the cap
+#define RECOVERY_FIRST_DELAY_MS 250
+#define RECOVERY_MAX_DELAY_MS 8000
+#define RECOVERY_MAX_ATTEMPTS 5
+// A view that stays up this long starts counting from zero again
+#define RECOVERY_STABLE_SECONDS 60
+#define RECOVERY_MAX_POSITIONS 256
+
+// Reports the scroll position at most twice a second while scrolling
+#define RECOVERY_SCROLL_SCRIPT \
+    "(() => {" \
+    "  let pending = false;" \
+    "  addEventListener('scroll', () => {" \
+    "    if (pending) return;" \
+    "    pending = true;" \
+    "    setTimeout(() => {" \
+    "      pending = false;" \
+    "      window.webkit.messageHandlers." RECOVERY_MESSAGE_HANDLER ".postMessage(" \
+    "        {url: location.href, y: window.scrollY});" \
+    "    }, 500);" \
+    "  }, {passive: true});" \
+    "})();"
+
+struct _Recovery {
+    RecoveryTerminated terminated;
+    gpointer user_data;
+    GHashTable *positions;  // URL -> double* scroll offset
+};
+
+typedef struct {
+    Recovery *recovery;
+    WebKitWebView *view;
+    char *uri;
+    WebKitWebViewSessionState *session;
+    double scroll_y;
+    gboolean restore_scroll;
+    guint attempts;
+    gint64 last_crash;  // monotonic
+    guint reload_id;
+} RecoveryState;
+
+static void recovery_state_free(RecoveryState *state) {
+    if (state->reload_id) g_source_remove(state->reload_id);
+    if (state->session) webkit_web_view_session_state_unref(state->session);
+    g_free(state->uri);
+    g_free(state);
+}
+
+static const char *reason_name(WebKitWebProcessTerminationReason reason) {
+    switch (reason) {
+    case WEBKIT_WEB_PROCESS_CRASHED:
+        return "crashed";
+    case WEBKIT_WEB_PROCESS_EXCEEDED_MEMORY_LIMIT:
+        return "exceeded its memory limit";
+    case WEBKIT_WEB_PROCESS_TERMINATED_BY_API:
+        return "was terminated by the app";
+    default:
+        return "terminated";
+    }
+}
+
+static void on_scroll_message(WebKitUserContentManager *manager, WebKitJavascriptResult *result, gpointer user_data) {
+    Recovery *recovery = user_data;
+    JSCValue *message = webkit_javascript_result_get_js_value(result);
+    if (!jsc_value_is_object(message)) return;
+
+    JSCValue *url = jsc_value_object_get_property(message, "url");
+    JSCValue *y = jsc_value_object_get_property(message, "y");
+
+    if (jsc_value_is_string(url) && jsc_value_is_number(y)) {
+        if (g_hash_table_size(recovery->positions) >= RECOVERY_MAX_POSITIONS) {
+            g_hash_table_remove_all(recovery->positions);
+        }
+        double *offset = g_new(double, 1);
+        *offset = jsc_value_to_double(y);
+        g_hash_table_replace(recovery->positions, jsc_value_to_string(url), offset);
+    }
+
+    g_object_unref(url);
+    g_object_unref(y);
+}
+
+static void on_load_changed(WebKitWebView *webview, WebKitLoadEvent load_event, gpointer user_data) {
+    RecoveryState *state = user_data;
+    if (load_event != WEBKIT_LOAD_FINISHED || !state->restore_scroll) return;
+
+    state->restore_scroll = FALSE;
+    char *script = g_strdup_printf("window.scrollTo(0, %f);", state->scroll_y);
+    webkit_web_view_evaluate_javascript(webview, script, -1, NULL, NULL, NULL, NULL, NULL);
+    g_free(script);
+}
+
+static gboolean on_reload_timeout(gpointer user_data) {
+    RecoveryState *state = user_data;
+    WebKitWebView *view = state->view;
+    state->reload_id = 0;
+
+    trace_instant(view, "recovery", "reload", "url", state->uri, NULL);
+
+    // History normally survives the crash; restore it if it didn't
+    WebKitBackForwardList *history = webkit_web_view_get_back_forward_list(view);
+    if (!webkit_back_forward_list_get_current_item(history) && state->session) {
+        webkit_web_view_restore_session_state(view, state->session);
+    }
+    g_clear_pointer(&state->session, webkit_web_view_session_state_unref);
+
+    WebKitBackForwardListItem *item = webkit_back_forward_list_get_current_item(history);
+    state->restore_scroll = state->scroll_y > 0;
+    if (item && g_strcmp0(webkit_back_forward_list_item_get_uri(item), state->uri) == 0) {
+        webkit_web_view_reload(view);
+    } else if (state->uri) {
+        // Crashed before the navigation was committed
+        webkit_web_view_load_uri(view, state->uri);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static void show_crash_page(RecoveryState *state, WebKitWebProcessTerminationReason reason) {
+    char *message = g_markup_printf_escaped(
+        "<html><body style='background-color:#242424; color:white; font-family:sans-serif; text-align:center; padding-top:50px;'>"
+        "<img src='leaf://resources/icons/leaf-class.png' width='96' height='96'>"
+        "<h1>🍂 Leaf Class 🍂</h1>"
+        "<h2>This page keeps closing</h2>"
+        "<p>The page %s %u times in a row.%s</p>"
+        "<button onclick='location.reload()' style='padding:10px 20px; cursor:pointer; background:#4CAF50; border:none; color:white; font-size:16px; border-radius:4px;'>Try Again</button>"
+        "</body></html>",
+        reason_name(reason), state->attempts,
+        reason == WEBKIT_WEB_PROCESS_EXCEEDED_MEMORY_LIMIT ? " Closing other tabs or turning off dark mode may help." : "");
+    webkit_web_view_load_html(state->view, message, state->uri);
+    g_free(message);
+}
+
+static void on_web_process_terminated(WebKitWebView *webview, WebKitWebProcessTerminationReason reason,
+                                      gpointer user_data) {
+    RecoveryState *state = user_data;
+    Recovery *recovery = state->recovery;
+    const char *uri = webkit_web_view_get_uri(webview);
+
+    trace_instant(webview, "recovery", "web process terminated", "reason", reason_name(reason), "url", uri, NULL);
+
+    // Our own doing, e.g. a view being torn down
+    if (reason == WEBKIT_WEB_PROCESS_TERMINATED_BY_API) return;
+
+    gint64 now = g_get_monotonic_time();
+    if (now - state->last_crash > RECOVERY_STABLE_SECONDS * G_USEC_PER_SEC) state->attempts = 0;
+    state->last_crash = now;
+    state->attempts++;
+
+    g_warning("Web process for %s %s (%u in a row)", uri ? uri : "(no page)", reason_name(reason), state->attempts);
+
+    g_free(state->uri);
+    state->uri = g_strdup(uri);
+    double *offset = uri ? g_hash_table_lookup(recovery->positions, uri) : NULL;
+    state->scroll_y = offset ? *offset : 0;
+    if (state->session) webkit_web_view_session_state_unref(state->session);
+    state->session = webkit_web_view_get_session_state(webview);
+
+    if (recovery->terminated) recovery->terminated(webview, reason, recovery->user_data);
+
+    if (state->reload_id) g_source_remove(state->reload_id);
+    state->reload_id = 0;
+
+    if (state->attempts > RECOVERY_MAX_ATTEMPTS) {
+        show_crash_page(state, reason);
+        return;
+    }
+
+    guint delay = MIN(RECOVERY_FIRST_DELAY_MS << (state->attempts - 1), RECOVERY_MAX_DELAY_MS);
+    state->reload_id = g_timeout_add(delay, on_reload_timeout, state);
+}
+
+Recovery *recovery_new(RecoveryTerminated terminated, gpointer user_data) {
+    Recovery *recovery = g_new0(Recovery, 1);
+    recovery->terminated = terminated;
+    recovery->user_data = user_data;
+    recovery->positions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    return recovery;
+}
+
+void recovery_add_content_manager(Recovery *recovery, WebKitUserContentManager *content_manager) {
+    WebKitUserScript *script = webkit_user_script_new(RECOVERY_SCROLL_SCRIPT, WEBKIT_USER_CONTENT_INJECT_TOP_FRAME,
+                                                      WEBKIT_USER_SCRIPT_INJECT_AT_DOCUMENT_END, NULL, NULL);
+    webkit_user_content_manager_add_script(content_manager, script);
+    webkit_user_script_unref(script);
+
+    g_signal_connect(content_manager, "script-message-received::" RECOVERY_MESSAGE_HANDLER,
+                     G_CALLBACK(on_scroll_message), recovery);
+    webkit_user_content_manager_register_script_message_handler(content_manager, RECOVERY_MESSAGE_HANDLER);
+}
+
+void recovery_watch_view(Recovery *recovery, WebKitWebView *webview) {
+    RecoveryState *state = g_new0(RecoveryState, 1);
+    state->recovery = recovery;
+    state->view = webview;
+    g_object_set_data_full(G_OBJECT(webview), RECOVERY_DATA_KEY, state, (GDestroyNotify)recovery_state_free);
+
+    g_signal_connect(webview, "web-process-terminated", G_CALLBACK(on_web_process_terminated), state);
+    g_signal_connect(webview, "load-changed", G_CALLBACK(on_load_changed), state);
+}
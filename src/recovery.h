@@ -0,0 +1,24 @@
+#ifndef LEAF_CLASS_RECOVERY_H
+#define LEAF_CLASS_RECOVERY_H
+
+#include <webkit2/webkit2.h>
+
+// Brings views back after their web process crashes or is killed for
+// using too much memory. The back/forward history lives in the UI process
+// and survives; the scroll position is reported by a small user script as
+// the page scrolls, since the page can't be asked once its process is
+// gone. The view reloads on its own, a little later each time if it keeps
+// crashing, and shows an error page after a few tries in a row. Every
+// termination is logged with its reason and added to the trace.
+typedef struct _Recovery Recovery;
+
+// Called on every termination, before the reload is scheduled
+typedef void (*RecoveryTerminated)(WebKitWebView *webview, WebKitWebProcessTerminationReason reason,
+                                   gpointer user_data);
+
+Recovery *recovery_new(RecoveryTerminated terminated, gpointer user_data);
+// Installs the scroll reporting script; views must use one of these managers
+void recovery_add_content_manager(Recovery *recovery, WebKitUserContentManager *content_manager);
+void recovery_watch_view(Recovery *recovery, WebKitWebView *webview);
+
+#endif
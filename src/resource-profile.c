@@ -0,0 +1,222 @@
+#include "resource-profile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Don't fire again while WebKit is still releasing memory from the last time
+#define MEMORY_MONITOR_COOLDOWN_SECONDS 60
+
+static const ResourceProfile profiles[] = {
+    {"minimal", WEBKIT_CACHE_MODEL_DOCUMENT_VIEWER, FALSE, 384, 96, 768},
+    {"balanced", WEBKIT_CACHE_MODEL_DOCUMENT_BROWSER, TRUE, 1024, 256, 1536},
+    {"performance", WEBKIT_CACHE_MODEL_WEB_BROWSER, TRUE, 0, 0, 0},
+};
+
+const ResourceProfile *resource_profile_lookup(const char *name) {
+    for (guint i = 0; i < G_N_ELEMENTS(profiles); i++) {
+        if (g_strcmp0(profiles[i].name, name) == 0) return &profiles[i];
+    }
+    return &profiles[1];
+}
+
+#if WEBKIT_CHECK_VERSION(2, 34, 0)
+static WebKitMemoryPressureSettings *pressure_settings_new(guint limit_mb) {
+    WebKitMemoryPressureSettings *settings = webkit_memory_pressure_settings_new();
+    webkit_memory_pressure_settings_set_memory_limit(settings, limit_mb);
+    // Start releasing caches well before the hard limit
+    webkit_memory_pressure_settings_set_conservative_threshold(settings, 0.5);
+    webkit_memory_pressure_settings_set_strict_threshold(settings, 0.75);
+    return settings;
+}
+#endif
+
+void resource_profile_apply_network(const ResourceProfile *profile) {
+#if WEBKIT_CHECK_VERSION(2, 34, 0)
+    if (profile->network_process_limit_mb == 0) return;
+
+    WebKitMemoryPressureSettings *settings = pressure_settings_new(profile->network_process_limit_mb);
+    webkit_website_data_manager_set_memory_pressure_settings(settings);
+    webkit_memory_pressure_settings_free(settings);
+#endif
+}
+
+WebKitWebContext *resource_profile_create_context(const ResourceProfile *profile, WebKitWebsiteDataManager *manager) {
+    WebKitWebContext *context;
+
+#if WEBKIT_CHECK_VERSION(2, 34, 0)
+    if (profile->web_process_limit_mb > 0) {
+        WebKitMemoryPressureSettings *settings = pressure_settings_new(profile->web_process_limit_mb);
+        context = g_object_new(WEBKIT_TYPE_WEB_CONTEXT,
+            "website-data-manager", manager,
+            "memory-pressure-settings", settings,
+            NULL);
+        webkit_memory_pressure_settings_free(settings);
+        return context;
+    }
+#endif
+
+    context = webkit_web_context_new_with_website_data_manager(manager);
+    return context;
+}
+
+void resource_profile_apply(const ResourceProfile *profile, WebKitWebContext *context, WebKitSettings *settings) {
+    webkit_web_context_set_cache_model(context, profile->cache_model);
+    webkit_settings_set_enable_page_cache(settings, profile->page_cache);
+}
+
+struct _MemoryMonitor {
+    guint64 budget;
+    MemoryMonitorCallback over_budget;
+    gpointer user_data;
+    gboolean sampling;
+    gint64 last_fired;
+};
+
+typedef struct {
+    guint64 ui;
+    guint64 web;
+    guint64 network;
+    guint web_count;
+} MemorySample;
+
+// Reads the parent pid, the (truncated) command name and the resident set
+// size from /proc/<pid>/stat
+static gboolean read_stat(const char *pid, int *ppid, char *comm, gsize comm_len, guint64 *rss_pages) {
+    char *path = g_build_filename("/proc", pid, "stat", NULL);
+    char *contents = NULL;
+    gboolean ok = FALSE;
+
+    if (g_file_get_contents(path, &contents, NULL, NULL)) {
+        // comm may contain spaces and parentheses, so split on the last ')'
+        char *open = strchr(contents, '(');
+        char *close = strrchr(contents, ')');
+        unsigned long long rss = 0;
+        if (open && close && close > open &&
+            sscanf(close + 1, " %*c %d %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %llu",
+                   ppid, &rss) == 2) {
+            g_strlcpy(comm, open + 1, MIN(comm_len, (gsize)(close - open)));
+            *rss_pages = rss;
+            ok = TRUE;
+        }
+    }
+
+    g_free(contents);
+    g_free(path);
+    return ok;
+}
+
+static void sample_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+    MemorySample *sample = g_new0(MemorySample, 1);
+    guint64 page_size = (guint64)sysconf(_SC_PAGESIZE);
+    int self = getpid();
+
+    // WebKit's auxiliary processes may sit behind a bubblewrap sandbox, so
+    // collect every descendant rather than just direct children
+    GHashTable *parents = g_hash_table_new(g_direct_hash, g_direct_equal);
+    GArray *pids = g_array_new(FALSE, FALSE, sizeof(int));
+    GPtrArray *comms = g_ptr_array_new_with_free_func(g_free);
+    GArray *rss = g_array_new(FALSE, FALSE, sizeof(guint64));
+
+    GDir *proc = g_dir_open("/proc", 0, NULL);
+    const char *name;
+    while (proc && (name = g_dir_read_name(proc)) != NULL) {
+        if (!g_ascii_isdigit(name[0])) continue;
+
+        int ppid;
+        char comm[32];
+        guint64 pages;
+        if (!read_stat(name, &ppid, comm, sizeof(comm), &pages)) continue;
+
+        int pid = atoi(name);
+        g_hash_table_insert(parents, GINT_TO_POINTER(pid), GINT_TO_POINTER(ppid));
+        g_array_append_val(pids, pid);
+        g_ptr_array_add(comms, g_strdup(comm));
+        guint64 bytes = pages * page_size;
+        g_array_append_val(rss, bytes);
+    }
+    if (proc) g_dir_close(proc);
+
+    for (guint i = 0; i < pids->len; i++) {
+        int pid = g_array_index(pids, int, i);
+        guint64 bytes = g_array_index(rss, guint64, i);
+        const char *comm = g_ptr_array_index(comms, i);
+
+        if (pid == self) {
+            sample->ui = bytes;
+            continue;
+        }
+
+        gboolean descendant = FALSE;
+        for (int p = pid, depth = 0; p > 1 && depth < 8; depth++) {
+            p = GPOINTER_TO_INT(g_hash_table_lookup(parents, GINT_TO_POINTER(p)));
+            if (p == self) {
+                descendant = TRUE;
+                break;
+            }
+        }
+        if (!descendant) continue;
+
+        // comm is truncated to 15 characters by the kernel
+        if (g_str_has_prefix(comm, "WebKitWebProces")) {
+            sample->web += bytes;
+            sample->web_count++;
+        } else if (g_str_has_prefix(comm, "WebKitNetworkPr")) {
+            sample->network += bytes;
+        }
+    }
+
+    g_array_unref(rss);
+    g_ptr_array_unref(comms);
+    g_array_unref(pids);
+    g_hash_table_unref(parents);
+
+    g_task_return_pointer(task, sample, g_free);
+}
+
+static void on_sample_ready(GObject *source, GAsyncResult *result, gpointer user_data) {
+    MemoryMonitor *monitor = user_data;
+    MemorySample *sample = g_task_propagate_pointer(G_TASK(result), NULL);
+    monitor->sampling = FALSE;
+    if (!sample) return;
+
+    guint64 total = sample->ui + sample->web + sample->network;
+    g_debug("memory: %" G_GUINT64_FORMAT " MB (ui %" G_GUINT64_FORMAT ", web %" G_GUINT64_FORMAT " in %u, network %" G_GUINT64_FORMAT ")",
+            total >> 20, sample->ui >> 20, sample->web >> 20, sample->web_count, sample->network >> 20);
+
+    gint64 now = g_get_monotonic_time();
+    if (monitor->budget > 0 && total > monitor->budget &&
+        (monitor->last_fired == 0 || now - monitor->last_fired >= MEMORY_MONITOR_COOLDOWN_SECONDS * G_USEC_PER_SEC)) {
+        monitor->last_fired = now;
+        g_message("Memory use %" G_GUINT64_FORMAT " MB is over the %" G_GUINT64_FORMAT " MB budget, releasing caches",
+                  total >> 20, monitor->budget >> 20);
+        monitor->over_budget(total, monitor->user_data);
+    }
+
+    g_free(sample);
+}
+
+static gboolean on_sample_timeout(gpointer user_data) {
+    MemoryMonitor *monitor = user_data;
+    if (monitor->sampling || monitor->budget == 0) return G_SOURCE_CONTINUE;
+
+    monitor->sampling = TRUE;
+    GTask *task = g_task_new(NULL, NULL, on_sample_ready, monitor);
+    g_task_run_in_thread(task, sample_thread);
+    g_object_unref(task);
+    return G_SOURCE_CONTINUE;
+}
+
+MemoryMonitor *memory_monitor_new(guint interval_seconds, MemoryMonitorCallback over_budget, gpointer user_data) {
+    MemoryMonitor *monitor = g_new0(MemoryMonitor, 1);
+    monitor->over_budget = over_budget;
+    monitor->user_data = user_data;
+    g_timeout_add_seconds(interval_seconds, on_sample_timeout, monitor);
+    return monitor;
+}
+
+void memory_monitor_set_budget(MemoryMonitor *monitor, guint64 budget_bytes) {
+    monitor->budget = budget_bytes;
+    monitor->last_fired = 0;
+}
@@ -0,0 +1,35 @@
+#ifndef LEAF_CLASS_RESOURCE_PROFILE_H
+#define LEAF_CLASS_RESOURCE_PROFILE_H
+
+#include <webkit2/webkit2.h>
+
+// How much memory WebKit may use. "minimal" trades speed for footprint
+// (no page cache, tight process limits), "performance" leaves WebKit's
+// defaults alone. Process limits are fixed when the context is created;
+// the cache model, page cache and budget also change live.
+typedef struct {
+    const char *name;
+    WebKitCacheModel cache_model;
+    gboolean page_cache;
+    guint web_process_limit_mb;      // 0 keeps WebKit's default
+    guint network_process_limit_mb;  // 0 keeps WebKit's default
+    guint budget_mb;                 // RSS of all processes together, 0 disables
+} ResourceProfile;
+
+const ResourceProfile *resource_profile_lookup(const char *name);
+
+// Must run before the first WebKitWebsiteDataManager is created
+void resource_profile_apply_network(const ResourceProfile *profile);
+WebKitWebContext *resource_profile_create_context(const ResourceProfile *profile, WebKitWebsiteDataManager *manager);
+void resource_profile_apply(const ResourceProfile *profile, WebKitWebContext *context, WebKitSettings *settings);
+
+// Samples the RSS of this process and its WebKit web and network processes
+// off the main thread and calls over_budget when the sum exceeds the budget,
+// at most once per cooldown period.
+typedef struct _MemoryMonitor MemoryMonitor;
+typedef void (*MemoryMonitorCallback)(guint64 rss_bytes, gpointer user_data);
+
+MemoryMonitor *memory_monitor_new(guint interval_seconds, MemoryMonitorCallback over_budget, gpointer user_data);
+void memory_monitor_set_budget(MemoryMonitor *monitor, guint64 budget_bytes);
+
+#endif
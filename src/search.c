@@ -0,0 +1,566 @@
+#include "search.h"
+
+#include <sqlite3.h>
+#include <string.h>
+
+// Extraction runs in its own script world, out of reach of page scripts
+#define SEARCH_WORLD "leaf-search"
+#define SEARCH_LAST_KEY "leaf-search-last"
+#define SEARCH_MAX_RESULTS 20
+// Pages not visited for this long drop out of the index
+#define SEARCH_FORGET_SECONDS (180LL * 24 * 60 * 60)
+
+// Bench builds also index the local stand-in pages in bench/
+#ifdef LEAF_CLASS_BENCH_BUILD
+#define SEARCH_HOSTS_PATTERN "classroom\\.google\\.com|localhost|127\\.0\\.0\\.1"
+#else
+#define SEARCH_HOSTS_PATTERN "classroom\\.google\\.com"
+#endif
+
+// Body of an async function run in Classroom pages; resolves with the
+// page's title, course, due date and text two seconds after the DOM stops
+// changing, or after ten seconds on a page that never settles
+#define SEARCH_EXTRACT_SCRIPT \
+    "const text = el => el ? el.innerText.replace(/\\s+/g, ' ').trim() : '';" \
+    "const dueDate = /\\bDue:?\\s+((?:[A-Z][a-z]{2,8}\\.?\\s+\\d{1,2}(?:,\\s*\\d{4})?|today|tomorrow)(?:,?\\s+\\d{1,2}:\\d{2}\\s*[AP]M)?)/i;" \
+    "return new Promise(resolve => {" \
+    "  let timer = 0;" \
+    "  const extract = () => {" \
+    "    observer.disconnect();" \
+    "    clearTimeout(timer);" \
+    "    clearTimeout(limit);" \
+    "    const main = document.querySelector('main, [role=\"main\"]') || document.body;" \
+    "    const body = main ? text(main).slice(0, 65536) : '';" \
+    "    const parts = document.title.split(' - ');" \
+    "    resolve({" \
+    "      title: (main && text(main.querySelector('h1, h2'))) || parts[0]," \
+    "      course: parts.length > 1 ? parts[parts.length - 1] : text(document.querySelector('header h1'))," \
+    "      due: (body.match(dueDate) || [])[1] || ''," \
+    "      body" \
+    "    });" \
+    "  };" \
+    "  const settle = () => { clearTimeout(timer); timer = setTimeout(extract, 2000); };" \
+    "  const observer = new MutationObserver(settle);" \
+    "  const limit = setTimeout(extract, 10000);" \
+    "  observer.observe(document.documentElement, {childList: true, subtree: true, characterData: true});" \
+    "  settle();" \
+    "});"
+
+#define SEARCH_SCHEMA \
+    "PRAGMA journal_mode=WAL;" \
+    "PRAGMA synchronous=NORMAL;" \
+    "CREATE TABLE IF NOT EXISTS pages(id INTEGER PRIMARY KEY, url TEXT UNIQUE NOT NULL," \
+    "  title TEXT, course TEXT, due TEXT, visited INTEGER NOT NULL);" \
+    "CREATE VIRTUAL TABLE IF NOT EXISTS pages_fts USING fts5(title, course, due, body," \
+    "  tokenize='unicode61 remove_diacritics 2');"
+
+// Snippet highlights are marked with control characters, escaped for Pango
+// and then turned into <b>
+#define SNIPPET_OPEN "\x01"
+#define SNIPPET_CLOSE "\x02"
+
+typedef enum {
+    JOB_WRITE,
+    JOB_SEARCH
+} SearchJobKind;
+
+typedef struct {
+    char *url;
+    char *title;
+    char *course;
+    char *due;
+    char *snippet;  // Pango markup
+} SearchResult;
+
+// A page being extracted; the URL it was started for
+typedef struct {
+    SearchIndex *index;
+    char *url;
+} PageRequest;
+
+typedef struct {
+    SearchJobKind kind;
+    SearchIndex *index;
+    // JOB_WRITE
+    char *url;
+    char *title;
+    char *course;
+    char *due;
+    char *body;
+    // JOB_SEARCH
+    char *query;
+    guint generation;
+    GPtrArray *results;
+} SearchJob;
+
+struct _SearchIndex {
+    char *path;
+    GThreadPool *pool;  // a single worker; owns db
+    sqlite3 *db;
+    gboolean unavailable;
+
+    SearchOpen open;
+    gpointer user_data;
+    GtkWidget *popover;
+    GtkWidget *entry;
+    GtkWidget *list;
+    GtkWidget *status;
+    guint generation;  // of the latest query; older results are dropped
+};
+
+static void search_result_free(SearchResult *result) {
+    g_free(result->url);
+    g_free(result->title);
+    g_free(result->course);
+    g_free(result->due);
+    g_free(result->snippet);
+    g_free(result);
+}
+
+static void search_job_free(SearchJob *job) {
+    g_free(job->url);
+    g_free(job->title);
+    g_free(job->course);
+    g_free(job->due);
+    g_free(job->body);
+    g_free(job->query);
+    if (job->results) g_ptr_array_unref(job->results);
+    g_free(job);
+}
+
+// --- Worker thread ---
+
+static gboolean open_db(SearchIndex *index) {
+    if (index->db) return TRUE;
+    if (index->unavailable) return FALSE;
+
+    char *error = NULL;
+    if (sqlite3_open_v2(index->path, &index->db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL) != SQLITE_OK ||
+        sqlite3_exec(index->db, SEARCH_SCHEMA, NULL, NULL, &error) != SQLITE_OK) {
+        g_warning("Search index unavailable (%s): %s", index->path, error ? error : sqlite3_errmsg(index->db));
+        sqlite3_free(error);
+        sqlite3_close(index->db);
+        index->db = NULL;
+        index->unavailable = TRUE;
+        return FALSE;
+    }
+
+    sqlite3_stmt *stmt;
+    gint64 cutoff = g_get_real_time() / G_USEC_PER_SEC - SEARCH_FORGET_SECONDS;
+    sqlite3_exec(index->db, "BEGIN", NULL, NULL, NULL);
+    if (sqlite3_prepare_v2(index->db, "DELETE FROM pages_fts WHERE rowid IN (SELECT id FROM pages WHERE visited < ?1)",
+                           -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, cutoff);
+        sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+    }
+    if (sqlite3_prepare_v2(index->db, "DELETE FROM pages WHERE visited < ?1", -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, cutoff);
+        sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_exec(index->db, "COMMIT", NULL, NULL, NULL);
+    return TRUE;
+}
+
+static gboolean exec_bound(sqlite3 *db, const char *sql, gint64 id, const char *const *texts, int n_texts) {
+    sqlite3_stmt *stmt;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) return FALSE;
+
+    int column = 1;
+    if (id >= 0) sqlite3_bind_int64(stmt, column++, id);
+    for (int i = 0; i < n_texts; i++) {
+        sqlite3_bind_text(stmt, column++, texts[i] ? texts[i] : "", -1, SQLITE_STATIC);
+    }
+
+    gboolean ok = sqlite3_step(stmt) == SQLITE_DONE;
+    sqlite3_finalize(stmt);
+    return ok;
+}
+
+static void write_page(SearchIndex *index, SearchJob *job) {
+    sqlite3 *db = index->db;
+    sqlite3_stmt *stmt;
+    gint64 id = -1;
+    gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+
+    sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+
+    if (sqlite3_prepare_v2(db, "SELECT id FROM pages WHERE url = ?1", -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, job->url, -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_ROW) id = sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+    }
+
+    if (id >= 0) {
+        exec_bound(db, "DELETE FROM pages_fts WHERE rowid = ?1", id, NULL, 0);
+    } else if (sqlite3_prepare_v2(db, "INSERT INTO pages(url, visited) VALUES (?1, 0)", -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, job->url, -1, SQLITE_STATIC);
+        if (sqlite3_step(stmt) == SQLITE_DONE) id = sqlite3_last_insert_rowid(db);
+        sqlite3_finalize(stmt);
+    }
+
+    gboolean ok = FALSE;
+    if (id >= 0 && sqlite3_prepare_v2(db, "UPDATE pages SET title = ?2, course = ?3, due = ?4, visited = ?5 WHERE id = ?1",
+                                      -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_int64(stmt, 1, id);
+        sqlite3_bind_text(stmt, 2, job->title, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 3, job->course, -1, SQLITE_STATIC);
+        sqlite3_bind_text(stmt, 4, job->due, -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 5, now);
+        ok = sqlite3_step(stmt) == SQLITE_DONE;
+        sqlite3_finalize(stmt);
+
+        const char *texts[] = {job->title, job->course, job->due, job->body};
+        ok = ok && exec_bound(db, "INSERT INTO pages_fts(rowid, title, course, due, body) VALUES (?1, ?2, ?3, ?4, ?5)",
+                              id, texts, G_N_ELEMENTS(texts));
+    }
+
+    if (ok) {
+        sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+        g_debug("search: indexed %s", job->url);
+    } else {
+        g_warning("Could not index %s: %s", job->url, sqlite3_errmsg(db));
+        sqlite3_exec(db, "ROLLBACK", NULL, NULL, NULL);
+    }
+}
+
+// Every word must match, the last one as a prefix so results follow typing.
+// Words are quoted so FTS5 syntax in the query is taken literally.
+static char *match_expression(const char *query) {
+    GString *expression = g_string_new(NULL);
+    char **words = g_strsplit_set(query, " \t\n", -1);
+
+    for (int i = 0; words[i] != NULL; i++) {
+        if (!*words[i]) continue;
+        if (expression->len) g_string_append_c(expression, ' ');
+        g_string_append_c(expression, '"');
+        for (const char *c = words[i]; *c; c++) {
+            if (*c == '"') g_string_append_c(expression, '"');
+            g_string_append_c(expression, *c);
+        }
+        g_string_append_c(expression, '"');
+    }
+    if (expression->len) g_string_append_c(expression, '*');
+
+    g_strfreev(words);
+    return g_string_free(expression, expression->len == 0);
+}
+
+// Escapes the text between the markers; g_markup_escape_text() would turn
+// the markers themselves into character references
+static char *snippet_markup(const char *snippet) {
+    GString *markup = g_string_new(NULL);
+    const char *text = snippet ? snippet : "";
+
+    while (*text) {
+        size_t length = strcspn(text, SNIPPET_OPEN SNIPPET_CLOSE);
+        char *escaped = g_markup_escape_text(text, length);
+        g_string_append(markup, escaped);
+        g_free(escaped);
+
+        text += length;
+        if (*text == SNIPPET_OPEN[0]) g_string_append(markup, "<b>");
+        if (*text == SNIPPET_CLOSE[0]) g_string_append(markup, "</b>");
+        if (*text) text++;
+    }
+
+    return g_string_free(markup, FALSE);
+}
+
+static char *column_dup(sqlite3_stmt *stmt, int column) {
+    const unsigned char *text = sqlite3_column_text(stmt, column);
+    return text && *text ? g_strdup((const char *)text) : NULL;
+}
+
+static void run_search(SearchIndex *index, SearchJob *job) {
+    char *expression = match_expression(job->query);
+    if (!expression) return;
+
+    sqlite3_stmt *stmt;
+    // Titles weigh most, then the course, then the due date and body
+    const char *sql =
+        "SELECT p.url, p.title, p.course, p.due,"
+        "  snippet(pages_fts, 3, '" SNIPPET_OPEN "', '" SNIPPET_CLOSE "', '…', 12)"
+        " FROM pages_fts JOIN pages p ON p.id = pages_fts.rowid"
+        " WHERE pages_fts MATCH ?1"
+        " ORDER BY bm25(pages_fts, 10.0, 5.0, 2.0, 1.0) LIMIT ?2";
+
+    if (sqlite3_prepare_v2(index->db, sql, -1, &stmt, NULL) == SQLITE_OK) {
+        sqlite3_bind_text(stmt, 1, expression, -1, SQLITE_STATIC);
+        sqlite3_bind_int(stmt, 2, SEARCH_MAX_RESULTS);
+        while (sqlite3_step(stmt) == SQLITE_ROW) {
+            SearchResult *result = g_new0(SearchResult, 1);
+            result->url = column_dup(stmt, 0);
+            result->title = column_dup(stmt, 1);
+            result->course = column_dup(stmt, 2);
+            result->due = column_dup(stmt, 3);
+            result->snippet = snippet_markup((const char *)sqlite3_column_text(stmt, 4));
+            g_ptr_array_add(job->results, result);
+        }
+        sqlite3_finalize(stmt);
+    }
+
+    g_free(expression);
+}
+
+static gboolean on_search_done(gpointer user_data);
+
+static void run_job(gpointer data, gpointer user_data) {
+    SearchJob *job = data;
+    SearchIndex *index = user_data;
+    gboolean available = open_db(index);
+
+    if (job->kind == JOB_WRITE) {
+        if (available) write_page(index, job);
+        search_job_free(job);
+        return;
+    }
+
+    job->results = g_ptr_array_new_with_free_func((GDestroyNotify)search_result_free);
+    if (available) run_search(index, job);
+    g_idle_add(on_search_done, job);
+}
+
+// --- Indexing ---
+
+static char *property_string(JSCValue *object, const char *name) {
+    JSCValue *value = jsc_value_object_get_property(object, name);
+    char *string = jsc_value_is_string(value) ? jsc_value_to_string(value) : NULL;
+    g_object_unref(value);
+    return string;
+}
+
+// Only Classroom pages are indexed; anything else (javascript:, file:,
+// other sites) could be opened from a result later
+static gboolean is_indexable(const char *url) {
+    GUri *uri = url ? g_uri_parse(url, G_URI_FLAGS_NONE, NULL) : NULL;
+    if (!uri) return FALSE;
+
+    const char *scheme = g_uri_get_scheme(uri);
+    const char *host = g_uri_get_host(uri);
+    gboolean indexable = g_strcmp0(scheme, "https") == 0 && g_strcmp0(host, "classroom.google.com") == 0;
+#ifdef LEAF_CLASS_BENCH_BUILD
+    indexable = indexable || ((g_strcmp0(scheme, "http") == 0 || g_strcmp0(scheme, "https") == 0) &&
+                              (g_strcmp0(host, "localhost") == 0 || g_strcmp0(host, "127.0.0.1") == 0));
+#endif
+
+    g_uri_unref(uri);
+    return indexable;
+}
+
+static void on_page_extracted(GObject *object, GAsyncResult *result, gpointer user_data) {
+    WebKitWebView *webview = WEBKIT_WEB_VIEW(object);
+    PageRequest *request = user_data;
+    GError *error = NULL;
+    JSCValue *value = webkit_web_view_call_async_javascript_function_finish(webview, result, &error);
+
+    // The URL is the view's, never the page's word; a page that navigated
+    // meanwhile has been asked again
+    const char *url = webkit_web_view_get_uri(webview);
+    if (value && jsc_value_is_object(value) && g_strcmp0(url, request->url) == 0) {
+        SearchJob *job = g_new0(SearchJob, 1);
+        job->kind = JOB_WRITE;
+        job->index = request->index;
+        job->url = g_strdup(url);
+        job->title = property_string(value, "title");
+        job->course = property_string(value, "course");
+        job->due = property_string(value, "due");
+        job->body = property_string(value, "body");
+
+        // Skip a page that hasn't changed since it was last written
+        char *key = g_strdup_printf("%s %zu", url, job->body ? strlen(job->body) : 0);
+        if (job->body && *job->body && g_strcmp0(key, g_object_get_data(G_OBJECT(webview), SEARCH_LAST_KEY)) != 0) {
+            g_object_set_data_full(G_OBJECT(webview), SEARCH_LAST_KEY, key, g_free);
+            g_thread_pool_push(request->index->pool, job, NULL);
+        } else {
+            g_free(key);
+            search_job_free(job);
+        }
+    } else if (error) {
+        g_debug("search: could not extract %s: %s", request->url, error->message);
+    }
+
+    if (value) g_object_unref(value);
+    if (error) g_error_free(error);
+    g_free(request->url);
+    g_free(request);
+}
+
+SearchIndex *search_index_new(const char *data_dir) {
+    SearchIndex *index = g_new0(SearchIndex, 1);
+    index->path = g_build_filename(data_dir, "search.db", NULL);
+    index->pool = g_thread_pool_new(run_job, index, 1, FALSE, NULL);
+    return index;
+}
+
+void search_index_page_changed(SearchIndex *index, WebKitWebView *webview) {
+    const char *url = webkit_web_view_get_uri(webview);
+    if (!is_indexable(url)) return;
+
+    PageRequest *request = g_new0(PageRequest, 1);
+    request->index = index;
+    request->url = g_strdup(url);
+    webkit_web_view_call_async_javascript_function(webview, SEARCH_EXTRACT_SCRIPT, -1, NULL, SEARCH_WORLD, NULL,
+                                                   NULL, on_page_extracted, request);
+}
+
+// --- Search popover ---
+
+static GtkWidget *result_row(const SearchResult *result) {
+    GtkWidget *row = gtk_list_box_row_new();
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 2);
+    g_object_set(box, "margin", 6, NULL);
+    gtk_container_add(GTK_CONTAINER(row), box);
+    g_object_set_data_full(G_OBJECT(row), "leaf-url", g_strdup(result->url), g_free);
+
+    char *title = g_markup_printf_escaped("<b>%s</b>", result->title ? result->title : result->url);
+    GtkWidget *title_label = gtk_label_new(NULL);
+    gtk_label_set_markup(GTK_LABEL(title_label), title);
+    gtk_label_set_xalign(GTK_LABEL(title_label), 0);
+    gtk_label_set_ellipsize(GTK_LABEL(title_label), PANGO_ELLIPSIZE_END);
+    gtk_box_pack_start(GTK_BOX(box), title_label, FALSE, FALSE, 0);
+    g_free(title);
+
+    GString *meta = g_string_new(result->course ? result->course : "");
+    if (result->due) g_string_append_printf(meta, "%sDue %s", meta->len ? " · " : "", result->due);
+    if (meta->len) {
+        GtkWidget *meta_label = gtk_label_new(meta->str);
+        gtk_label_set_xalign(GTK_LABEL(meta_label), 0);
+        gtk_label_set_ellipsize(GTK_LABEL(meta_label), PANGO_ELLIPSIZE_END);
+        gtk_style_context_add_class(gtk_widget_get_style_context(meta_label), "dim-label");
+        gtk_box_pack_start(GTK_BOX(box), meta_label, FALSE, FALSE, 0);
+    }
+    g_string_free(meta, TRUE);
+
+    GtkWidget *snippet_label = gtk_label_new(NULL);
+    gtk_label_set_markup(GTK_LABEL(snippet_label), result->snippet);
+    gtk_label_set_xalign(GTK_LABEL(snippet_label), 0);
+    gtk_label_set_line_wrap(GTK_LABEL(snippet_label), TRUE);
+    gtk_label_set_lines(GTK_LABEL(snippet_label), 2);
+    gtk_label_set_ellipsize(GTK_LABEL(snippet_label), PANGO_ELLIPSIZE_END);
+    gtk_label_set_max_width_chars(GTK_LABEL(snippet_label), 60);
+    gtk_box_pack_start(GTK_BOX(box), snippet_label, FALSE, FALSE, 0);
+
+    gtk_widget_show_all(row);
+    return row;
+}
+
+static gboolean on_search_done(gpointer user_data) {
+    SearchJob *job = user_data;
+    SearchIndex *index = job->index;
+
+    if (job->generation == index->generation) {
+        gtk_container_foreach(GTK_CONTAINER(index->list), (GtkCallback)gtk_widget_destroy, NULL);
+        for (guint i = 0; i < job->results->len; i++) {
+            gtk_container_add(GTK_CONTAINER(index->list), result_row(g_ptr_array_index(job->results, i)));
+        }
+
+        GtkListBoxRow *first = gtk_list_box_get_row_at_index(GTK_LIST_BOX(index->list), 0);
+        if (first) gtk_list_box_select_row(GTK_LIST_BOX(index->list), first);
+        gtk_label_set_text(GTK_LABEL(index->status),
+                           index->unavailable ? "Search is unavailable; see the log for details" :
+                           job->results->len ? "" : "No visited pages match");
+        gtk_widget_set_visible(index->status, index->unavailable || job->results->len == 0);
+    }
+
+    search_job_free(job);
+    return G_SOURCE_REMOVE;
+}
+
+static void on_search_changed(GtkSearchEntry *entry, gpointer user_data) {
+    SearchIndex *index = user_data;
+    const char *query = gtk_entry_get_text(GTK_ENTRY(entry));
+
+    index->generation++;
+    if (strspn(query, " \t\n") == strlen(query)) {
+        gtk_container_foreach(GTK_CONTAINER(index->list), (GtkCallback)gtk_widget_destroy, NULL);
+        gtk_label_set_text(GTK_LABEL(index->status), "Search the pages you have visited");
+        gtk_widget_show(index->status);
+        return;
+    }
+
+    SearchJob *job = g_new0(SearchJob, 1);
+    job->kind = JOB_SEARCH;
+    job->index = index;
+    job->query = g_strdup(query);
+    job->generation = index->generation;
+    g_thread_pool_push(index->pool, job, NULL);
+}
+
+static void open_row(SearchIndex *index, GtkListBoxRow *row) {
+    const char *url = row ? g_object_get_data(G_OBJECT(row), "leaf-url") : NULL;
+    if (!url) return;
+
+    char *target = g_strdup(url);
+    gtk_popover_popdown(GTK_POPOVER(index->popover));
+    index->open(target, index->user_data);
+    g_free(target);
+}
+
+static void on_row_activated(GtkListBox *list, GtkListBoxRow *row, gpointer user_data) {
+    open_row(user_data, row);
+}
+
+static void on_search_activate(GtkEntry *entry, gpointer user_data) {
+    SearchIndex *index = user_data;
+    open_row(index, gtk_list_box_get_selected_row(GTK_LIST_BOX(index->list)));
+}
+
+// Up and Down move through the results while typing
+static gboolean on_search_key_press(GtkWidget *widget, GdkEventKey *event, gpointer user_data) {
+    SearchIndex *index = user_data;
+    if (event->keyval != GDK_KEY_Down && event->keyval != GDK_KEY_Up) return FALSE;
+
+    GtkListBoxRow *selected = gtk_list_box_get_selected_row(GTK_LIST_BOX(index->list));
+    int position = selected ? gtk_list_box_row_get_index(selected) : -1;
+    position += event->keyval == GDK_KEY_Down ? 1 : -1;
+
+    GtkListBoxRow *row = gtk_list_box_get_row_at_index(GTK_LIST_BOX(index->list), MAX(position, 0));
+    if (row) gtk_list_box_select_row(GTK_LIST_BOX(index->list), row);
+    return TRUE;
+}
+
+void search_index_attach(SearchIndex *index, GtkWidget *relative_to, SearchOpen open, gpointer user_data) {
+    index->open = open;
+    index->user_data = user_data;
+
+    index->popover = gtk_popover_new(relative_to);
+    gtk_popover_set_position(GTK_POPOVER(index->popover), GTK_POS_BOTTOM);
+
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 6);
+    g_object_set(box, "margin", 8, NULL);
+    gtk_container_add(GTK_CONTAINER(index->popover), box);
+
+    index->entry = gtk_search_entry_new();
+    gtk_entry_set_placeholder_text(GTK_ENTRY(index->entry), "Search visited pages");
+    g_signal_connect(index->entry, "search-changed", G_CALLBACK(on_search_changed), index);
+    g_signal_connect(index->entry, "activate", G_CALLBACK(on_search_activate), index);
+    g_signal_connect(index->entry, "key-press-event", G_CALLBACK(on_search_key_press), index);
+    gtk_box_pack_start(GTK_BOX(box), index->entry, FALSE, FALSE, 0);
+
+    index->status = gtk_label_new("Search the pages you have visited");
+    gtk_style_context_add_class(gtk_widget_get_style_context(index->status), "dim-label");
+    gtk_box_pack_start(GTK_BOX(box), index->status, FALSE, FALSE, 0);
+
+    GtkWidget *scrolled = gtk_scrolled_window_new(NULL, NULL);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+    gtk_scrolled_window_set_propagate_natural_height(GTK_SCROLLED_WINDOW(scrolled), TRUE);
+    gtk_scrolled_window_set_max_content_height(GTK_SCROLLED_WINDOW(scrolled), 420);
+    gtk_widget_set_size_request(scrolled, 480, -1);
+    index->list = gtk_list_box_new();
+    gtk_list_box_set_selection_mode(GTK_LIST_BOX(index->list), GTK_SELECTION_BROWSE);
+    gtk_list_box_set_activate_on_single_click(GTK_LIST_BOX(index->list), TRUE);
+    g_signal_connect(index->list, "row-activated", G_CALLBACK(on_row_activated), index);
+    gtk_container_add(GTK_CONTAINER(scrolled), index->list);
+    gtk_box_pack_start(GTK_BOX(box), scrolled, TRUE, TRUE, 0);
+
+    gtk_widget_show_all(box);
+}
+
+void search_index_show(SearchIndex *index) {
+    if (!index->popover) return;
+    gtk_popover_popup(GTK_POPOVER(index->popover));
+    gtk_widget_grab_focus(index->entry);
+    gtk_editable_select_region(GTK_EDITABLE(index->entry), 0, -1);
+}
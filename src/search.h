@@ -0,0 +1,27 @@
+#ifndef LEAF_CLASS_SEARCH_H
+#define LEAF_CLASS_SEARCH_H
+
+#include <gtk/gtk.h>
+#include <webkit2/webkit2.h>
+
+// Full-text index of visited Classroom pages. After each load or in-page
+// navigation, a script in a private script world pulls the title, course,
+// due date and text out of the page once it settles; the page is indexed
+// under the view's own URI, so page scripts can neither see the extractor
+// nor forge entries. Pages are written to an SQLite FTS5 database
+// (<data_dir>/search.db) on a worker thread, which also runs the searches.
+// The search box is a popover under the URL entry.
+typedef struct _SearchIndex SearchIndex;
+
+typedef void (*SearchOpen)(const char *url, gpointer user_data);
+
+SearchIndex *search_index_new(const char *data_dir);
+// Call when a page finishes loading or its URI changes
+void search_index_page_changed(SearchIndex *index, WebKitWebView *webview);
+
+// Builds the search popover pointing at relative_to; open gets the URL of
+// the chosen result
+void search_index_attach(SearchIndex *index, GtkWidget *relative_to, SearchOpen open, gpointer user_data);
+void search_index_show(SearchIndex *index);
+
+#endif
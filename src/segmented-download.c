@@ -0,0 +1,511 @@
+#include "segmented-download.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#define SEGMENT_MIN_SIZE (4 * 1024 * 1024)
+#define SEGMENT_MAX_COUNT 4
+#define SEGMENT_BUFFER_SIZE (64 * 1024)
+#define SEGMENT_MAX_ATTEMPTS 5
+#define JOURNAL_SAVE_INTERVAL_SECONDS 2
+#define JOURNAL_GROUP "Journal"
+
+typedef struct {
+    SegmentedDownload *owner;
+    guint64 start;
+    guint64 end;   // inclusive
+    guint64 done;  // bytes written from start
+    guint attempts;
+    SoupMessage *message;
+    GInputStream *stream;
+    guint retry_id;
+    guint8 buffer[SEGMENT_BUFFER_SIZE];
+} Segment;
+
+struct _SegmentedDownload {
+    gint ref_count;
+    SoupSession *session;
+    char *source;  // identifies the download in the journal
+    char *uri;     // fetched; may be a short-lived redirect target
+    char *path;
+    char *part_path;
+    char *journal_path;
+    guint64 total;
+    char *validator;
+
+    GPtrArray *segments;
+    int fd;
+    GCancellable *cancellable;
+    gboolean stopped;
+    gboolean journal_obsolete;  // completed or discarded; late async writes must not resurrect it
+
+    guint journal_id;
+    gboolean journal_writing;
+
+    SegmentedDownloadProgressFunc progress;
+    SegmentedDownloadDoneFunc done;
+    gpointer user_data;
+};
+
+static void segment_request(Segment *segment);
+static void on_segment_read(GObject *object, GAsyncResult *result, gpointer user_data);
+
+SoupSession *segmented_download_session_new(const char *cookie_file, const char *user_agent) {
+    SoupSession *session = soup_session_new_with_options(
+        "user-agent", user_agent,
+        "max-conns-per-host", SEGMENT_MAX_COUNT,
+        NULL);
+
+    if (cookie_file) {
+        // WebKit keeps writing to this database; only read from it
+        SoupCookieJar *jar = soup_cookie_jar_db_new(cookie_file, TRUE);
+        soup_session_add_feature(session, SOUP_SESSION_FEATURE(jar));
+        g_object_unref(jar);
+    }
+    return session;
+}
+
+static gboolean segment_complete(Segment *segment) {
+    return segment->start + segment->done > segment->end;
+}
+
+static guint64 received_bytes(SegmentedDownload *download) {
+    guint64 received = 0;
+    for (guint i = 0; i < download->segments->len; i++) {
+        Segment *segment = g_ptr_array_index(download->segments, i);
+        received += segment->done;
+    }
+    return received;
+}
+
+static void add_segment(SegmentedDownload *download, guint64 start, guint64 end, guint64 done) {
+    Segment *segment = g_new0(Segment, 1);
+    segment->owner = download;
+    segment->start = start;
+    segment->end = end;
+    segment->done = MIN(done, end - start + 1);
+    g_ptr_array_add(download->segments, segment);
+}
+
+static GKeyFile *journal_to_key_file(SegmentedDownload *download) {
+    GKeyFile *key_file = g_key_file_new();
+    GPtrArray *ranges = g_ptr_array_new_with_free_func(g_free);
+
+    g_key_file_set_string(key_file, JOURNAL_GROUP, "URL", download->source);
+    g_key_file_set_uint64(key_file, JOURNAL_GROUP, "Total", download->total);
+    g_key_file_set_string(key_file, JOURNAL_GROUP, "Validator", download->validator ? download->validator : "");
+
+    for (guint i = 0; i < download->segments->len; i++) {
+        Segment *segment = g_ptr_array_index(download->segments, i);
+        g_ptr_array_add(ranges, g_strdup_printf("%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT,
+                                                segment->start, segment->end, segment->done));
+    }
+    g_key_file_set_string_list(key_file, JOURNAL_GROUP, "Segments",
+                               (const gchar *const *)ranges->pdata, ranges->len);
+
+    g_ptr_array_free(ranges, TRUE);
+    return key_file;
+}
+
+// Restores segment progress if the journal describes this exact resource
+static gboolean journal_load(SegmentedDownload *download) {
+    GKeyFile *key_file = g_key_file_new();
+    gboolean loaded = FALSE;
+
+    if (g_key_file_load_from_file(key_file, download->journal_path, G_KEY_FILE_NONE, NULL) &&
+        g_file_test(download->part_path, G_FILE_TEST_EXISTS)) {
+        char *uri = g_key_file_get_string(key_file, JOURNAL_GROUP, "URL", NULL);
+        char *validator = g_key_file_get_string(key_file, JOURNAL_GROUP, "Validator", NULL);
+        guint64 total = g_key_file_get_uint64(key_file, JOURNAL_GROUP, "Total", NULL);
+        gsize count = 0;
+        gchar **ranges = g_key_file_get_string_list(key_file, JOURNAL_GROUP, "Segments", &count, NULL);
+
+        if (g_strcmp0(uri, download->source) == 0 && total == download->total &&
+            g_strcmp0(validator, download->validator ? download->validator : "") == 0 && count > 0) {
+            loaded = TRUE;
+            for (gsize i = 0; i < count && loaded; i++) {
+                guint64 start, end, done;
+                if (sscanf(ranges[i], "%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT ":%" G_GUINT64_FORMAT,
+                           &start, &end, &done) == 3 && start <= end && end < total) {
+                    add_segment(download, start, end, done);
+                } else {
+                    loaded = FALSE;
+                }
+            }
+            if (!loaded) g_ptr_array_set_size(download->segments, 0);
+        }
+
+        g_strfreev(ranges);
+        g_free(validator);
+        g_free(uri);
+    }
+
+    g_key_file_free(key_file);
+    return loaded;
+}
+
+static void on_journal_written(GObject *object, GAsyncResult *result, gpointer user_data) {
+    SegmentedDownload *download = user_data;
+    g_file_replace_contents_finish(G_FILE(object), result, NULL, NULL);
+    download->journal_writing = FALSE;
+    if (download->journal_obsolete) g_unlink(download->journal_path);
+    segmented_download_unref(download);
+}
+
+static gboolean journal_save(gpointer user_data) {
+    SegmentedDownload *download = user_data;
+    download->journal_id = 0;
+
+    // Progress since an in-flight write is picked up by the next tick
+    if (download->journal_writing || download->stopped) return G_SOURCE_REMOVE;
+    download->journal_writing = TRUE;
+
+    GKeyFile *key_file = journal_to_key_file(download);
+    gsize length;
+    char *data = g_key_file_to_data(key_file, &length, NULL);
+    GBytes *bytes = g_bytes_new_take(data, length);
+    GFile *file = g_file_new_for_path(download->journal_path);
+
+    g_file_replace_contents_bytes_async(file, bytes, NULL, FALSE, G_FILE_CREATE_PRIVATE, NULL,
+                                        on_journal_written, segmented_download_ref(download));
+
+    g_object_unref(file);
+    g_bytes_unref(bytes);
+    g_key_file_free(key_file);
+    return G_SOURCE_REMOVE;
+}
+
+static void journal_schedule(SegmentedDownload *download) {
+    if (download->journal_id || download->stopped) return;
+    download->journal_id = g_timeout_add_seconds(JOURNAL_SAVE_INTERVAL_SECONDS, journal_save, download);
+}
+
+// Synchronous final write so the journal on disk matches the part file
+static void journal_flush(SegmentedDownload *download) {
+    GKeyFile *key_file = journal_to_key_file(download);
+    g_key_file_save_to_file(key_file, download->journal_path, NULL);
+    g_key_file_free(key_file);
+}
+
+static void segment_reset(Segment *segment) {
+    if (segment->retry_id) {
+        g_source_remove(segment->retry_id);
+        segment->retry_id = 0;
+        segmented_download_unref(segment->owner);
+    }
+    g_clear_object(&segment->stream);
+    g_clear_object(&segment->message);
+}
+
+static void stop(SegmentedDownload *download) {
+    download->stopped = TRUE;
+    g_cancellable_cancel(download->cancellable);
+
+    if (download->journal_id) {
+        g_source_remove(download->journal_id);
+        download->journal_id = 0;
+    }
+    for (guint i = 0; i < download->segments->len; i++) {
+        segment_reset(g_ptr_array_index(download->segments, i));
+    }
+    if (download->fd >= 0) {
+        close(download->fd);
+        download->fd = -1;
+    }
+}
+
+static void finish(SegmentedDownload *download, GError *error) {
+    if (download->stopped) return;
+
+    stop(download);
+
+    // A complete part file that can't be renamed keeps its journal, so a
+    // retry finds every segment done and only renames
+    GError *rename_error = NULL;
+    if (!error && g_rename(download->part_path, download->path) != 0) {
+        rename_error = g_error_new(G_IO_ERROR, g_io_error_from_errno(errno), "Could not move %s into place: %s",
+                                   download->part_path, g_strerror(errno));
+        error = rename_error;
+    }
+
+    if (error) {
+        journal_flush(download);
+    } else {
+        download->journal_obsolete = TRUE;
+        g_unlink(download->journal_path);
+    }
+    download->done(download, error, download->user_data);
+    if (rename_error) g_error_free(rename_error);
+}
+
+static gboolean on_segment_retry(gpointer user_data) {
+    Segment *segment = user_data;
+    segment->retry_id = 0;
+    segment_request(segment);
+    segmented_download_unref(segment->owner);
+    return G_SOURCE_REMOVE;
+}
+
+static void segment_fail(Segment *segment, GError *error) {
+    SegmentedDownload *download = segment->owner;
+
+    g_clear_object(&segment->stream);
+    g_clear_object(&segment->message);
+
+    if (download->stopped || g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_error_free(error);
+        return;
+    }
+
+    if (++segment->attempts < SEGMENT_MAX_ATTEMPTS) {
+        guint delay = 1u << (segment->attempts - 1);
+        g_debug("segmented-download: %s segment %" G_GUINT64_FORMAT " failed (%s), retrying in %us",
+                download->uri, segment->start, error->message, delay);
+        segmented_download_ref(download);
+        segment->retry_id = g_timeout_add_seconds(delay, on_segment_retry, segment);
+        g_error_free(error);
+        return;
+    }
+
+    finish(download, error);
+    g_error_free(error);
+}
+
+static void segment_finished(Segment *segment) {
+    SegmentedDownload *download = segment->owner;
+    gboolean all_complete = TRUE;
+
+    g_clear_object(&segment->stream);
+    g_clear_object(&segment->message);
+
+    for (guint i = 0; i < download->segments->len && all_complete; i++) {
+        all_complete = segment_complete(g_ptr_array_index(download->segments, i));
+    }
+    if (all_complete) finish(download, NULL);
+}
+
+static void segment_read_next(Segment *segment) {
+    SegmentedDownload *download = segment->owner;
+    g_input_stream_read_async(segment->stream, segment->buffer, SEGMENT_BUFFER_SIZE, G_PRIORITY_DEFAULT,
+                              download->cancellable, on_segment_read, segment);
+    segmented_download_ref(download);
+}
+
+static gboolean segment_write(Segment *segment, gsize length) {
+    SegmentedDownload *download = segment->owner;
+    guint64 offset = segment->start + segment->done;
+    // Some servers keep sending past the requested range; drop the excess
+    gsize remaining = MIN((guint64)length, segment->end - offset + 1);
+    const guint8 *data = segment->buffer;
+
+    while (remaining > 0) {
+        ssize_t written = pwrite(download->fd, data, remaining, offset);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            // Disk errors are not worth retrying
+            GError *error = g_error_new(G_IO_ERROR, g_io_error_from_errno(errno), "Could not write %s: %s",
+                                        download->part_path, g_strerror(errno));
+            finish(download, error);
+            g_error_free(error);
+            return FALSE;
+        }
+        data += written;
+        offset += written;
+        remaining -= written;
+        segment->done += written;
+    }
+    return TRUE;
+}
+
+static void on_segment_read(GObject *object, GAsyncResult *result, gpointer user_data) {
+    Segment *segment = user_data;
+    SegmentedDownload *download = segment->owner;
+    GError *error = NULL;
+    gssize length = g_input_stream_read_finish(G_INPUT_STREAM(object), result, &error);
+
+    if (download->stopped) {
+        g_clear_error(&error);
+    } else if (length < 0) {
+        segment_fail(segment, error);
+    } else if (length == 0) {
+        segment_fail(segment, g_error_new_literal(G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED,
+                                                  "Connection closed before the segment was complete"));
+    } else if (segment_write(segment, length)) {
+        // Data is flowing again, so the next failure starts a fresh backoff
+        segment->attempts = 0;
+        journal_schedule(download);
+        download->progress(download, received_bytes(download), download->total, download->user_data);
+
+        if (segment_complete(segment)) {
+            segment_finished(segment);
+        } else {
+            segment_read_next(segment);
+        }
+    }
+
+    segmented_download_unref(download);
+}
+
+static void on_segment_response(GObject *object, GAsyncResult *result, gpointer user_data) {
+    Segment *segment = user_data;
+    SegmentedDownload *download = segment->owner;
+    GError *error = NULL;
+    GInputStream *stream = soup_session_send_finish(SOUP_SESSION(object), result, &error);
+
+    if (download->stopped) {
+        g_clear_error(&error);
+        g_clear_object(&stream);
+        segmented_download_unref(download);
+        return;
+    }
+
+    if (!stream) {
+        segment_fail(segment, error);
+        segmented_download_unref(download);
+        return;
+    }
+
+    SoupMessageHeaders *headers = soup_message_get_response_headers(segment->message);
+    goffset range_start = -1, range_end = -1, range_total = -1;
+    guint status = soup_message_get_status(segment->message);
+
+    // 200 instead of 206 means the server ignored the range or If-Range no
+    // longer matches (the file changed); either way the bytes can't be placed
+    if (status != SOUP_STATUS_PARTIAL_CONTENT ||
+        !soup_message_headers_get_content_range(headers, &range_start, &range_end, &range_total) ||
+        (guint64)range_start != segment->start + segment->done) {
+        g_object_unref(stream);
+        GError *range_error = g_error_new(G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                                          "Server did not honour the byte range (HTTP %u)", status);
+        if (status == SOUP_STATUS_OK || status == SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE) {
+            g_clear_object(&segment->message);
+            finish(download, range_error);
+            g_error_free(range_error);
+        } else {
+            segment_fail(segment, range_error);
+        }
+        segmented_download_unref(download);
+        return;
+    }
+
+    segment->stream = stream;
+    segment_read_next(segment);
+    segmented_download_unref(download);
+}
+
+static void segment_request(Segment *segment) {
+    SegmentedDownload *download = segment->owner;
+
+    segment->message = soup_message_new("GET", download->uri);
+    SoupMessageHeaders *headers = soup_message_get_request_headers(segment->message);
+    soup_message_headers_set_range(headers, segment->start + segment->done, segment->end);
+    if (download->validator) soup_message_headers_replace(headers, "If-Range", download->validator);
+
+    soup_session_send_async(download->session, segment->message, G_PRIORITY_DEFAULT, download->cancellable,
+                            on_segment_response, segment);
+    segmented_download_ref(download);
+}
+
+SegmentedDownload *segmented_download_new(SoupSession *session, const char *source, const char *uri,
+                                          const char *path, guint64 total, const char *validator) {
+    SegmentedDownload *download = g_new0(SegmentedDownload, 1);
+    download->ref_count = 1;
+    download->session = g_object_ref(session);
+    download->source = g_strdup(source);
+    download->uri = g_strdup(uri);
+    download->path = g_strdup(path);
+    download->part_path = g_strconcat(path, ".part", NULL);
+    download->journal_path = g_strconcat(path, ".part.journal", NULL);
+    download->total = total;
+    download->validator = validator && *validator ? g_strdup(validator) : NULL;
+    download->segments = g_ptr_array_new_with_free_func(g_free);
+    download->fd = -1;
+    download->cancellable = g_cancellable_new();
+    return download;
+}
+
+SegmentedDownload *segmented_download_ref(SegmentedDownload *download) {
+    g_atomic_int_inc(&download->ref_count);
+    return download;
+}
+
+void segmented_download_unref(SegmentedDownload *download) {
+    if (!g_atomic_int_dec_and_test(&download->ref_count)) return;
+
+    if (!download->stopped) stop(download);
+    g_ptr_array_free(download->segments, TRUE);
+    g_object_unref(download->cancellable);
+    g_object_unref(download->session);
+    g_free(download->validator);
+    g_free(download->journal_path);
+    g_free(download->part_path);
+    g_free(download->path);
+    g_free(download->uri);
+    g_free(download->source);
+    g_free(download);
+}
+
+void segmented_download_start(SegmentedDownload *download,
+                              SegmentedDownloadProgressFunc progress,
+                              SegmentedDownloadDoneFunc done,
+                              gpointer user_data) {
+    download->progress = progress;
+    download->done = done;
+    download->user_data = user_data;
+
+    // The done callback may drop the caller's reference before we return
+    segmented_download_ref(download);
+
+    if (journal_load(download)) {
+        g_debug("segmented-download: resuming %s at %" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT,
+                download->uri, received_bytes(download), download->total);
+    } else {
+        guint count = CLAMP(download->total / SEGMENT_MIN_SIZE, 1, SEGMENT_MAX_COUNT);
+        guint64 size = download->total / count;
+        for (guint i = 0; i < count; i++) {
+            guint64 start = i * size;
+            guint64 end = i == count - 1 ? download->total - 1 : start + size - 1;
+            add_segment(download, start, end, 0);
+        }
+        g_unlink(download->part_path);
+    }
+
+    download->fd = g_open(download->part_path, O_RDWR | O_CREAT, 0600);
+    if (download->fd < 0 || ftruncate(download->fd, download->total) != 0) {
+        GError *error = g_error_new(G_IO_ERROR, g_io_error_from_errno(errno), "Could not create %s: %s",
+                                    download->part_path, g_strerror(errno));
+        finish(download, error);
+        g_error_free(error);
+        segmented_download_unref(download);
+        return;
+    }
+
+    journal_flush(download);
+    download->progress(download, received_bytes(download), download->total, download->user_data);
+
+    for (guint i = 0; i < download->segments->len; i++) {
+        Segment *segment = g_ptr_array_index(download->segments, i);
+        if (!segment_complete(segment)) segment_request(segment);
+    }
+
+    // Everything was already on disk from an earlier run
+    if (received_bytes(download) >= download->total) finish(download, NULL);
+
+    segmented_download_unref(download);
+}
+
+void segmented_download_cancel(SegmentedDownload *download, gboolean discard) {
+    if (download->stopped) return;
+
+    stop(download);
+    if (discard) {
+        download->journal_obsolete = TRUE;
+        g_unlink(download->part_path);
+        g_unlink(download->journal_path);
+    } else {
+        journal_flush(download);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef LEAF_CLASS_SEGMENTED_DOWNLOAD_H
+#define LEAF_CLASS_SEGMENTED_DOWNLOAD_H
+
+#include <libsoup/soup.h>
+
+// Native download engine for large files on servers that accept byte
+// ranges. The file is split into parallel HTTP Range segments written into
+// "<path>.part", with progress recorded in a "<path>.part.journal" sidecar
+// so an interrupted transfer resumes where it stopped instead of starting
+// over. Segments retry with exponential backoff before giving up.
+typedef struct _SegmentedDownload SegmentedDownload;
+
+typedef void (*SegmentedDownloadProgressFunc)(SegmentedDownload *download, guint64 received, guint64 total, gpointer user_data);
+typedef void (*SegmentedDownloadDoneFunc)(SegmentedDownload *download, const GError *error, gpointer user_data);
+
+// Session sharing the browser's persistent cookies (read-only) so
+// authenticated Drive and Classroom URLs work outside the web view
+SoupSession *segmented_download_session_new(const char *cookie_file, const char *user_agent);
+
+// source is the URL the download was requested from and uri the one to
+// fetch, e.g. the signed link it redirected to, which changes on every
+// request. The journal is keyed by source, total and validator, so a retry
+// through a fresh redirect still resumes. validator is the response's ETag
+// or Last-Modified and is sent as If-Range.
+SegmentedDownload *segmented_download_new(SoupSession *session, const char *source, const char *uri,
+                                          const char *path, guint64 total, const char *validator);
+SegmentedDownload *segmented_download_ref(SegmentedDownload *download);
+void segmented_download_unref(SegmentedDownload *download);
+
+void segmented_download_start(SegmentedDownload *download,
+                              SegmentedDownloadProgressFunc progress,
+                              SegmentedDownloadDoneFunc done,
+                              gpointer user_data);
+
+// Stops all segments; with discard the partial file and journal are removed,
+// otherwise they are kept for a later resume. The done callback is not called.
+void segmented_download_cancel(SegmentedDownload *download, gboolean discard);
+
+#endif
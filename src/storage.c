@@ -0,0 +1,660 @@
+#include "storage.h"
+
+#include "config-store.h"
+
+#include <glib/gstdio.h>
+#include <libsoup/soup.h>
+#include <string.h>
+
+#define STORAGE_FIRST_CHECK_SECONDS 30
+#define STORAGE_CHECK_INTERVAL_SECONDS (30 * 60)
+#define STORAGE_SITES_SAVE_DELAY_MS 5000
+// Sites removed per round before usage is measured again; WebKit only
+// reports per-site sizes for the disk cache
+#define STORAGE_EVICT_BATCH 8
+#define STORAGE_MAX_ROUNDS 16
+// Sites with no data left are forgotten after this long
+#define STORAGE_FORGET_SECONDS (90 * 24 * 60 * 60)
+#define STORAGE_DIAGNOSTICS_MAX_SITES 200
+
+#define STORAGE_TYPES (WEBKIT_WEBSITE_DATA_DISK_CACHE | WEBKIT_WEBSITE_DATA_LOCAL_STORAGE | \
+                       WEBKIT_WEBSITE_DATA_INDEXEDDB_DATABASES | WEBKIT_WEBSITE_DATA_SERVICE_WORKER_REGISTRATIONS)
+
+typedef enum {
+    KIND_DISK_CACHE,
+    KIND_LOCAL_STORAGE,
+    KIND_INDEXEDDB,
+    KIND_SERVICE_WORKERS,
+    N_KINDS
+} StorageKind;
+
+static const struct {
+    const char *label;
+    WebKitWebsiteDataTypes type;
+} kinds[N_KINDS] = {
+    {"Disk cache", WEBKIT_WEBSITE_DATA_DISK_CACHE},
+    {"Local storage", WEBKIT_WEBSITE_DATA_LOCAL_STORAGE},
+    {"IndexedDB", WEBKIT_WEBSITE_DATA_INDEXEDDB_DATABASES},
+    {"Service workers", WEBKIT_WEBSITE_DATA_SERVICE_WORKER_REGISTRATIONS},
+};
+
+// Where WebKitGTK keeps each type under the base directories
+static const struct {
+    gboolean in_cache_dir;
+    const char *path;
+    StorageKind kind;
+} type_dirs[] = {
+    {TRUE, "WebKitCache", KIND_DISK_CACHE},
+    {TRUE, "CacheStorage", KIND_SERVICE_WORKERS},
+    {FALSE, "localstorage", KIND_LOCAL_STORAGE},
+    {FALSE, "databases/indexeddb", KIND_INDEXEDDB},
+    {FALSE, "serviceworkers", KIND_SERVICE_WORKERS},
+};
+
+// Newer WebKit keeps per-origin data in <data_dir>/storage/<top origin>/<origin>/,
+// one directory per type
+#define STORAGE_ORIGIN_DIR "storage"
+static const struct {
+    const char *name;
+    StorageKind kind;
+} origin_dirs[] = {
+    {"LocalStorage", KIND_LOCAL_STORAGE},
+    {"IndexedDB", KIND_INDEXEDDB},
+    {"CacheStorage", KIND_SERVICE_WORKERS},
+};
+
+typedef struct {
+    char *name;
+    WebKitWebsiteData *data;
+    gint64 used;  // Unix time in seconds, 0 if never recorded
+    guint64 cache_bytes;
+} StorageSite;
+
+typedef struct {
+    guint64 bytes[N_KINDS];
+    guint sites[N_KINDS];
+    guint64 total;
+    GPtrArray *sites_lru;  // StorageSite, least recently used first
+} StorageUsage;
+
+typedef void (*StorageQueryDone)(Storage *storage, StorageUsage *usage, gpointer user_data);
+
+typedef struct {
+    Storage *storage;
+    StorageUsage *usage;
+    StorageQueryDone done;
+    gpointer user_data;
+} StorageQuery;
+
+typedef struct {
+    Storage *storage;
+    GList *victims;  // WebKitWebsiteData
+} StorageRemoval;
+
+typedef struct {
+    GCallback callback;  // void (*)(gpointer user_data)
+    gpointer user_data;
+} StorageWaiter;
+
+struct _Storage {
+    WebKitWebsiteDataManager *manager;
+    char *data_dir;
+    char *cache_dir;
+    char *sites_path;
+    guint64 quota_bytes;
+    gint64 session_start;
+    GHashTable *sites;  // site name -> gint64* last used
+    ConfigStore *sites_store;
+    gboolean enforcing;
+    guint rounds;
+    GSList *waiters;  // StorageWaiter, told when enforcement finishes
+};
+
+static void storage_site_free(StorageSite *site) {
+    g_free(site->name);
+    webkit_website_data_unref(site->data);
+    g_free(site);
+}
+
+static void storage_usage_free(StorageUsage *usage) {
+    if (usage->sites_lru) g_ptr_array_unref(usage->sites_lru);
+    g_free(usage);
+}
+
+static gint64 now_seconds(void) {
+    return g_get_real_time() / G_USEC_PER_SEC;
+}
+
+// Site data is grouped by registrable domain, the same names
+// webkit_website_data_get_name() returns
+static char *site_for_host(const char *host) {
+    const char *base = soup_tld_get_base_domain(host, NULL);
+    return g_ascii_strdown(base ? base : host, -1);
+}
+
+// --- Last use per site ---
+
+static void fill_sites(GKeyFile *key_file, gpointer user_data) {
+    Storage *storage = user_data;
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, storage->sites);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        g_key_file_set_int64(key_file, "Sites", key, *(gint64 *)value);
+    }
+}
+
+static void schedule_sites_save(Storage *storage) {
+    config_store_mark_dirty(storage->sites_store);
+}
+
+static void load_sites(Storage *storage) {
+    GKeyFile *key_file = g_key_file_new();
+    if (g_key_file_load_from_file(key_file, storage->sites_path, G_KEY_FILE_NONE, NULL)) {
+        gchar **names = g_key_file_get_keys(key_file, "Sites", NULL, NULL);
+        for (int i = 0; names && names[i] != NULL; i++) {
+            gint64 *used = g_new(gint64, 1);
+            *used = g_key_file_get_int64(key_file, "Sites", names[i], NULL);
+            g_hash_table_replace(storage->sites, g_strdup(names[i]), used);
+        }
+        g_strfreev(names);
+    }
+    g_key_file_free(key_file);
+}
+
+// --- Measuring ---
+
+static void measure_tree(const char *path, int kind, guint64 *bytes) {
+    GDir *dir = g_dir_open(path, 0, NULL);
+    if (!dir) return;
+
+    const char *name;
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        char *child = g_build_filename(path, name, NULL);
+        GStatBuf st;
+
+        if (g_lstat(child, &st) == 0) {
+            if (S_ISDIR(st.st_mode)) {
+                int child_kind = kind;
+                for (guint i = 0; i < G_N_ELEMENTS(origin_dirs); i++) {
+                    if (strcmp(name, origin_dirs[i].name) == 0) child_kind = origin_dirs[i].kind;
+                }
+                measure_tree(child, child_kind, bytes);
+            } else if (S_ISREG(st.st_mode) && kind >= 0) {
+                // Space actually taken on disk, which is what fills quotas
+                bytes[kind] += (guint64)st.st_blocks * 512;
+            }
+        }
+        g_free(child);
+    }
+
+    g_dir_close(dir);
+}
+
+static void measure_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+    Storage *storage = task_data;
+    guint64 *bytes = g_new0(guint64, N_KINDS);
+
+    for (guint i = 0; i < G_N_ELEMENTS(type_dirs); i++) {
+        char *path = g_build_filename(type_dirs[i].in_cache_dir ? storage->cache_dir : storage->data_dir,
+                                      type_dirs[i].path, NULL);
+        measure_tree(path, type_dirs[i].kind, bytes);
+        g_free(path);
+    }
+
+    char *origins = g_build_filename(storage->data_dir, STORAGE_ORIGIN_DIR, NULL);
+    measure_tree(origins, -1, bytes);
+    g_free(origins);
+
+    g_task_return_pointer(task, bytes, g_free);
+}
+
+static gint compare_sites(gconstpointer a, gconstpointer b) {
+    const StorageSite *x = *(StorageSite *const *)a;
+    const StorageSite *y = *(StorageSite *const *)b;
+    if (x->used != y->used) return x->used < y->used ? -1 : 1;
+    // Among equally old sites, the biggest go first
+    return (x->cache_bytes < y->cache_bytes) - (x->cache_bytes > y->cache_bytes);
+}
+
+static void on_data_fetched(GObject *source, GAsyncResult *result, gpointer user_data) {
+    StorageQuery *query = user_data;
+    Storage *storage = query->storage;
+    StorageUsage *usage = query->usage;
+    GError *error = NULL;
+    GList *records = webkit_website_data_manager_fetch_finish(WEBKIT_WEBSITE_DATA_MANAGER(source), result, &error);
+
+    if (error) {
+        g_warning("Could not list website data: %s", error->message);
+        g_error_free(error);
+    }
+
+    GHashTable *present = g_hash_table_new(g_str_hash, g_str_equal);
+    usage->sites_lru = g_ptr_array_new_with_free_func((GDestroyNotify)storage_site_free);
+
+    for (GList *l = records; l != NULL; l = l->next) {
+        WebKitWebsiteData *data = l->data;
+        StorageSite *site = g_new0(StorageSite, 1);
+        site->name = g_ascii_strdown(webkit_website_data_get_name(data), -1);
+        site->data = webkit_website_data_ref(data);
+        site->cache_bytes = webkit_website_data_get_size(data, WEBKIT_WEBSITE_DATA_DISK_CACHE);
+
+        gint64 *used = g_hash_table_lookup(storage->sites, site->name);
+        site->used = used ? *used : 0;
+
+        WebKitWebsiteDataTypes types = webkit_website_data_get_types(data);
+        for (int i = 0; i < N_KINDS; i++) {
+            if (types & kinds[i].type) usage->sites[i]++;
+        }
+
+        g_hash_table_add(present, site->name);
+        g_ptr_array_add(usage->sites_lru, site);
+    }
+    g_ptr_array_sort(usage->sites_lru, compare_sites);
+
+    // Forget sites whose data is gone and that haven't been visited in a while
+    GHashTableIter iter;
+    gpointer key, value;
+    gint64 forget_before = now_seconds() - STORAGE_FORGET_SECONDS;
+    g_hash_table_iter_init(&iter, storage->sites);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        if (!g_hash_table_contains(present, key) && *(gint64 *)value < forget_before) {
+            g_hash_table_iter_remove(&iter);
+            schedule_sites_save(storage);
+        }
+    }
+
+    query->done(storage, usage, query->user_data);
+
+    g_hash_table_destroy(present);
+    g_list_free_full(records, (GDestroyNotify)webkit_website_data_unref);
+    storage_usage_free(usage);
+    g_free(query);
+}
+
+static void on_measured(GObject *source, GAsyncResult *result, gpointer user_data) {
+    StorageQuery *query = user_data;
+    guint64 *bytes = g_task_propagate_pointer(G_TASK(result), NULL);
+
+    for (int i = 0; bytes && i < N_KINDS; i++) {
+        query->usage->bytes[i] = bytes[i];
+        query->usage->total += bytes[i];
+    }
+    g_free(bytes);
+
+    webkit_website_data_manager_fetch(query->storage->manager, STORAGE_TYPES, NULL, on_data_fetched, query);
+}
+
+// Measures the directories on a worker thread, then lists the sites that
+// have data; done gets both on the main thread
+static void storage_query(Storage *storage, StorageQueryDone done, gpointer user_data) {
+    StorageQuery *query = g_new0(StorageQuery, 1);
+    query->storage = storage;
+    query->usage = g_new0(StorageUsage, 1);
+    query->done = done;
+    query->user_data = user_data;
+
+    GTask *task = g_task_new(NULL, NULL, on_measured, query);
+    g_task_set_task_data(task, storage, NULL);
+    g_task_run_in_thread(task, measure_thread);
+    g_object_unref(task);
+}
+
+// --- Enforcing the quota ---
+
+static void enforce_round(Storage *storage, StorageUsage *usage, gpointer user_data);
+
+static void finish_enforcing(Storage *storage) {
+    GSList *waiters = storage->waiters;
+    storage->waiters = NULL;
+    storage->enforcing = FALSE;
+
+    for (GSList *l = waiters; l != NULL; l = l->next) {
+        StorageWaiter *waiter = l->data;
+        ((void (*)(gpointer))waiter->callback)(waiter->user_data);
+    }
+    g_slist_free_full(waiters, g_free);
+}
+
+static void on_sites_removed(GObject *source, GAsyncResult *result, gpointer user_data) {
+    StorageRemoval *removal = user_data;
+    Storage *storage = removal->storage;
+    GList *victims = removal->victims;
+    GError *error = NULL;
+
+    g_free(removal);
+
+    if (!webkit_website_data_manager_remove_finish(WEBKIT_WEBSITE_DATA_MANAGER(source), result, &error)) {
+        g_warning("Could not remove website data: %s", error->message);
+        g_error_free(error);
+        g_list_free_full(victims, (GDestroyNotify)webkit_website_data_unref);
+        finish_enforcing(storage);
+        return;
+    }
+
+    for (GList *l = victims; l != NULL; l = l->next) {
+        char *name = g_ascii_strdown(webkit_website_data_get_name(l->data), -1);
+        if (g_hash_table_remove(storage->sites, name)) schedule_sites_save(storage);
+        g_free(name);
+    }
+    g_list_free_full(victims, (GDestroyNotify)webkit_website_data_unref);
+
+    storage_query(storage, enforce_round, NULL);
+}
+
+static void on_cache_cleared(GObject *source, GAsyncResult *result, gpointer user_data) {
+    Storage *storage = user_data;
+    GError *error = NULL;
+
+    if (!webkit_website_data_manager_clear_finish(WEBKIT_WEBSITE_DATA_MANAGER(source), result, &error)) {
+        g_warning("Could not clear the disk cache: %s", error->message);
+        g_error_free(error);
+    }
+    finish_enforcing(storage);
+}
+
+static void enforce_round(Storage *storage, StorageUsage *usage, gpointer user_data) {
+    if (storage->quota_bytes == 0 || usage->total <= storage->quota_bytes) {
+        g_debug("storage: %" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " bytes used",
+                usage->total, storage->quota_bytes);
+        finish_enforcing(storage);
+        return;
+    }
+
+    guint64 excess = usage->total - storage->quota_bytes;
+    guint64 freed = 0;
+    GList *victims = NULL;
+
+    // Oldest first; sites used in this session are left alone so open
+    // tabs keep their state
+    if (storage->rounds++ < STORAGE_MAX_ROUNDS) {
+        for (guint i = 0; i < usage->sites_lru->len; i++) {
+            StorageSite *site = g_ptr_array_index(usage->sites_lru, i);
+            if (site->used >= storage->session_start) break;
+
+            victims = g_list_prepend(victims, webkit_website_data_ref(site->data));
+            freed += site->cache_bytes;
+            if (freed >= excess || g_list_length(victims) >= STORAGE_EVICT_BATCH) break;
+        }
+    }
+
+    if (victims) {
+        g_debug("storage: %" G_GUINT64_FORMAT " bytes over quota, removing data of %u sites",
+                excess, g_list_length(victims));
+        StorageRemoval *removal = g_new0(StorageRemoval, 1);
+        removal->storage = storage;
+        removal->victims = victims;
+        webkit_website_data_manager_remove(storage->manager, STORAGE_TYPES, victims, NULL, on_sites_removed, removal);
+        return;
+    }
+
+    // Only recent sites are left; the disk cache can always go
+    if (usage->bytes[KIND_DISK_CACHE] > 0) {
+        g_debug("storage: still %" G_GUINT64_FORMAT " bytes over quota, clearing the disk cache", excess);
+        webkit_website_data_manager_clear(storage->manager, WEBKIT_WEBSITE_DATA_DISK_CACHE, 0, NULL,
+                                          on_cache_cleared, storage);
+        return;
+    }
+
+    g_message("Website data is %" G_GUINT64_FORMAT " bytes over its quota, all of it from sites in use",
+              excess);
+    finish_enforcing(storage);
+}
+
+static void enforce_then(Storage *storage, GCallback callback, gpointer user_data) {
+    if (callback) {
+        StorageWaiter *waiter = g_new0(StorageWaiter, 1);
+        waiter->callback = callback;
+        waiter->user_data = user_data;
+        storage->waiters = g_slist_append(storage->waiters, waiter);
+    }
+
+    if (storage->enforcing) return;
+    storage->enforcing = TRUE;
+    storage->rounds = 0;
+    storage_query(storage, enforce_round, NULL);
+}
+
+static gboolean on_periodic_check(gpointer user_data) {
+    Storage *storage = user_data;
+    if (storage->quota_bytes > 0) enforce_then(storage, NULL, NULL);
+    return G_SOURCE_CONTINUE;
+}
+
+static gboolean on_first_check(gpointer user_data) {
+    Storage *storage = user_data;
+    on_periodic_check(storage);
+    g_timeout_add_seconds_full(G_PRIORITY_LOW, STORAGE_CHECK_INTERVAL_SECONDS, on_periodic_check, storage, NULL);
+    return G_SOURCE_REMOVE;
+}
+
+Storage *storage_new(WebKitWebsiteDataManager *manager, const char *data_dir, const char *cache_dir,
+                     guint64 quota_bytes) {
+    Storage *storage = g_new0(Storage, 1);
+    storage->manager = g_object_ref(manager);
+    storage->data_dir = g_strdup(data_dir);
+    storage->cache_dir = g_strdup(cache_dir);
+    storage->sites_path = g_build_filename(data_dir, "storage-sites.ini", NULL);
+    storage->quota_bytes = quota_bytes;
+    storage->session_start = now_seconds();
+    storage->sites = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    storage->sites_store = config_store_new_key_file(storage->sites_path, STORAGE_SITES_SAVE_DELAY_MS, fill_sites, storage);
+    load_sites(storage);
+
+    // Out of the way of the first page load
+    g_timeout_add_seconds_full(G_PRIORITY_LOW, STORAGE_FIRST_CHECK_SECONDS, on_first_check, storage, NULL);
+    return storage;
+}
+
+void storage_note_uri(Storage *storage, const char *uri) {
+    if (!storage || !uri) return;
+
+    GUri *parsed = g_uri_parse(uri, G_URI_FLAGS_NONE, NULL);
+    if (!parsed) return;
+
+    const char *scheme = g_uri_get_scheme(parsed);
+    const char *host = g_uri_get_host(parsed);
+    if (host && *host && (g_strcmp0(scheme, "https") == 0 || g_strcmp0(scheme, "http") == 0)) {
+        gint64 *used = g_new(gint64, 1);
+        *used = now_seconds();
+        g_hash_table_replace(storage->sites, site_for_host(host), used);
+        schedule_sites_save(storage);
+    }
+
+    g_uri_unref(parsed);
+}
+
+// --- Diagnostics ---
+
+typedef struct {
+    Storage *storage;
+    GtkWidget *root;  // NULL once destroyed
+    GtkWidget *size_labels[N_KINDS];
+    GtkWidget *count_labels[N_KINDS];
+    GtkWidget *total_label;
+    GtkWidget *level_bar;
+    GtkWidget *site_list;
+    GtkWidget *refresh_button;
+    GtkWidget *free_button;
+    guint pending;
+} Diagnostics;
+
+static void diagnostics_release(Diagnostics *diag) {
+    if (diag->root == NULL && diag->pending == 0) g_free(diag);
+}
+
+static void on_diagnostics_destroy(GtkWidget *widget, gpointer user_data) {
+    Diagnostics *diag = user_data;
+    diag->root = NULL;
+    diagnostics_release(diag);
+}
+
+static GtkWidget *site_row(const StorageSite *site) {
+    GtkWidget *row = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 10);
+    g_object_set(row, "margin", 4, NULL);
+
+    GtkWidget *name_label = gtk_label_new(site->name);
+    gtk_label_set_xalign(GTK_LABEL(name_label), 0);
+    gtk_label_set_ellipsize(GTK_LABEL(name_label), PANGO_ELLIPSIZE_END);
+    gtk_box_pack_start(GTK_BOX(row), name_label, TRUE, TRUE, 0);
+
+    char *used;
+    if (site->used > 0) {
+        GDateTime *time = g_date_time_new_from_unix_local(site->used);
+        used = g_date_time_format(time, "%x");
+        g_date_time_unref(time);
+    } else {
+        used = g_strdup("not recorded");
+    }
+    GtkWidget *used_label = gtk_label_new(used);
+    gtk_style_context_add_class(gtk_widget_get_style_context(used_label), "dim-label");
+    gtk_box_pack_start(GTK_BOX(row), used_label, FALSE, FALSE, 0);
+    g_free(used);
+
+    char *size = site->cache_bytes ? g_format_size(site->cache_bytes) : g_strdup("");
+    GtkWidget *size_label = gtk_label_new(size);
+    gtk_label_set_width_chars(GTK_LABEL(size_label), 9);
+    gtk_label_set_xalign(GTK_LABEL(size_label), 1);
+    gtk_box_pack_start(GTK_BOX(row), size_label, FALSE, FALSE, 0);
+    g_free(size);
+
+    gtk_widget_show_all(row);
+    return row;
+}
+
+static void on_diagnostics_usage(Storage *storage, StorageUsage *usage, gpointer user_data) {
+    Diagnostics *diag = user_data;
+    diag->pending--;
+    if (diag->root == NULL) {
+        diagnostics_release(diag);
+        return;
+    }
+
+    for (int i = 0; i < N_KINDS; i++) {
+        char *size = g_format_size(usage->bytes[i]);
+        char *count = g_strdup_printf("%u %s", usage->sites[i], usage->sites[i] == 1 ? "site" : "sites");
+        gtk_label_set_text(GTK_LABEL(diag->size_labels[i]), size);
+        gtk_label_set_text(GTK_LABEL(diag->count_labels[i]), count);
+        g_free(size);
+        g_free(count);
+    }
+
+    char *total = g_format_size(usage->total);
+    char *text;
+    if (storage->quota_bytes > 0) {
+        char *quota = g_format_size(storage->quota_bytes);
+        text = g_strdup_printf("<b>%s</b> of %s", total, quota);
+        g_free(quota);
+        gtk_level_bar_set_value(GTK_LEVEL_BAR(diag->level_bar),
+                                MIN((double)usage->total / (double)storage->quota_bytes, 1.0));
+        gtk_widget_show(diag->level_bar);
+    } else {
+        text = g_strdup_printf("<b>%s</b>, no quota", total);
+        gtk_widget_hide(diag->level_bar);
+    }
+    gtk_label_set_markup(GTK_LABEL(diag->total_label), text);
+    g_free(text);
+    g_free(total);
+
+    gtk_container_foreach(GTK_CONTAINER(diag->site_list), (GtkCallback)gtk_widget_destroy, NULL);
+    for (guint i = 0; i < usage->sites_lru->len && i < STORAGE_DIAGNOSTICS_MAX_SITES; i++) {
+        gtk_list_box_insert(GTK_LIST_BOX(diag->site_list), site_row(g_ptr_array_index(usage->sites_lru, i)), -1);
+    }
+
+    gtk_widget_set_sensitive(diag->refresh_button, TRUE);
+    gtk_widget_set_sensitive(diag->free_button, storage->quota_bytes > 0);
+}
+
+static void diagnostics_refresh(Diagnostics *diag) {
+    gtk_widget_set_sensitive(diag->refresh_button, FALSE);
+    gtk_widget_set_sensitive(diag->free_button, FALSE);
+    diag->pending++;
+    storage_query(diag->storage, on_diagnostics_usage, diag);
+}
+
+static void on_diagnostics_enforced(gpointer user_data) {
+    Diagnostics *diag = user_data;
+    diag->pending--;
+    if (diag->root == NULL) {
+        diagnostics_release(diag);
+        return;
+    }
+    diagnostics_refresh(diag);
+}
+
+static void on_refresh_clicked(GtkButton *button, gpointer user_data) {
+    diagnostics_refresh(user_data);
+}
+
+static void on_free_clicked(GtkButton *button, gpointer user_data) {
+    Diagnostics *diag = user_data;
+    gtk_widget_set_sensitive(diag->refresh_button, FALSE);
+    gtk_widget_set_sensitive(diag->free_button, FALSE);
+    diag->pending++;
+    enforce_then(diag->storage, G_CALLBACK(on_diagnostics_enforced), diag);
+}
+
+GtkWidget *storage_diagnostics_new(Storage *storage) {
+    Diagnostics *diag = g_new0(Diagnostics, 1);
+    diag->storage = storage;
+
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 10);
+    g_object_set(box, "margin", 20, NULL);
+    diag->root = box;
+    g_signal_connect(box, "destroy", G_CALLBACK(on_diagnostics_destroy), diag);
+
+    GtkWidget *grid = gtk_grid_new();
+    gtk_grid_set_row_spacing(GTK_GRID(grid), 6);
+    gtk_grid_set_column_spacing(GTK_GRID(grid), 20);
+    for (int i = 0; i < N_KINDS; i++) {
+        GtkWidget *label = gtk_label_new(kinds[i].label);
+        gtk_label_set_xalign(GTK_LABEL(label), 0);
+        gtk_widget_set_hexpand(label, TRUE);
+        diag->size_labels[i] = gtk_label_new("…");
+        gtk_label_set_xalign(GTK_LABEL(diag->size_labels[i]), 1);
+        diag->count_labels[i] = gtk_label_new("");
+        gtk_label_set_xalign(GTK_LABEL(diag->count_labels[i]), 1);
+        gtk_style_context_add_class(gtk_widget_get_style_context(diag->count_labels[i]), "dim-label");
+
+        gtk_grid_attach(GTK_GRID(grid), label, 0, i, 1, 1);
+        gtk_grid_attach(GTK_GRID(grid), diag->size_labels[i], 1, i, 1, 1);
+        gtk_grid_attach(GTK_GRID(grid), diag->count_labels[i], 2, i, 1, 1);
+    }
+    gtk_box_pack_start(GTK_BOX(box), grid, FALSE, FALSE, 0);
+
+    diag->total_label = gtk_label_new("Measuring…");
+    gtk_label_set_xalign(GTK_LABEL(diag->total_label), 0);
+    gtk_box_pack_start(GTK_BOX(box), diag->total_label, FALSE, FALSE, 0);
+
+    diag->level_bar = gtk_level_bar_new_for_interval(0.0, 1.0);
+    gtk_level_bar_add_offset_value(GTK_LEVEL_BAR(diag->level_bar), GTK_LEVEL_BAR_OFFSET_LOW, 0.75);
+    gtk_level_bar_add_offset_value(GTK_LEVEL_BAR(diag->level_bar), GTK_LEVEL_BAR_OFFSET_HIGH, 0.95);
+    gtk_widget_set_no_show_all(diag->level_bar, TRUE);
+    gtk_box_pack_start(GTK_BOX(box), diag->level_bar, FALSE, FALSE, 0);
+
+    GtkWidget *sites_label = gtk_label_new("Sites, least recently used first (disk cache size):");
+    gtk_label_set_xalign(GTK_LABEL(sites_label), 0);
+    gtk_box_pack_start(GTK_BOX(box), sites_label, FALSE, FALSE, 0);
+
+    GtkWidget *scrolled = gtk_scrolled_window_new(NULL, NULL);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+    gtk_scrolled_window_set_min_content_height(GTK_SCROLLED_WINDOW(scrolled), 160);
+    diag->site_list = gtk_list_box_new();
+    gtk_list_box_set_selection_mode(GTK_LIST_BOX(diag->site_list), GTK_SELECTION_NONE);
+    gtk_container_add(GTK_CONTAINER(scrolled), diag->site_list);
+    gtk_box_pack_start(GTK_BOX(box), scrolled, TRUE, TRUE, 0);
+
+    GtkWidget *buttons = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 10);
+    diag->refresh_button = gtk_button_new_with_label("Refresh");
+    g_signal_connect(diag->refresh_button, "clicked", G_CALLBACK(on_refresh_clicked), diag);
+    gtk_box_pack_end(GTK_BOX(buttons), diag->refresh_button, FALSE, FALSE, 0);
+    diag->free_button = gtk_button_new_with_label("Free Space Now");
+    gtk_widget_set_tooltip_text(diag->free_button, "Remove the data of the least recently used sites until under quota");
+    g_signal_connect(diag->free_button, "clicked", G_CALLBACK(on_free_clicked), diag);
+    gtk_box_pack_end(GTK_BOX(buttons), diag->free_button, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(box), buttons, FALSE, FALSE, 0);
+
+    diagnostics_refresh(diag);
+    return box;
+}
@@ -0,0 +1,26 @@
+#ifndef LEAF_CLASS_STORAGE_H
+#define LEAF_CLASS_STORAGE_H
+
+#include <gtk/gtk.h>
+#include <webkit2/webkit2.h>
+
+// Keeps WebKit's website data (disk cache, local storage, IndexedDB and
+// service workers) under a size quota. Usage is measured on disk on a
+// worker thread; when it is over the quota, the data of the sites used
+// longest ago is removed through the website data manager, a few sites at
+// a time, until it fits. Checks run shortly after startup and then
+// periodically at idle priority. Last use per site is kept in
+// <data_dir>/storage-sites.ini.
+typedef struct _Storage Storage;
+
+// quota_bytes 0 measures but never evicts
+Storage *storage_new(WebKitWebsiteDataManager *manager, const char *data_dir, const char *cache_dir,
+                     guint64 quota_bytes);
+
+// Call when a page is committed; marks its site as used now
+void storage_note_uri(Storage *storage, const char *uri);
+
+// Usage per data type and per site, with refresh and "free space" buttons
+GtkWidget *storage_diagnostics_new(Storage *storage);
+
+#endif
@@ -0,0 +1,363 @@
+#include "tabs.h"
+
+#define TAB_LABEL_MAX_CHARS 18
+
+typedef struct {
+    Tabs *tabs;
+    GtkWidget *page;    // stack child, holds the view while awake
+    GtkWidget *handle;  // [button][close] in the tab strip
+    GtkWidget *button;
+    GtkWidget *label;
+    GtkWidget *close_button;
+    WebKitWebView *view;  // NULL while hibernated
+    char *uri;
+    char *title;
+    WebKitWebViewSessionState *session;
+    double scroll_y;
+    gboolean restore_scroll;
+    guint hibernate_id;
+    GCancellable *cancellable;  // pending scroll query before hibernating
+} Tab;
+
+struct _Tabs {
+    guint hibernate_seconds;
+    TabsCreateView create_view;
+    TabsSwitched switched;
+    gpointer user_data;
+    GtkWidget *bar;
+    GtkWidget *strip;
+    GtkWidget *stack;
+    GList *tabs;  // Tab, in strip order
+    Tab *current;
+    gboolean updating;
+    gboolean suspended;  // every view goes, the focused one included
+};
+
+static void tab_focus(Tab *tab);
+static void tab_hibernate(Tab *tab);
+
+static void tab_update_label(Tab *tab) {
+    const char *text = tab->title && *tab->title ? tab->title : tab->uri;
+    gtk_label_set_text(GTK_LABEL(tab->label), text ? text : "New Tab");
+    gtk_widget_set_tooltip_text(tab->button, text);
+
+    GtkStyleContext *style = gtk_widget_get_style_context(tab->label);
+    if (tab->view) {
+        gtk_style_context_remove_class(style, "dim-label");
+    } else {
+        gtk_style_context_add_class(style, "dim-label");
+    }
+}
+
+static void update_close_buttons(Tabs *tabs) {
+    gboolean closable = g_list_length(tabs->tabs) > 1;
+    for (GList *l = tabs->tabs; l != NULL; l = l->next) {
+        Tab *tab = l->data;
+        gtk_widget_set_visible(tab->close_button, closable);
+    }
+}
+
+static void on_view_title_changed(WebKitWebView *view, GParamSpec *pspec, gpointer user_data) {
+    Tab *tab = user_data;
+    g_free(tab->title);
+    tab->title = g_strdup(webkit_web_view_get_title(view));
+    tab_update_label(tab);
+}
+
+static void on_view_uri_changed(WebKitWebView *view, GParamSpec *pspec, gpointer user_data) {
+    Tab *tab = user_data;
+    const char *uri = webkit_web_view_get_uri(view);
+    if (!uri) return;
+    g_free(tab->uri);
+    tab->uri = g_strdup(uri);
+    tab_update_label(tab);
+}
+
+static void on_view_load_changed(WebKitWebView *view, WebKitLoadEvent load_event, gpointer user_data) {
+    Tab *tab = user_data;
+    if (load_event != WEBKIT_LOAD_FINISHED || !tab->restore_scroll) return;
+
+    tab->restore_scroll = FALSE;
+    char *script = g_strdup_printf("window.scrollTo(0, %f);", tab->scroll_y);
+    webkit_web_view_evaluate_javascript(view, script, -1, NULL, NULL, NULL, NULL, NULL);
+    g_free(script);
+}
+
+static void tab_wake(Tab *tab) {
+    if (tab->view) return;
+
+    Tabs *tabs = tab->tabs;
+    tab->view = tabs->create_view(tabs->user_data);
+    g_signal_connect(tab->view, "notify::title", G_CALLBACK(on_view_title_changed), tab);
+    g_signal_connect(tab->view, "notify::uri", G_CALLBACK(on_view_uri_changed), tab);
+    g_signal_connect(tab->view, "load-changed", G_CALLBACK(on_view_load_changed), tab);
+    gtk_container_add(GTK_CONTAINER(tab->page), GTK_WIDGET(tab->view));
+    gtk_widget_show(GTK_WIDGET(tab->view));
+
+    WebKitBackForwardListItem *item = NULL;
+    if (tab->session) {
+        webkit_web_view_restore_session_state(tab->view, tab->session);
+        webkit_web_view_session_state_unref(tab->session);
+        tab->session = NULL;
+        item = webkit_back_forward_list_get_current_item(webkit_web_view_get_back_forward_list(tab->view));
+        tab->restore_scroll = tab->scroll_y > 0;
+    }
+
+    if (item) {
+        webkit_web_view_go_to_back_forward_list_item(tab->view, item);
+    } else if (tab->uri) {
+        webkit_web_view_load_uri(tab->view, tab->uri);
+    }
+    tab_update_label(tab);
+}
+
+static gboolean on_hibernate_timeout(gpointer user_data) {
+    Tab *tab = user_data;
+    tab->hibernate_id = 0;
+    tab_hibernate(tab);
+    return G_SOURCE_REMOVE;
+}
+
+static void tab_schedule_hibernate(Tab *tab) {
+    Tabs *tabs = tab->tabs;
+    if (tabs->hibernate_seconds == 0 || tab->hibernate_id) return;
+    tab->hibernate_id = g_timeout_add_seconds(tabs->hibernate_seconds, on_hibernate_timeout, tab);
+}
+
+static void tab_cancel_hibernate(Tab *tab) {
+    if (tab->hibernate_id) {
+        g_source_remove(tab->hibernate_id);
+        tab->hibernate_id = 0;
+    }
+    if (tab->cancellable) {
+        g_cancellable_cancel(tab->cancellable);
+        g_clear_object(&tab->cancellable);
+    }
+}
+
+static void on_scroll_position(GObject *source, GAsyncResult *result, gpointer user_data) {
+    GError *error = NULL;
+    JSCValue *value = webkit_web_view_evaluate_javascript_finish(WEBKIT_WEB_VIEW(source), result, &error);
+
+    // Cancelled when the tab was focused or closed meanwhile; tab may be gone
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_error_free(error);
+        return;
+    }
+    g_clear_error(&error);
+
+    Tab *tab = user_data;
+    g_clear_object(&tab->cancellable);
+    tab->scroll_y = value && jsc_value_is_number(value) ? jsc_value_to_double(value) : 0;
+    if (value) g_object_unref(value);
+
+    if ((tab == tab->tabs->current && !tab->tabs->suspended) || !tab->view) return;
+
+    g_debug("tabs: hibernating %s", tab->uri);
+    tab->session = webkit_web_view_get_session_state(tab->view);
+    gtk_widget_destroy(GTK_WIDGET(tab->view));
+    tab->view = NULL;
+    tab_update_label(tab);
+}
+
+static void tab_hibernate(Tab *tab) {
+    Tabs *tabs = tab->tabs;
+    if (!tab->view || (tab == tabs->current && !tabs->suspended) || tab->cancellable) return;
+
+    // Don't interrupt audio or a page that is still coming in; check later
+    if (!tabs->suspended &&
+        (webkit_web_view_is_playing_audio(tab->view) || webkit_web_view_is_loading(tab->view))) {
+        tab_schedule_hibernate(tab);
+        return;
+    }
+
+    tab->cancellable = g_cancellable_new();
+    webkit_web_view_evaluate_javascript(tab->view, "window.scrollY", -1, NULL, NULL,
+                                        tab->cancellable, on_scroll_position, tab);
+}
+
+static void on_tab_toggled(GtkToggleButton *button, gpointer user_data) {
+    Tab *tab = user_data;
+    if (tab->tabs->updating || !gtk_toggle_button_get_active(button)) return;
+    tab_focus(tab);
+}
+
+static void tab_focus(Tab *tab) {
+    Tabs *tabs = tab->tabs;
+    Tab *previous = tabs->current;
+
+    tab_cancel_hibernate(tab);
+    tabs->current = tab;
+    if (previous && previous != tab) tab_schedule_hibernate(previous);
+
+    tabs->updating = TRUE;
+    gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(tab->button), TRUE);
+    tabs->updating = FALSE;
+
+    tab_wake(tab);
+    gtk_stack_set_visible_child(GTK_STACK(tabs->stack), tab->page);
+    tabs->switched(tab->view, tabs->user_data);
+}
+
+static void tab_free(Tab *tab) {
+    tab_cancel_hibernate(tab);
+    gtk_widget_destroy(tab->handle);
+    gtk_widget_destroy(tab->page);
+    if (tab->session) webkit_web_view_session_state_unref(tab->session);
+    g_free(tab->uri);
+    g_free(tab->title);
+    g_free(tab);
+}
+
+static void tab_close(Tab *tab) {
+    Tabs *tabs = tab->tabs;
+    if (g_list_length(tabs->tabs) < 2) return;
+
+    GList *link = g_list_find(tabs->tabs, tab);
+    if (tab == tabs->current) {
+        GList *neighbour = link->next ? link->next : link->prev;
+        tab_focus(neighbour->data);
+    }
+
+    tabs->tabs = g_list_delete_link(tabs->tabs, link);
+    tab_free(tab);
+    update_close_buttons(tabs);
+}
+
+static void on_close_clicked(GtkButton *button, gpointer user_data) {
+    tab_close(user_data);
+}
+
+Tabs *tabs_new(guint hibernate_seconds, TabsCreateView create_view, TabsSwitched switched, gpointer user_data) {
+    Tabs *tabs = g_new0(Tabs, 1);
+    tabs->hibernate_seconds = hibernate_seconds;
+    tabs->create_view = create_view;
+    tabs->switched = switched;
+    tabs->user_data = user_data;
+
+    tabs->stack = gtk_stack_new();
+
+    tabs->bar = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 6);
+    tabs->strip = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 4);
+    gtk_box_pack_start(GTK_BOX(tabs->bar), tabs->strip, FALSE, FALSE, 0);
+
+    GtkWidget *new_button = gtk_button_new_from_icon_name("tab-new-symbolic", GTK_ICON_SIZE_BUTTON);
+    gtk_widget_set_tooltip_text(new_button, "New Tab");
+    gtk_actionable_set_action_name(GTK_ACTIONABLE(new_button), "app.new-tab");
+    gtk_box_pack_start(GTK_BOX(tabs->bar), new_button, FALSE, FALSE, 0);
+
+    return tabs;
+}
+
+void tabs_free(Tabs *tabs) {
+    g_list_free_full(tabs->tabs, (GDestroyNotify)tab_free);
+    gtk_widget_destroy(tabs->bar);
+    gtk_widget_destroy(tabs->stack);
+    g_free(tabs);
+}
+
+GtkWidget *tabs_get_bar(Tabs *tabs) {
+    return tabs->bar;
+}
+
+GtkWidget *tabs_get_stack(Tabs *tabs) {
+    return tabs->stack;
+}
+
+void tabs_open(Tabs *tabs, const char *uri, gboolean focus) {
+    Tab *tab = g_new0(Tab, 1);
+    tab->tabs = tabs;
+    tab->uri = g_strdup(uri);
+
+    tab->page = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+    gtk_widget_show(tab->page);
+    gtk_container_add(GTK_CONTAINER(tabs->stack), tab->page);
+
+    Tab *sibling = tabs->tabs ? tabs->tabs->data : NULL;
+    tab->button = gtk_radio_button_new_from_widget(sibling ? GTK_RADIO_BUTTON(sibling->button) : NULL);
+    gtk_toggle_button_set_mode(GTK_TOGGLE_BUTTON(tab->button), FALSE);
+    tab->label = gtk_label_new(NULL);
+    gtk_label_set_ellipsize(GTK_LABEL(tab->label), PANGO_ELLIPSIZE_END);
+    gtk_label_set_max_width_chars(GTK_LABEL(tab->label), TAB_LABEL_MAX_CHARS);
+    gtk_container_add(GTK_CONTAINER(tab->button), tab->label);
+    g_signal_connect(tab->button, "toggled", G_CALLBACK(on_tab_toggled), tab);
+
+    tab->close_button = gtk_button_new_from_icon_name("window-close-symbolic", GTK_ICON_SIZE_MENU);
+    gtk_widget_set_tooltip_text(tab->close_button, "Close Tab");
+    g_signal_connect(tab->close_button, "clicked", G_CALLBACK(on_close_clicked), tab);
+
+    tab->handle = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
+    gtk_style_context_add_class(gtk_widget_get_style_context(tab->handle), GTK_STYLE_CLASS_LINKED);
+    gtk_box_pack_start(GTK_BOX(tab->handle), tab->button, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(tab->handle), tab->close_button, FALSE, FALSE, 0);
+    gtk_widget_show_all(tab->handle);
+    gtk_box_pack_start(GTK_BOX(tabs->strip), tab->handle, FALSE, FALSE, 0);
+
+    tabs->tabs = g_list_append(tabs->tabs, tab);
+    update_close_buttons(tabs);
+
+    if (focus || !tabs->current) {
+        tab_focus(tab);
+    } else {
+        // Opened in the background: start loading, hibernate if left alone
+        tab_wake(tab);
+        tab_schedule_hibernate(tab);
+    }
+}
+
+void tabs_close_current(Tabs *tabs) {
+    if (tabs->current) tab_close(tabs->current);
+}
+
+void tabs_focus_next(Tabs *tabs) {
+    GList *link = g_list_find(tabs->tabs, tabs->current);
+    if (!link) return;
+    tab_focus(link->next ? link->next->data : tabs->tabs->data);
+}
+
+WebKitWebView *tabs_get_current_view(Tabs *tabs) {
+    return tabs->current ? tabs->current->view : NULL;
+}
+
+void tabs_foreach_view(Tabs *tabs, GFunc func, gpointer user_data) {
+    for (GList *l = tabs->tabs; l != NULL; l = l->next) {
+        Tab *tab = l->data;
+        if (tab->view) func(tab->view, user_data);
+    }
+}
+
+void tabs_hibernate_background(Tabs *tabs) {
+    for (GList *l = tabs->tabs; l != NULL; l = l->next) {
+        Tab *tab = l->data;
+        if (tab->hibernate_id) {
+            g_source_remove(tab->hibernate_id);
+            tab->hibernate_id = 0;
+        }
+        tab_hibernate(tab);
+    }
+}
+
+void tabs_suspend(Tabs *tabs) {
+    tabs->suspended = TRUE;
+    for (GList *l = tabs->tabs; l != NULL; l = l->next) {
+        Tab *tab = l->data;
+        if (tab->hibernate_id) {
+            g_source_remove(tab->hibernate_id);
+            tab->hibernate_id = 0;
+        }
+        tab_hibernate(tab);
+    }
+}
+
+void tabs_resume(Tabs *tabs) {
+    if (!tabs->suspended) return;
+    tabs->suspended = FALSE;
+
+    // Views whose scroll query hasn't come back yet are simply kept
+    for (GList *l = tabs->tabs; l != NULL; l = l->next) {
+        Tab *tab = l->data;
+        tab_cancel_hibernate(tab);
+        if (tab != tabs->current && tab->view) tab_schedule_hibernate(tab);
+    }
+    if (tabs->current) tab_focus(tabs->current);
+}
@@ -0,0 +1,41 @@
+#ifndef LEAF_CLASS_TABS_H
+#define LEAF_CLASS_TABS_H
+
+#include <gtk/gtk.h>
+#include <webkit2/webkit2.h>
+
+// Tab strip for the header bar plus a stack of pages for the window. Tabs
+// that stay in the background for hibernate_seconds give up their web view:
+// the URL, back/forward session and scroll position are kept and the view
+// is rebuilt when the tab is focused again. A playing or loading tab is
+// left alone until it settles.
+typedef struct _Tabs Tabs;
+
+// Builds an unloaded web view for a tab (settings, signal handlers); the
+// tab strip loads it
+typedef WebKitWebView *(*TabsCreateView)(gpointer user_data);
+// Called whenever the focused tab or its view changes
+typedef void (*TabsSwitched)(WebKitWebView *view, gpointer user_data);
+
+Tabs *tabs_new(guint hibernate_seconds, TabsCreateView create_view, TabsSwitched switched, gpointer user_data);
+// Closes every tab and destroys the bar and the stack
+void tabs_free(Tabs *tabs);
+
+GtkWidget *tabs_get_bar(Tabs *tabs);
+GtkWidget *tabs_get_stack(Tabs *tabs);
+
+void tabs_open(Tabs *tabs, const char *uri, gboolean focus);
+void tabs_close_current(Tabs *tabs);
+void tabs_focus_next(Tabs *tabs);
+
+WebKitWebView *tabs_get_current_view(Tabs *tabs);
+// Calls func on every live (not hibernated) view
+void tabs_foreach_view(Tabs *tabs, GFunc func, gpointer user_data);
+// Hibernates every background tab now, e.g. when memory runs short
+void tabs_hibernate_background(Tabs *tabs);
+// Hibernates every tab, the focused one too, e.g. while the window is
+// hidden; tabs_resume() wakes the focused tab again
+void tabs_suspend(Tabs *tabs);
+void tabs_resume(Tabs *tabs);
+
+#endif
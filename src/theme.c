@@ -0,0 +1,94 @@
+#include "theme.h"
+
+#include <string.h>
+
+struct _ThemeEngine {
+    GdkScreen *screen;
+    char *resource_prefix;
+    char *dev_dir;
+    GFileMonitor *monitor;
+    GHashTable *providers;  // name -> GtkCssProvider
+    GtkCssProvider *active;
+};
+
+static void on_parsing_error(GtkCssProvider *provider, GtkCssSection *section, GError *error, gpointer user_data) {
+    g_warning("Theme %s:%u: %s", (const char *)user_data,
+              gtk_css_section_get_start_line(section) + 1, error->message);
+}
+
+static void load_provider(ThemeEngine *engine, GtkCssProvider *provider, const char *name) {
+    if (engine->dev_dir) {
+        char *filename = g_strconcat(name, ".css", NULL);
+        char *path = g_build_filename(engine->dev_dir, filename, NULL);
+        gtk_css_provider_load_from_path(provider, path, NULL);
+        g_free(path);
+        g_free(filename);
+    } else {
+        char *resource = g_strconcat(engine->resource_prefix, "/css/", name, ".css", NULL);
+        gtk_css_provider_load_from_resource(provider, resource);
+        g_free(resource);
+    }
+}
+
+static GtkCssProvider *get_provider(ThemeEngine *engine, const char *name) {
+    GtkCssProvider *provider = g_hash_table_lookup(engine->providers, name);
+    if (provider) return provider;
+
+    char *key = g_strdup(name);
+    provider = gtk_css_provider_new();
+    g_signal_connect(provider, "parsing-error", G_CALLBACK(on_parsing_error), key);
+    load_provider(engine, provider, name);
+    g_hash_table_insert(engine->providers, key, provider);
+    return provider;
+}
+
+static void on_theme_file_changed(GFileMonitor *monitor, GFile *file, GFile *other_file,
+                                  GFileMonitorEvent event, gpointer user_data) {
+    ThemeEngine *engine = user_data;
+    if (event != G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT && event != G_FILE_MONITOR_EVENT_CREATED) return;
+
+    char *basename = g_file_get_basename(file);
+    if (g_str_has_suffix(basename, ".css")) {
+        basename[strlen(basename) - strlen(".css")] = '\0';
+
+        // Reloading an installed provider restyles the screen by itself
+        GtkCssProvider *provider = g_hash_table_lookup(engine->providers, basename);
+        if (provider) {
+            g_debug("theme: reloading %s", basename);
+            load_provider(engine, provider, basename);
+        }
+    }
+    g_free(basename);
+}
+
+ThemeEngine *theme_engine_new(GdkScreen *screen, const char *resource_prefix, const char *dev_dir) {
+    ThemeEngine *engine = g_new0(ThemeEngine, 1);
+    engine->screen = screen;
+    engine->resource_prefix = g_strdup(resource_prefix);
+    engine->providers = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_object_unref);
+
+    if (dev_dir && *dev_dir) {
+        engine->dev_dir = g_strdup(dev_dir);
+
+        GFile *dir = g_file_new_for_path(dev_dir);
+        engine->monitor = g_file_monitor_directory(dir, G_FILE_MONITOR_NONE, NULL, NULL);
+        if (engine->monitor) {
+            g_signal_connect(engine->monitor, "changed", G_CALLBACK(on_theme_file_changed), engine);
+        }
+        g_object_unref(dir);
+    }
+    return engine;
+}
+
+void theme_engine_set_theme(ThemeEngine *engine, const char *name) {
+    GtkCssProvider *provider = get_provider(engine, name);
+    if (provider == engine->active) return;
+
+    // Add the new sheet before dropping the old one so no frame is unstyled
+    gtk_style_context_add_provider_for_screen(engine->screen, GTK_STYLE_PROVIDER(provider),
+                                              GTK_STYLE_PROVIDER_PRIORITY_USER);
+    if (engine->active) {
+        gtk_style_context_remove_provider_for_screen(engine->screen, GTK_STYLE_PROVIDER(engine->active));
+    }
+    engine->active = provider;
+}
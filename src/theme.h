@@ -0,0 +1,18 @@
+#ifndef LEAF_CLASS_THEME_H
+#define LEAF_CLASS_THEME_H
+
+#include <gtk/gtk.h>
+
+// Keeps exactly one theme provider installed on the screen. Each theme is
+// parsed once and cached, so switching only swaps providers and costs the
+// same on every toggle.
+//
+// With a dev_dir (LEAF_CLASS_THEME_DIR, e.g. src/css) themes are read from
+// <dev_dir>/<name>.css instead of the bundled resources and reloaded in
+// place whenever the file changes.
+typedef struct _ThemeEngine ThemeEngine;
+
+ThemeEngine *theme_engine_new(GdkScreen *screen, const char *resource_prefix, const char *dev_dir);
+void theme_engine_set_theme(ThemeEngine *engine, const char *name);
+
+#endif
@@ -0,0 +1,147 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+static FILE *trace_file = NULL;
+static gboolean trace_first_event = TRUE;
+static GHashTable *trace_tracks = NULL;  // track -> tid
+static int trace_next_tid = 1;
+
+static void write_string(const char *text) {
+    fputc('"', trace_file);
+    for (const unsigned char *c = (const unsigned char *)text; c && *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', trace_file);
+            fputc(*c, trace_file);
+        } else if (*c < 0x20) {
+            fprintf(trace_file, "\\u%04x", *c);
+        } else {
+            fputc(*c, trace_file);
+        }
+    }
+    fputc('"', trace_file);
+}
+
+static void write_separator(void) {
+    fputs(trace_first_event ? "\n" : ",\n", trace_file);
+    trace_first_event = FALSE;
+}
+
+static int track_tid(gconstpointer track, const char *category) {
+    if (!track) return 0;
+
+    gpointer tid = g_hash_table_lookup(trace_tracks, track);
+    if (tid) return GPOINTER_TO_INT(tid);
+
+    // Name the row after the first category seen on it, e.g. "navigation 2"
+    int new_tid = trace_next_tid++;
+    g_hash_table_insert(trace_tracks, (gpointer)track, GINT_TO_POINTER(new_tid));
+
+    char *name = g_strdup_printf("%s %d", category, new_tid);
+    write_separator();
+    fprintf(trace_file, "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", getpid(), new_tid);
+    write_string(name);
+    fputs("}}", trace_file);
+    g_free(name);
+    return new_tid;
+}
+
+static void write_event(gconstpointer track, const char *category, const char *name, char phase,
+                        gint64 ts, gint64 dur, va_list args) {
+    int tid = track_tid(track, category);
+
+    write_separator();
+    fprintf(trace_file, "{\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":%" G_GINT64_FORMAT, phase, getpid(), tid, ts);
+    if (phase == 'X') fprintf(trace_file, ",\"dur\":%" G_GINT64_FORMAT, dur);
+    if (phase == 'i') fputs(",\"s\":\"t\"", trace_file);
+    fputs(",\"cat\":", trace_file);
+    write_string(category);
+    fputs(",\"name\":", trace_file);
+    write_string(name);
+
+    const char *key = va_arg(args, const char *);
+    if (key) {
+        fputs(",\"args\":{", trace_file);
+        for (gboolean first = TRUE; key; key = va_arg(args, const char *), first = FALSE) {
+            const char *value = va_arg(args, const char *);
+            if (!first) fputc(',', trace_file);
+            write_string(key);
+            fputc(':', trace_file);
+            write_string(value ? value : "");
+        }
+        fputc('}', trace_file);
+    }
+    fputc('}', trace_file);
+
+    // Readers poll the live file (bench/run.py) and a crash never reaches
+    // fclose(), so nothing may sit in stdio's buffer
+    fflush(trace_file);
+}
+
+void trace_open(const char *path) {
+    if (trace_file) return;
+
+    trace_file = fopen(path, "w");
+    if (!trace_file) {
+        g_warning("Could not open trace file %s", path);
+        return;
+    }
+
+    trace_tracks = g_hash_table_new(g_direct_hash, g_direct_equal);
+    fputs("[", trace_file);
+    write_separator();
+    fprintf(trace_file, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"Leaf Class\"}}", getpid());
+    fflush(trace_file);
+}
+
+void trace_close(void) {
+    if (!trace_file) return;
+
+    fputs("\n]\n", trace_file);
+    fclose(trace_file);
+    trace_file = NULL;
+    g_hash_table_destroy(trace_tracks);
+    trace_tracks = NULL;
+}
+
+gboolean trace_is_enabled(void) {
+    return trace_file != NULL;
+}
+
+void trace_instant(gconstpointer track, const char *category, const char *name, ...) {
+    if (!trace_file) return;
+
+    va_list args;
+    va_start(args, name);
+    write_event(track, category, name, 'i', g_get_monotonic_time(), 0, args);
+    va_end(args);
+}
+
+void trace_complete(gconstpointer track, const char *category, const char *name, gint64 start, gint64 end, ...) {
+    if (!trace_file) return;
+
+    va_list args;
+    va_start(args, end);
+    write_event(track, category, name, 'X', start, MAX(end - start, 0), args);
+    va_end(args);
+}
+
+void trace_begin(gconstpointer track, const char *category, const char *name, ...) {
+    if (!trace_file) return;
+
+    va_list args;
+    va_start(args, name);
+    write_event(track, category, name, 'B', g_get_monotonic_time(), 0, args);
+    va_end(args);
+}
+
+void trace_end(gconstpointer track, const char *category, const char *name, ...) {
+    if (!trace_file) return;
+
+    va_list args;
+    va_start(args, name);
+    write_event(track, category, name, 'E', g_get_monotonic_time(), 0, args);
+    va_end(args);
+}
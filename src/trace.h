@@ -0,0 +1,25 @@
+#ifndef LEAF_CLASS_TRACE_H
+#define LEAF_CLASS_TRACE_H
+
+#include <glib.h>
+
+// Process-wide trace in Chrome's trace-event JSON format (chrome://tracing,
+// Perfetto, speedscope). Events are streamed to the file as they happen, so
+// a trace cut short by a crash still loads. Every call is a no-op until
+// trace_open() succeeds.
+//
+// Timestamps are g_get_monotonic_time() microseconds. track groups events
+// into one row per object (a tab's view, a download); NULL is the
+// application row. Trailing arguments are key/value string pairs ending
+// in NULL and end up in the event's "args".
+void trace_open(const char *path);
+void trace_close(void);
+gboolean trace_is_enabled(void);
+
+void trace_instant(gconstpointer track, const char *category, const char *name, ...) G_GNUC_NULL_TERMINATED;
+void trace_complete(gconstpointer track, const char *category, const char *name,
+                    gint64 start, gint64 end, ...) G_GNUC_NULL_TERMINATED;
+void trace_begin(gconstpointer track, const char *category, const char *name, ...) G_GNUC_NULL_TERMINATED;
+void trace_end(gconstpointer track, const char *category, const char *name, ...) G_GNUC_NULL_TERMINATED;
+
+#endif
@@ -0,0 +1,123 @@
+#include "warmup.h"
+
+#include "config-store.h"
+
+// A host seen in a session scores 1 and loses half its score every launch
+// it isn't seen, so it is pre-resolved for about two sessions after last use
+#define WARMUP_DECAY 0.5
+#define WARMUP_MIN_SCORE 0.25
+#define WARMUP_MAX_LEARNED 24
+#define WARMUP_SAVE_DELAY_MS 10000
+
+struct _Warmup {
+    char *path;
+    GHashTable *scores;  // host -> double*, as loaded at startup
+    GHashTable *seen;    // hosts loaded from in this session
+    ConfigStore *store;
+};
+
+typedef struct {
+    const char *host;
+    double score;
+} HostScore;
+
+static gint compare_scores(gconstpointer a, gconstpointer b) {
+    const HostScore *x = a;
+    const HostScore *y = b;
+    return (x->score < y->score) - (x->score > y->score);
+}
+
+// Previous scores decayed, plus this session; highest first
+static GArray *rank_hosts(Warmup *warmup) {
+    GArray *ranked = g_array_new(FALSE, FALSE, sizeof(HostScore));
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, warmup->scores);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        HostScore entry = {key, *(double *)value * WARMUP_DECAY};
+        if (g_hash_table_contains(warmup->seen, key)) entry.score += 1.0;
+        g_array_append_val(ranked, entry);
+    }
+
+    g_hash_table_iter_init(&iter, warmup->seen);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        if (g_hash_table_contains(warmup->scores, key)) continue;
+        HostScore entry = {key, 1.0};
+        g_array_append_val(ranked, entry);
+    }
+
+    g_array_sort(ranked, compare_scores);
+    return ranked;
+}
+
+static void fill_learned(GKeyFile *key_file, gpointer user_data) {
+    Warmup *warmup = user_data;
+    GArray *ranked = rank_hosts(warmup);
+
+    for (guint i = 0; i < ranked->len && i < WARMUP_MAX_LEARNED; i++) {
+        HostScore *entry = &g_array_index(ranked, HostScore, i);
+        if (entry->score < WARMUP_MIN_SCORE) break;
+        g_key_file_set_double(key_file, "Hosts", entry->host, entry->score);
+    }
+
+    g_array_unref(ranked);
+}
+
+static void on_resource_load_started(WebKitWebView *webview, WebKitWebResource *resource,
+                                     WebKitURIRequest *request, gpointer user_data) {
+    Warmup *warmup = user_data;
+    GUri *uri = g_uri_parse(webkit_uri_request_get_uri(request), G_URI_FLAGS_NONE, NULL);
+    if (!uri) return;
+
+    const char *scheme = g_uri_get_scheme(uri);
+    char *host = g_uri_get_host(uri) ? g_ascii_strdown(g_uri_get_host(uri), -1) : NULL;
+    if (host && *host && (g_strcmp0(scheme, "https") == 0 || g_strcmp0(scheme, "http") == 0) &&
+        !g_hash_table_contains(warmup->seen, host)) {
+        g_hash_table_add(warmup->seen, host);
+        host = NULL;
+        config_store_mark_dirty(warmup->store);
+    }
+
+    g_free(host);
+    g_uri_unref(uri);
+}
+
+Warmup *warmup_new(WebKitWebContext *context, const char *data_dir, const char *const *hosts) {
+    Warmup *warmup = g_new0(Warmup, 1);
+    warmup->path = g_build_filename(data_dir, "learned-hosts.ini", NULL);
+    warmup->scores = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    warmup->seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    warmup->store = config_store_new_key_file(warmup->path, WARMUP_SAVE_DELAY_MS, fill_learned, warmup);
+
+    GHashTable *prefetched = g_hash_table_new(g_str_hash, g_str_equal);
+    for (int i = 0; hosts && hosts[i] != NULL; i++) {
+        if (!*hosts[i] || !g_hash_table_add(prefetched, (gpointer)hosts[i])) continue;
+        webkit_web_context_prefetch_dns(context, hosts[i]);
+    }
+
+    GKeyFile *key_file = g_key_file_new();
+    if (g_key_file_load_from_file(key_file, warmup->path, G_KEY_FILE_NONE, NULL)) {
+        gchar **learned = g_key_file_get_keys(key_file, "Hosts", NULL, NULL);
+        for (int i = 0; learned && learned[i] != NULL; i++) {
+            double *score = g_new(double, 1);
+            *score = g_key_file_get_double(key_file, "Hosts", learned[i], NULL);
+            g_hash_table_replace(warmup->scores, g_strdup(learned[i]), score);
+
+            if (*score >= WARMUP_MIN_SCORE && !g_hash_table_contains(prefetched, learned[i])) {
+                webkit_web_context_prefetch_dns(context, learned[i]);
+            }
+        }
+        g_strfreev(learned);
+    }
+
+    g_debug("warmup: prefetching DNS for %u configured and %u learned hosts",
+            g_hash_table_size(prefetched), g_hash_table_size(warmup->scores));
+    g_key_file_free(key_file);
+    g_hash_table_destroy(prefetched);
+    return warmup;
+}
+
+void warmup_watch_view(Warmup *warmup, WebKitWebView *webview) {
+    g_signal_connect(webview, "resource-load-started", G_CALLBACK(on_resource_load_started), warmup);
+}
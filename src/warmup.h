@@ -0,0 +1,16 @@
+#ifndef LEAF_CLASS_WARMUP_H
+#define LEAF_CLASS_WARMUP_H
+
+#include <webkit2/webkit2.h>
+
+// Startup network warm-up. DNS for the configured hosts, and for the hosts
+// recent sessions actually loaded from, is resolved as soon as the context
+// exists, so the first page load doesn't queue behind DNS for
+// accounts.google.com, gstatic and friends. Hosts are learned from watched
+// views and kept in <data_dir>/learned-hosts.ini.
+typedef struct _Warmup Warmup;
+
+Warmup *warmup_new(WebKitWebContext *context, const char *data_dir, const char *const *hosts);
+void warmup_watch_view(Warmup *warmup, WebKitWebView *webview);
+
+#endif